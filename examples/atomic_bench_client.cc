@@ -0,0 +1,138 @@
+#include <iomanip>
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+// Remote atomics microbenchmark. The server exposes an array of 64-bit counters and stays passive while
+// the client issues atomics on them:
+//   latency:    a single blocking FetchAdd/CompareSwap/Swap per iteration
+//   throughput: AtomicV with a window of K fetch-adds in flight at once, spread over the counters
+// In the end the server checks that the counters add up to the # of fetch-adds issued.
+
+struct atomic_config {
+  uint64_t num_counters;
+  uint64_t window;
+  uint64_t num_iters;
+};
+
+// runs (op) for (num_iters) iterations and returns the elapsed time (0 if unsupported).
+template <typename F>
+uint64_t run_atomic(F op, uint64_t num_iters) {
+  // warm up (and find out whether atomics are supported at all)
+  if (!op()) {
+    return 0;
+  }
+
+  auto beg = now_nsecs();
+  for (uint64_t i = 0; i < num_iters; i++) {
+    op();
+  }
+  return std::max<uint64_t>(now_nsecs() - beg, 1);
+}
+
+void print_latency(rnetlib::Channel &channel, const atomic_config &conf, const rnetlib::RemoteMemoryRegion &rmr,
+                   uint64_t &num_adds) {
+  std::cout << "# Atomic latency" << std::endl;
+  std::cout << "FetchAdd[us]" << "\t" << "CompareSwap[us]" << "\t" << "Swap[us]" << std::endl;
+
+  // the last counter is the one compare-swaps and swaps work on, so that the others only get added to.
+  auto last = (conf.num_counters - 1) * sizeof(uint64_t);
+  uint64_t prev = 0;
+  auto add_nsecs = run_atomic([&]() {
+    num_adds++;
+    return channel.FetchAdd(rmr, 0, 1, prev);
+  }, conf.num_iters);
+  if (add_nsecs == 0) {
+    num_adds--;
+    std::cout << "unsupported" << std::endl;
+    return;
+  }
+  // the last counter flips between 0 and 1
+  auto cas_nsecs = run_atomic([&]() { return channel.CompareSwap(rmr, last, prev, prev ^ 1, prev); },
+                              conf.num_iters);
+  auto swap_nsecs = run_atomic([&]() { return channel.Swap(rmr, last, 0, prev); }, conf.num_iters);
+
+  std::cout << std::fixed << std::setprecision(2);
+  for (auto nsecs : {add_nsecs, cas_nsecs, swap_nsecs}) {
+    if (nsecs) {
+      std::cout << nsecs / 1e3 / conf.num_iters;
+    } else {
+      std::cout << "n/a";
+    }
+    std::cout << "\t";
+  }
+  std::cout << std::endl;
+}
+
+void print_throughput(rnetlib::Channel &channel, const atomic_config &conf, const rnetlib::RemoteMemoryRegion &rmr,
+                      uint64_t &num_adds) {
+  std::cout << "# Atomic throughput" << std::endl;
+  std::cout << "Window" << "\t" << "FetchAdd[ops/s]" << std::endl;
+
+  auto num_targets = std::max<uint64_t>(conf.num_counters - 1, 1);
+  for (uint64_t window = 1; window <= conf.window; window <<= 1) {
+    std::vector<rnetlib::AtomicOp> ops(window);
+    for (uint64_t w = 0; w < window; w++) {
+      ops[w].opcode = rnetlib::ATOMIC_FETCH_ADD;
+      ops[w].rmr = rmr;
+      ops[w].offset = (w % num_targets) * sizeof(uint64_t);
+      ops[w].operand = 1;
+    }
+
+    uint64_t num_calls = 0;
+    auto nsecs = run_atomic([&]() {
+      num_calls++;
+      return channel.AtomicV(ops.data(), ops.size()) == ops.size();
+    }, conf.num_iters);
+    if (nsecs == 0) {
+      std::cout << "unsupported" << std::endl;
+      return;
+    }
+    num_adds += num_calls * window;
+
+    std::cout << std::fixed << std::setprecision(2) << window << "\t"
+              << static_cast<double>(window * conf.num_iters) * 1e9 / nsecs << std::endl;
+  }
+}
+
+int main(int argc, const char **argv) {
+  if (argc != 7) {
+    std::cerr << "Usage: " << argv[0] << " [addr] [port] [ofi|verbs] [num_counters] [window] [num_iters]"
+              << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[3], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[3] << std::endl;
+    return 1;
+  }
+  if (prov == rnetlib::PROV_SOCKET) {
+    std::cerr << "ERROR: socket channels have no atomics" << std::endl;
+    return 1;
+  }
+  atomic_config conf;
+  conf.num_counters = std::max<uint64_t>(std::stoul(argv[4]), 2);
+  conf.window = std::max<uint64_t>(std::stoul(argv[5]), 1);
+  conf.num_iters = std::max<uint64_t>(std::stoul(argv[6]), 1);
+
+  // FIXME: handle errors
+  auto client = rnetlib::NewClient(prov, 0, opts);
+  auto channel = client->Connect(argv[1], static_cast<uint16_t>(std::stoul(argv[2])));
+  channel->Send(&conf, sizeof(conf));
+
+  rnetlib::RemoteMemoryRegion rmr;
+  channel->AckRemoteMemoryRegionV(&rmr, 1);
+
+  uint64_t num_adds = 0;
+  print_latency(*channel, conf, rmr, num_adds);
+  print_throughput(*channel, conf, rmr, num_adds);
+
+  // lets the server check the counters
+  channel->Send(&num_adds, sizeof(num_adds));
+
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct atomic_config {
+  uint64_t num_counters;
+  uint64_t window;
+  uint64_t num_iters;
+};
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [ofi|verbs]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[2], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+  if (prov == rnetlib::PROV_SOCKET) {
+    std::cerr << "ERROR: socket channels have no atomics" << std::endl;
+    return 1;
+  }
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov, opts);
+  server->Listen();
+  auto channel = server->Accept();
+
+  atomic_config conf;
+  channel->Recv(&conf, sizeof(conf));
+
+  // the targets of every atomic issued by the client.
+  std::vector<uint64_t> counters(conf.num_counters, 0);
+  auto lmr = channel->RegisterMemoryRegion(counters.data(), counters.size() * sizeof(uint64_t),
+                                           rnetlib::MR_REMOTE_ATOMIC);
+  channel->SynRemoteMemoryRegionV(&lmr, 1);
+
+  // stay passive until the client tells how many fetch-adds it has issued.
+  uint64_t num_adds = 0;
+  channel->Recv(&num_adds, sizeof(num_adds));
+
+  // the last counter is not added to
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i + 1 < conf.num_counters; i++) {
+    sum += counters[i];
+  }
+  std::cout << "fetch-adds: " << num_adds << ", counted: " << sum << ((sum == num_adds) ? "" : " (MISMATCH)")
+            << std::endl;
+
+  return sum == num_adds ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#ifndef RNETLIB_EXAMPLES_BENCH_UTIL_H_
+#define RNETLIB_EXAMPLES_BENCH_UTIL_H_
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <rnetlib/rnetlib.h>
+
+// parse a provider name given on the command line ("socket", "ofi" or "verbs").
+static bool parse_prov(const std::string &name, rnetlib::Prov &prov) {
+  if (name == "socket") {
+    prov = rnetlib::PROV_SOCKET;
+  } else if (name == "ofi") {
+    prov = rnetlib::PROV_OFI;
+  } else if (name == "verbs") {
+    prov = rnetlib::PROV_VERBS;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// same as above, but also takes options given as suffixes (e.g., "verbs+shared+ring").
+static bool parse_prov(const std::string &name, rnetlib::Prov &prov, int &opts) {
+  auto pos = name.find('+');
+  opts = 0;
+  while (pos != std::string::npos) {
+    auto next = name.find('+', pos + 1);
+    auto opt = name.substr(pos + 1, (next == std::string::npos) ? std::string::npos : next - pos - 1);
+    if (opt == "shared") {
+      opts |= rnetlib::OPT_SHARED_QUEUES;
+    } else if (opt == "ring") {
+      opts |= rnetlib::OPT_EAGER_RING;
+    } else if (opt == "private") {
+      opts |= rnetlib::OPT_PRIVATE_ENDPOINTS;
+    } else if (opt == "mrecv") {
+      opts |= rnetlib::OPT_MULTI_RECV;
+    } else if (opt == "progress") {
+      opts |= rnetlib::OPT_PROGRESS_THREAD;
+    } else {
+      return false;
+    }
+    pos = next;
+  }
+
+  return parse_prov(name.substr(0, name.find('+')), prov);
+}
+
+static uint64_t now_nsecs() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// CPU time consumed by the calling thread.
+static uint64_t thread_cpu_nsecs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// resident set size of this process in bytes.
+static uint64_t resident_bytes() {
+  uint64_t size = 0, resident = 0;
+  std::ifstream statm("/proc/self/statm");
+  statm >> size >> resident;
+  return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+// raises the soft limit of open file descriptors up to the hard limit.
+static void raise_fd_limit() {
+  struct rlimit rlim;
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+}
+
+// returns a CPU cycle count (the TSC on x86; nanoseconds elsewhere).
+static uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return now_nsecs();
+#endif
+}
+
+// busy-waits until the given point in time (in now_nsecs() units).
+static void spin_until(uint64_t deadline_nsecs) {
+  while (now_nsecs() < deadline_nsecs);
+}
+
+// prints the non-zero counters of a snapshot (nothing unless built with RNETLIB_ENABLE_PERF_COUNTERS).
+static void print_perf(const std::string &desc, const rnetlib::PerfSnapshot &snapshot) {
+  for (int i = 0; i < rnetlib::PERF_NUM_COUNTERS; i++) {
+    auto counter = static_cast<rnetlib::PerfCounter>(i);
+    if (snapshot[counter]) {
+      std::cerr << "# " << desc << " " << rnetlib::PerfSnapshot::GetName(counter) << ": " << snapshot[counter] << std::endl;
+    }
+  }
+}
+
+// A log-linear histogram in the spirit of HdrHistogram.
+// Values (in nanoseconds) are recorded with a relative error below 0.1% over the whole 64-bit range.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(static_cast<size_t>(kNumBuckets), 0), total_count_(0), max_value_(0) {}
+
+  void Record(uint64_t value) {
+    counts_[GetIndex(value)]++;
+    total_count_++;
+    if (value > max_value_) {
+      max_value_ = value;
+    }
+  }
+
+  // returns the value at the given percentile (0 < percentile <= 100).
+  uint64_t GetPercentile(double percentile) const {
+    if (total_count_ == 0) {
+      return 0;
+    }
+
+    auto target = static_cast<uint64_t>(percentile / 100. * total_count_ + 0.5);
+    if (target == 0) {
+      target = 1;
+    }
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      cumulative += counts_[i];
+      if (cumulative >= target) {
+        auto upper = GetUpperBound(i);
+        return (upper < max_value_) ? upper : max_value_;
+      }
+    }
+
+    return max_value_;
+  }
+
+  uint64_t GetMax() const { return max_value_; }
+
+  uint64_t GetTotalCount() const { return total_count_; }
+
+  void Reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_count_ = 0;
+    max_value_ = 0;
+  }
+
+ private:
+  static const int kSubBucketBits = 11;
+  static const uint64_t kSubBucketCount = (1ULL << kSubBucketBits);
+  static const uint64_t kSubBucketHalf = (kSubBucketCount >> 1);
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBucketHalf + kSubBucketHalf;
+  std::vector<uint64_t> counts_;
+  uint64_t total_count_;
+  uint64_t max_value_;
+
+  static size_t GetIndex(uint64_t value) {
+    if (value < kSubBucketCount) {
+      return value;
+    }
+
+    // the shift keeps the top kSubBucketBits bits of the value.
+    int shift = (63 - __builtin_clzll(value)) - kSubBucketBits + 1;
+    return shift * kSubBucketHalf + (value >> shift);
+  }
+
+  static uint64_t GetUpperBound(size_t index) {
+    if (index < kSubBucketCount) {
+      return index;
+    }
+
+    int shift = static_cast<int>(index / kSubBucketHalf) - 1;
+    uint64_t sub_bucket = index - shift * kSubBucketHalf;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+};
+
+#endif // RNETLIB_EXAMPLES_BENCH_UTIL_H_
@@ -0,0 +1,167 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+// Connection scalability over loopback.
+// For every number of channels N given on the command line, this opens N channels and reports
+// the connect time and resident memory per channel on both sides, the latency until the server's
+// event loop (waiting on all N channels) observes a message on one of a few active channels,
+// and the aggregate throughput when all N channels are active.
+// Wakeup latencies compare timestamps taken in two processes, so both must run on the same host.
+// "verbs+shared" lets the channels share a receive queue and a CQ on both sides (msg_size <= EAGER_THRESHOLD).
+
+struct scale_config {
+  uint64_t num_channels;
+  uint64_t num_active;
+  uint64_t num_rounds;
+  uint64_t msg_size;
+  uint64_t num_iters;
+};
+
+struct scale_report {
+  uint64_t mem_bytes;
+  uint64_t wakeup_p50;
+  uint64_t wakeup_p99;
+  uint64_t wakeup_max;
+};
+
+bool drive_wakeup(const scale_config &conf, std::vector<rnetlib::Channel::ptr> &channels, rnetlib::Channel &ctrl) {
+  uint64_t supported = 0;
+  ctrl.Recv(&supported, sizeof(supported));
+  if (!supported) {
+    return false;
+  }
+
+  std::vector<uint64_t> indices(conf.num_channels);
+  for (uint64_t i = 0; i < conf.num_channels; i++) {
+    indices[i] = i;
+  }
+  std::mt19937_64 engine(42);
+
+  for (uint64_t r = 0; r < conf.num_rounds; r++) {
+    // pick a few distinct channels to be active in this round.
+    for (uint64_t a = 0; a < conf.num_active; a++) {
+      std::uniform_int_distribution<uint64_t> dist(a, conf.num_channels - 1);
+      std::swap(indices[a], indices[dist(engine)]);
+    }
+    ctrl.Send(indices.data(), sizeof(uint64_t) * conf.num_active);
+    uint64_t go = 0;
+    ctrl.Recv(&go, sizeof(go));
+
+    for (uint64_t a = 0; a < conf.num_active; a++) {
+      auto stamp = now_nsecs();
+      channels[indices[a]]->Send(&stamp, sizeof(stamp));
+    }
+  }
+
+  // retire the timestamp receives still outstanding on the server.
+  for (auto &channel : channels) {
+    uint64_t dummy = 0;
+    channel->Send(&dummy, sizeof(dummy));
+  }
+
+  return true;
+}
+
+uint64_t drive_throughput(rnetlib::Prov prov, const scale_config &conf, std::vector<rnetlib::Channel::ptr> &channels,
+                          rnetlib::Channel &ctrl, bool async) {
+  std::unique_ptr<char[]> msg(new char[conf.msg_size]);
+  std::memset(msg.get(), 'a', conf.msg_size);
+  auto evloop = rnetlib::NewEventLoop(prov);
+
+  auto beg = now_nsecs();
+  for (uint64_t i = 0; i < conf.num_iters; i++) {
+    for (auto &channel : channels) {
+      if (async) {
+        channel->ISend(msg.get(), conf.msg_size, evloop);
+      } else {
+        channel->Send(msg.get(), conf.msg_size);
+      }
+    }
+    evloop->WaitAll(-1);
+  }
+  uint64_t ack = 0;
+  ctrl.Recv(&ack, sizeof(ack));
+
+  return now_nsecs() - beg;
+}
+
+int main(int argc, const char **argv) {
+  if (argc < 8) {
+    std::cerr << "Usage: " << argv[0] << " [addr] [port] [socket|ofi|verbs[+shared]] [num_active]"
+              << " [msg_size] [num_iters] [num_channels]..." << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[3], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[3] << std::endl;
+    return 1;
+  }
+  std::string addr(argv[1]);
+  auto port = static_cast<uint16_t>(std::stoul(argv[2]));
+  raise_fd_limit();
+
+  // FIXME: handle errors
+  auto client = rnetlib::NewClient(prov, 0, opts);
+  auto ctrl = client->Connect(addr, port);
+
+  std::cout << "Channels" << "\t" << "Connect[us/ch]" << "\t" << "ClientMem[KiB/ch]" << "\t" << "ServerMem[KiB/ch]"
+            << "\t" << "Wakeup-p50[us]" << "\t" << "Wakeup-p99[us]" << "\t" << "Wakeup-max[us]"
+            << "\t" << "Throughput[Gbit/s]" << std::endl;
+
+  for (int i = 7; i < argc; i++) {
+    scale_config conf;
+    conf.num_channels = std::stoul(argv[i]);
+    conf.num_active = std::min(static_cast<uint64_t>(std::stoul(argv[4])), conf.num_channels);
+    conf.num_rounds = 200;
+    conf.msg_size = std::stoul(argv[5]);
+    conf.num_iters = std::stoul(argv[6]);
+    if (conf.num_channels == 0) {
+      continue;
+    }
+    ctrl->Send(&conf, sizeof(conf));
+
+    auto mem_beg = resident_bytes();
+    auto beg = now_nsecs();
+    std::vector<rnetlib::Channel::ptr> channels;
+    for (uint64_t c = 0; c < conf.num_channels; c++) {
+      channels.emplace_back(client->Connect(addr, port));
+      if (!channels.back()) {
+        std::cerr << "ERROR: failed to connect channel #" << c << std::endl;
+        return 1;
+      }
+    }
+    auto connect_nsecs = now_nsecs() - beg;
+    auto mem_end = resident_bytes();
+    auto mem_bytes = (mem_end > mem_beg) ? (mem_end - mem_beg) : 0;
+
+    auto async = drive_wakeup(conf, channels, *ctrl);
+    auto dur = drive_throughput(prov, conf, channels, *ctrl, async);
+
+    scale_report report;
+    ctrl->Recv(&report, sizeof(report));
+
+    double num_channels = static_cast<double>(conf.num_channels);
+    std::cout << std::fixed << std::setprecision(2)
+              << conf.num_channels << "\t" << connect_nsecs / num_channels / 1e3 << "\t"
+              << mem_bytes / num_channels / 1024. << "\t" << report.mem_bytes / num_channels / 1024. << "\t";
+    if (async) {
+      std::cout << report.wakeup_p50 / 1e3 << "\t" << report.wakeup_p99 / 1e3 << "\t" << report.wakeup_max / 1e3;
+    } else {
+      std::cout << "n/a" << "\t" << "n/a" << "\t" << "n/a";
+    }
+    std::cout << "\t" << (8. * conf.msg_size * conf.num_iters * num_channels) / dur << std::endl;
+  }
+
+  scale_config fin;
+  std::memset(&fin, 0, sizeof(fin));
+  ctrl->Send(&fin, sizeof(fin));
+
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct scale_config {
+  uint64_t num_channels;
+  uint64_t num_active;
+  uint64_t num_rounds;
+  uint64_t msg_size;
+  uint64_t num_iters;
+};
+
+struct scale_report {
+  uint64_t mem_bytes;
+  uint64_t wakeup_p50;
+  uint64_t wakeup_p99;
+  uint64_t wakeup_max;
+};
+
+// posts a timestamp receive on every channel and measures how long it takes the event loop
+// to observe the few timestamps the client sends in each round.
+bool measure_wakeup(rnetlib::Prov prov, const scale_config &conf, std::vector<rnetlib::Channel::ptr> &channels,
+                    rnetlib::Channel &ctrl, LatencyHistogram &hist) {
+  std::vector<uint64_t> stamps(conf.num_channels, 0);
+  auto evloop = rnetlib::NewEventLoop(prov);
+
+  uint64_t supported = 1;
+  for (uint64_t i = 0; i < conf.num_channels; i++) {
+    if (channels[i]->IRecv(&stamps[i], sizeof(stamps[i]), evloop) != sizeof(stamps[i])) {
+      supported = 0;
+      break;
+    }
+  }
+  ctrl.Send(&supported, sizeof(supported));
+  if (!supported) {
+    return false;
+  }
+
+  std::vector<uint64_t> active(conf.num_active);
+  std::vector<bool> observed(conf.num_active);
+  for (uint64_t r = 0; r < conf.num_rounds; r++) {
+    ctrl.Recv(active.data(), sizeof(uint64_t) * active.size());
+    ctrl.Send(&r, sizeof(r));
+
+    std::fill(observed.begin(), observed.end(), false);
+    uint64_t num_observed = 0;
+    while (num_observed < active.size()) {
+      evloop->WaitAll(0);
+      auto now = now_nsecs();
+      for (size_t a = 0; a < active.size(); a++) {
+        if (!observed[a] && stamps[active[a]] != 0) {
+          hist.Record(now - stamps[active[a]]);
+          observed[a] = true;
+          num_observed++;
+        }
+      }
+    }
+
+    for (auto idx : active) {
+      stamps[idx] = 0;
+      channels[idx]->IRecv(&stamps[idx], sizeof(stamps[idx]), evloop);
+    }
+  }
+
+  // the client finally sends a dummy timestamp to every channel to retire the outstanding receives.
+  evloop->WaitAll(-1);
+
+  return true;
+}
+
+void measure_throughput(rnetlib::Prov prov, const scale_config &conf, std::vector<rnetlib::Channel::ptr> &channels,
+                        rnetlib::Channel &ctrl, bool async) {
+  std::unique_ptr<char[]> msg(new char[conf.msg_size]);
+  auto evloop = rnetlib::NewEventLoop(prov);
+
+  for (uint64_t i = 0; i < conf.num_iters; i++) {
+    for (auto &channel : channels) {
+      if (async) {
+        channel->IRecv(msg.get(), conf.msg_size, evloop);
+      } else {
+        channel->Recv(msg.get(), conf.msg_size);
+      }
+    }
+    evloop->WaitAll(-1);
+  }
+
+  uint64_t ack = 1;
+  ctrl.Send(&ack, sizeof(ack));
+}
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [socket|ofi|verbs[+shared]]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[2], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+  raise_fd_limit();
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov, opts);
+  server->Listen();
+  auto ctrl = server->Accept();
+
+  while (true) {
+    scale_config conf;
+    if (ctrl->Recv(&conf, sizeof(conf)) != sizeof(conf) || conf.num_channels == 0) {
+      break;
+    }
+
+    auto mem_beg = resident_bytes();
+    std::vector<rnetlib::Channel::ptr> channels;
+    for (uint64_t i = 0; i < conf.num_channels; i++) {
+      channels.emplace_back(server->Accept());
+    }
+
+    scale_report report;
+    std::memset(&report, 0, sizeof(report));
+    auto mem_end = resident_bytes();
+    report.mem_bytes = (mem_end > mem_beg) ? (mem_end - mem_beg) : 0;
+
+    // providers without async receives fall back to blocking ones for the throughput phase.
+    LatencyHistogram hist;
+    auto async = measure_wakeup(prov, conf, channels, *ctrl, hist);
+    if (async) {
+      report.wakeup_p50 = hist.GetPercentile(50);
+      report.wakeup_p99 = hist.GetPercentile(99);
+      report.wakeup_max = hist.GetMax();
+    }
+    measure_throughput(prov, conf, channels, *ctrl, async);
+
+    ctrl->Send(&report, sizeof(report));
+  }
+
+  return 0;
+}
@@ -0,0 +1,176 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+// Open-loop latency under load.
+// Requests are issued on a fixed schedule (constant or Poisson inter-arrival times) regardless of
+// whether earlier requests have been answered. Each latency is measured from the time the request
+// was *supposed* to be sent, so stalls in the sender are charged to every request they delay
+// (coordinated-omission correction).
+
+struct load_ctrl {
+  uint64_t msg_size;
+  uint64_t num_msgs;
+};
+
+struct load_msg_hdr {
+  uint64_t seq;
+  uint64_t intended_nsecs;
+};
+
+// the last 8 bytes of every message repeat the sequence number so that
+// the async path can tell when an echo has been received completely.
+static const size_t kMinMsgSize = sizeof(load_msg_hdr) + sizeof(uint64_t);
+static const size_t kAsyncWindow = 64;
+
+static void write_msg(char *msg, size_t msg_size, uint64_t seq, uint64_t intended_nsecs) {
+  load_msg_hdr hdr = {seq, intended_nsecs};
+  std::memcpy(msg, &hdr, sizeof(hdr));
+  std::memcpy(msg + msg_size - sizeof(seq), &seq, sizeof(seq));
+}
+
+static bool is_msg_complete(const char *msg, size_t msg_size, uint64_t seq) {
+  uint64_t tail;
+  std::memcpy(&tail, msg + msg_size - sizeof(tail), sizeof(tail));
+  return (tail == seq);
+}
+
+static uint64_t read_intended(const char *msg) {
+  load_msg_hdr hdr;
+  std::memcpy(&hdr, msg, sizeof(hdr));
+  return hdr.intended_nsecs;
+}
+
+static std::vector<uint64_t> make_schedule(double rate, bool poisson, size_t num_msgs, uint64_t start_nsecs) {
+  std::vector<uint64_t> schedule(num_msgs);
+  std::mt19937_64 engine(42);
+  std::exponential_distribution<double> exp_dist(rate);
+  double offset_secs = 0;
+
+  for (size_t i = 0; i < num_msgs; i++) {
+    offset_secs += poisson ? exp_dist(engine) : (1. / rate);
+    schedule[i] = start_nsecs + static_cast<uint64_t>(offset_secs * 1e9);
+  }
+
+  return schedule;
+}
+
+bool run_sync(rnetlib::Channel &channel, size_t msg_size, const std::vector<uint64_t> &schedule,
+              LatencyHistogram &hist) {
+  std::unique_ptr<char[]> msg(new char[msg_size]());
+  auto lmr = channel.RegisterMemoryRegion(msg.get(), msg_size, rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE);
+
+  for (size_t i = 0; i < schedule.size(); i++) {
+    spin_until(schedule[i]);
+    write_msg(msg.get(), msg_size, i + 1, schedule[i]);
+    if (channel.Send(lmr) != msg_size || channel.Recv(lmr) != msg_size) {
+      std::cerr << "ERROR: sync echo" << std::endl;
+      return false;
+    }
+    hist.Record(now_nsecs() - read_intended(msg.get()));
+  }
+
+  return true;
+}
+
+bool run_async(rnetlib::Channel &channel, rnetlib::Prov prov, size_t msg_size, const std::vector<uint64_t> &schedule,
+               LatencyHistogram &hist) {
+  std::unique_ptr<char[]> tx_msgs(new char[msg_size * kAsyncWindow]());
+  std::unique_ptr<char[]> rx_msgs(new char[msg_size * kAsyncWindow]());
+  auto evloop = rnetlib::NewEventLoop(prov);
+  size_t num_sent = 0, num_done = 0;
+
+  while (num_done < schedule.size()) {
+    // issue the next request once its time has come, as long as the window has room.
+    // when the window is full the request is delayed, but its latency still counts from the schedule.
+    if (num_sent < schedule.size() && (num_sent - num_done) < kAsyncWindow && now_nsecs() >= schedule[num_sent]) {
+      auto slot = num_sent % kAsyncWindow;
+      auto tx_msg = tx_msgs.get() + slot * msg_size;
+      auto rx_msg = rx_msgs.get() + slot * msg_size;
+
+      std::memset(rx_msg, 0, msg_size);
+      write_msg(tx_msg, msg_size, num_sent + 1, schedule[num_sent]);
+      if (channel.IRecv(rx_msg, msg_size, evloop) != msg_size || channel.ISend(tx_msg, msg_size, evloop) != msg_size) {
+        std::cerr << "ERROR: async send/recv is not supported by this provider" << std::endl;
+        return false;
+      }
+      num_sent++;
+    }
+
+    evloop->WaitAll(0);
+
+    while (num_done < num_sent) {
+      auto rx_msg = rx_msgs.get() + (num_done % kAsyncWindow) * msg_size;
+      if (!is_msg_complete(rx_msg, msg_size, num_done + 1)) {
+        break;
+      }
+      hist.Record(now_nsecs() - read_intended(rx_msg));
+      num_done++;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, const char **argv) {
+  if (argc < 9) {
+    std::cerr << "Usage: " << argv[0] << " [addr] [port] [socket|ofi|verbs[+ring]] [sync|async] [const|poisson]"
+              << " [msg_size] [num_msgs] [rate(msgs/s)]..." << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[3], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[3] << std::endl;
+    return 1;
+  }
+  bool async = (std::string(argv[4]) == "async");
+  if (async && (opts & rnetlib::OPT_EAGER_RING)) {
+    // the server echoes with Recv()/Send(), which take the ring while ISend()/IRecv() do not
+    std::cerr << "ERROR: the eager ring is for the sync mode only" << std::endl;
+    return 1;
+  }
+  bool poisson = (std::string(argv[5]) == "poisson");
+  size_t msg_size = std::max(static_cast<size_t>(std::stoul(argv[6])), kMinMsgSize);
+  size_t num_msgs = std::stoul(argv[7]);
+
+  // FIXME: handle errors
+  auto client = rnetlib::NewClient(prov, 0, opts);
+  auto channel = client->Connect(argv[1], static_cast<uint16_t>(std::stoul(argv[2])));
+
+  std::cout << "Offered[msgs/s]" << "\t" << "Achieved[msgs/s]" << "\t" << "p50[us]" << "\t" << "p99[us]"
+            << "\t" << "p99.9[us]" << "\t" << "p99.99[us]" << "\t" << "Max[us]" << std::endl;
+
+  LatencyHistogram hist;
+  for (int i = 8; i < argc; i++) {
+    double rate = std::stod(argv[i]);
+    load_ctrl ctrl = {msg_size, num_msgs};
+    channel->Send(&ctrl, sizeof(ctrl));
+
+    hist.Reset();
+    auto schedule = make_schedule(rate, poisson, num_msgs, now_nsecs());
+    auto beg = now_nsecs();
+    auto ok = async ? run_async(*channel, prov, msg_size, schedule, hist)
+                    : run_sync(*channel, msg_size, schedule, hist);
+    auto end = now_nsecs();
+    if (!ok) {
+      return 1;
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << rate << "\t" << (num_msgs * 1e9) / (end - beg) << "\t"
+              << hist.GetPercentile(50) / 1e3 << "\t" << hist.GetPercentile(99) / 1e3 << "\t"
+              << hist.GetPercentile(99.9) / 1e3 << "\t" << hist.GetPercentile(99.99) / 1e3 << "\t"
+              << hist.GetMax() / 1e3 << std::endl;
+  }
+
+  load_ctrl fin = {0, 0};
+  channel->Send(&fin, sizeof(fin));
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct load_ctrl {
+  uint64_t msg_size;
+  uint64_t num_msgs;
+};
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [socket|ofi|verbs[+ring]]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[2], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov, opts);
+  server->Listen();
+  auto channel = server->Accept();
+
+  // echo every request back as-is, one offered-load level at a time.
+  while (true) {
+    load_ctrl ctrl;
+    if (channel->Recv(&ctrl, sizeof(ctrl)) != sizeof(ctrl) || ctrl.num_msgs == 0) {
+      break;
+    }
+
+    std::unique_ptr<char[]> msg(new char[ctrl.msg_size]);
+    auto lmr = channel->RegisterMemoryRegion(msg.get(), ctrl.msg_size,
+                                             rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE);
+    for (uint64_t i = 0; i < ctrl.num_msgs; i++) {
+      if (channel->Recv(lmr) != ctrl.msg_size || channel->Send(lmr) != ctrl.msg_size) {
+        std::cerr << "ERROR: echo" << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
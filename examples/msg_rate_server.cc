@@ -0,0 +1,77 @@
+#include <iostream>
+#include <thread>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct rate_config {
+  uint64_t num_pairs;
+  uint64_t window;
+  uint64_t msg_size;
+  uint64_t num_iters;
+  uint64_t async;
+};
+
+void do_recv(rnetlib::Channel &channel, rnetlib::Prov prov, int opts, const rate_config &conf) {
+  std::unique_ptr<char[]> msgs(new char[conf.msg_size * conf.window]);
+  std::vector<rnetlib::LocalMemoryRegion::ptr> lmrs;
+  for (uint64_t w = 0; w < conf.window; w++) {
+    lmrs.emplace_back(channel.RegisterMemoryRegion(msgs.get() + w * conf.msg_size, conf.msg_size,
+                                                   rnetlib::MR_LOCAL_WRITE));
+  }
+  auto evloop = rnetlib::NewEventLoop(prov, opts);
+  int ack = 1;
+
+  for (uint64_t i = 0; i < conf.num_iters; i++) {
+    for (uint64_t w = 0; w < conf.window; w++) {
+      if (conf.async) {
+        channel.IRecv(lmrs[w]->GetAddr(), conf.msg_size, evloop);
+      } else {
+        channel.Recv(lmrs[w]);
+      }
+    }
+    if (conf.async) {
+      evloop->WaitAll(-1);
+    }
+    channel.Send(&ack, sizeof(ack));
+  }
+}
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [socket[+progress]|ofi[+private][+mrecv][+progress]|verbs]"
+              << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[2], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov, opts);
+  server->Listen();
+
+  // the first pair tells how many pairs will follow.
+  std::vector<rnetlib::Channel::ptr> channels;
+  rate_config conf;
+  channels.emplace_back(server->Accept());
+  channels[0]->Recv(&conf, sizeof(conf));
+  for (uint64_t p = 1; p < conf.num_pairs; p++) {
+    channels.emplace_back(server->Accept());
+  }
+
+  std::vector<std::thread> threads;
+  for (auto &channel : channels) {
+    threads.emplace_back(do_recv, std::ref(*channel), prov, opts, std::cref(conf));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  return 0;
+}
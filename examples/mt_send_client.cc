@@ -0,0 +1,105 @@
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+// Many threads sending over a single channel.
+// "mutex" serializes the sends of the threads with a mutex around the channel, as applications do without
+// a thread-safe channel. "combining" lets them send through a ThreadSafeChannel, where one of the senders sends
+// what the others have queued in batches (flat combining).
+
+struct mt_send_config {
+  uint64_t num_threads;
+  uint64_t msg_size;
+  uint64_t num_msgs;
+};
+
+void do_send(rnetlib::Channel &channel, std::mutex *mtx, const mt_send_config &conf, std::atomic<uint64_t> &num_ready,
+             bool &ok) {
+  std::unique_ptr<char[]> msg(new char[conf.msg_size]);
+  std::memset(msg.get(), 'a', conf.msg_size);
+  auto lmr = channel.RegisterMemoryRegion(msg.get(), conf.msg_size, rnetlib::MR_LOCAL_READ);
+  ok = true;
+
+  num_ready++;
+  while (num_ready.load() < conf.num_threads);
+  for (uint64_t i = 0; i < conf.num_msgs; i++) {
+    size_t sent;
+    if (mtx) {
+      std::lock_guard<std::mutex> lock(*mtx);
+      sent = channel.Send(lmr);
+    } else {
+      sent = channel.Send(lmr);
+    }
+    if (sent != conf.msg_size) {
+      ok = false;
+    }
+  }
+}
+
+int main(int argc, const char **argv) {
+  if (argc != 8) {
+    std::cerr << "Usage: " << argv[0] << " [addr] [port] [socket|ofi|verbs] [mutex|combining]"
+              << " [num_threads] [msg_size] [num_msgs]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[3], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[3] << std::endl;
+    return 1;
+  }
+  auto combining = (std::string(argv[4]) == "combining");
+  mt_send_config conf;
+  conf.num_threads = std::stoul(argv[5]);
+  conf.msg_size = std::stoul(argv[6]);
+  conf.num_msgs = std::stoul(argv[7]);
+
+  // FIXME: handle errors
+  auto client = rnetlib::NewClient(prov, 0, opts);
+  auto channel = client->Connect(argv[1], static_cast<uint16_t>(std::stoul(argv[2])));
+  channel->Send(&conf, sizeof(conf));
+  if (combining) {
+    channel = rnetlib::MakeThreadSafe(std::move(channel));
+  }
+
+  std::mutex mtx;
+  std::atomic<uint64_t> num_ready(0);
+  std::unique_ptr<bool[]> oks(new bool[conf.num_threads]);
+  std::vector<std::thread> threads;
+  auto beg = now_nsecs();
+  for (uint64_t t = 0; t < conf.num_threads; t++) {
+    threads.emplace_back(do_send, std::ref(*channel), combining ? nullptr : &mtx, std::cref(conf),
+                         std::ref(num_ready), std::ref(oks[t]));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  // the server answers once it has received everything
+  int ack;
+  channel->Recv(&ack, sizeof(ack));
+  auto nsecs = now_nsecs() - beg;
+
+  for (uint64_t t = 0; t < conf.num_threads; t++) {
+    if (!oks[t]) {
+      std::cerr << "ERROR: send failed" << std::endl;
+      return 1;
+    }
+  }
+  double num_msgs = static_cast<double>(conf.num_threads * conf.num_msgs);
+
+  std::cout << "Threads" << "\t" << "Mode" << "\t" << "Length[Bytes]" << "\t" << "Rate[msgs/s]" << std::endl;
+  std::cout << std::fixed << std::setprecision(1)
+            << conf.num_threads << "\t" << (combining ? "combining" : "mutex") << "\t" << conf.msg_size << "\t"
+            << num_msgs * 1e9 / nsecs << std::endl;
+
+  print_perf("channel", channel->GetPerfCounters());
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct mt_send_config {
+  uint64_t num_threads;
+  uint64_t msg_size;
+  uint64_t num_msgs;
+};
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [socket|ofi|verbs]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  int opts;
+  if (!parse_prov(argv[2], prov, opts)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov, opts);
+  server->Listen();
+  auto channel = server->Accept();
+
+  mt_send_config conf;
+  channel->Recv(&conf, sizeof(conf));
+  std::unique_ptr<char[]> msg(new char[conf.msg_size]);
+  auto lmr = channel->RegisterMemoryRegion(msg.get(), conf.msg_size, rnetlib::MR_LOCAL_WRITE);
+
+  // the messages of all the sending threads come one after another
+  for (uint64_t i = 0; i < conf.num_threads * conf.num_msgs; i++) {
+    if (channel->Recv(lmr) != conf.msg_size) {
+      std::cerr << "ERROR: recv" << std::endl;
+      return 1;
+    }
+  }
+  int ack = 1;
+  channel->Send(&ack, sizeof(ack));
+
+  return 0;
+}
@@ -0,0 +1,252 @@
+#include <iomanip>
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+// RMA microbenchmarks. The server exposes one large region and stays passive while the client
+// issues Write/Read/WriteV/ReadV against slices of it:
+//   latency:   a single blocking Write/Read per iteration
+//   bandwidth: WriteV/ReadV with a window of K ops posted before waiting for their completions
+//   sg:        WriteV from many small, separately registered regions into one large remote region,
+//              compared to a single Write of the same total length
+//   reg:       RegisterMemoryRegion, deregistration, and SynRemoteMemoryRegionV until the peer has it
+// Providers without RMA (e.g. sockets) only run the registration phase.
+// OFI can be run over its software tcp provider by setting FI_PROVIDER=tcp on both sides.
+
+struct rma_config {
+  uint64_t max_size;
+  uint64_t window;
+  uint64_t num_iters;
+  uint64_t num_regions;
+};
+
+enum RMACommand : uint64_t {
+  CMD_FIN = 0,
+  CMD_SYN
+};
+
+// runs (cnt) ops per call for (num_iters) calls and returns the elapsed time (0 if unsupported).
+uint64_t run_rma(rnetlib::Channel &channel, bool write, const rnetlib::LocalMemoryRegion::ptr *lmrs,
+                 const rnetlib::RemoteMemoryRegion *rmrs, size_t cnt, uint64_t num_iters) {
+  size_t expected = 0;
+  for (size_t i = 0; i < cnt; i++) {
+    expected += lmrs[i]->GetLength();
+  }
+
+  // warm up (and find out whether RMA is supported at all)
+  for (uint64_t i = 0; i < std::max<uint64_t>(num_iters / 10, 1); i++) {
+    auto len = write ? channel.WriteV(lmrs, rmrs, cnt) : channel.ReadV(lmrs, rmrs, cnt);
+    if (len != expected) {
+      return 0;
+    }
+  }
+
+  auto beg = now_nsecs();
+  for (uint64_t i = 0; i < num_iters; i++) {
+    if (write) {
+      channel.WriteV(lmrs, rmrs, cnt);
+    } else {
+      channel.ReadV(lmrs, rmrs, cnt);
+    }
+  }
+  return std::max<uint64_t>(now_nsecs() - beg, 1);
+}
+
+void print_latency(rnetlib::Channel &channel, char *buf, const rma_config &conf, const rnetlib::RmaWindow &region) {
+  std::cout << "# RMA latency" << std::endl;
+  std::cout << "Length[Bytes]" << "\t" << "Write[us]" << "\t" << "Read[us]" << std::endl;
+
+  for (uint64_t size = 1; size <= conf.max_size; size <<= 1) {
+    auto lmr = channel.RegisterMemoryRegion(buf, size, rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE);
+    auto rslice = region.Slice(0, size);
+
+    auto write_nsecs = run_rma(channel, true, &lmr, &rslice, 1, conf.num_iters);
+    auto read_nsecs = run_rma(channel, false, &lmr, &rslice, 1, conf.num_iters);
+    if (write_nsecs == 0 && read_nsecs == 0) {
+      std::cout << "unsupported" << std::endl;
+      return;
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << size;
+    for (auto nsecs : {write_nsecs, read_nsecs}) {
+      std::cout << "\t";
+      if (nsecs) {
+        std::cout << nsecs / 1e3 / conf.num_iters;
+      } else {
+        std::cout << "n/a";
+      }
+    }
+    std::cout << std::endl;
+  }
+}
+
+void print_bandwidth(rnetlib::Channel &channel, char *buf, const rma_config &conf,
+                     const rnetlib::RmaWindow &region) {
+  std::cout << "# RMA bandwidth (window: " << conf.window << ")" << std::endl;
+  std::cout << "Length[Bytes]" << "\t" << "Write[Gbit/s]" << "\t" << "Read[Gbit/s]"
+            << "\t" << "Write[ops/s]" << "\t" << "Read[ops/s]" << std::endl;
+
+  for (uint64_t size = 1; size <= conf.max_size; size <<= 1) {
+    std::vector<rnetlib::LocalMemoryRegion::ptr> lmrs;
+    std::vector<rnetlib::RemoteMemoryRegion> rmrs;
+    for (uint64_t w = 0; w < conf.window; w++) {
+      lmrs.emplace_back(channel.RegisterMemoryRegion(buf + w * size, size,
+                                                     rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE));
+      rmrs.emplace_back(region.Slice(w * size, size));
+    }
+
+    auto write_nsecs = run_rma(channel, true, lmrs.data(), rmrs.data(), conf.window, conf.num_iters);
+    auto read_nsecs = run_rma(channel, false, lmrs.data(), rmrs.data(), conf.window, conf.num_iters);
+    if (write_nsecs == 0 && read_nsecs == 0) {
+      std::cout << "unsupported" << std::endl;
+      return;
+    }
+
+    double num_ops = static_cast<double>(conf.window * conf.num_iters);
+    std::cout << std::fixed << std::setprecision(2) << size;
+    for (auto nsecs : {write_nsecs, read_nsecs}) {
+      std::cout << "\t";
+      if (nsecs) {
+        std::cout << (8. * size * num_ops) / nsecs;
+      } else {
+        std::cout << "n/a";
+      }
+    }
+    for (auto nsecs : {write_nsecs, read_nsecs}) {
+      std::cout << "\t";
+      if (nsecs) {
+        std::cout << num_ops * 1e9 / nsecs;
+      } else {
+        std::cout << "n/a";
+      }
+    }
+    std::cout << std::endl;
+  }
+}
+
+void print_scatter_gather(rnetlib::Channel &channel, char *buf, const rma_config &conf,
+                          const rnetlib::RmaWindow &region) {
+  std::cout << "# WriteV from many small regions into one large region" << std::endl;
+  std::cout << "Length[Bytes]" << "\t" << "Regions" << "\t" << "WriteV[Gbit/s]" << "\t" << "Write[Gbit/s]" << std::endl;
+
+  // the small regions are scattered over the local buffer (every other slot) to defeat merging.
+  auto buf_len = conf.max_size * conf.window;
+  for (uint64_t size = 1; size <= conf.max_size; size <<= 1) {
+    auto num_regions = std::min(conf.num_regions, buf_len / (2 * size));
+    if (num_regions == 0) {
+      break;
+    }
+
+    std::vector<rnetlib::LocalMemoryRegion::ptr> lmrs;
+    std::vector<rnetlib::RemoteMemoryRegion> rmrs;
+    for (uint64_t r = 0; r < num_regions; r++) {
+      lmrs.emplace_back(channel.RegisterMemoryRegion(buf + 2 * r * size, size,
+                                                     rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE));
+      rmrs.emplace_back(region.Slice(r * size, size));
+    }
+    auto large_lmr = channel.RegisterMemoryRegion(buf, num_regions * size,
+                                                  rnetlib::MR_LOCAL_READ | rnetlib::MR_LOCAL_WRITE);
+    auto large_rmr = region.Slice(0, num_regions * size);
+
+    auto sg_nsecs = run_rma(channel, true, lmrs.data(), rmrs.data(), lmrs.size(), conf.num_iters);
+    auto contig_nsecs = run_rma(channel, true, &large_lmr, &large_rmr, 1, conf.num_iters);
+    if (sg_nsecs == 0 && contig_nsecs == 0) {
+      std::cout << "unsupported" << std::endl;
+      return;
+    }
+
+    double num_bytes = static_cast<double>(num_regions * size * conf.num_iters);
+    std::cout << std::fixed << std::setprecision(2) << size << "\t" << num_regions;
+    for (auto nsecs : {sg_nsecs, contig_nsecs}) {
+      std::cout << "\t";
+      if (nsecs) {
+        std::cout << (8. * num_bytes) / nsecs;
+      } else {
+        std::cout << "n/a";
+      }
+    }
+    std::cout << std::endl;
+  }
+}
+
+void print_registration(rnetlib::Channel &channel, char *buf, const rma_config &conf) {
+  std::cout << "# Memory registration" << std::endl;
+  std::cout << "Length[Bytes]" << "\t" << "Register[us]" << "\t" << "Deregister[us]" << "\t" << "Syn[us]" << std::endl;
+
+  // registration is expensive for large regions, so fewer iterations are enough here.
+  auto num_iters = std::min<uint64_t>(conf.num_iters, 100);
+  auto buf_len = conf.max_size * conf.window;
+  for (uint64_t size = 1; size <= buf_len; size <<= 1) {
+    uint64_t reg_nsecs = 0, dereg_nsecs = 0, syn_nsecs = 0;
+
+    for (uint64_t i = 0; i < num_iters; i++) {
+      uint64_t cmd = CMD_SYN, ack = 0;
+      channel.Send(&cmd, sizeof(cmd));
+
+      auto beg = now_nsecs();
+      auto lmr = channel.RegisterMemoryRegion(buf, size, rnetlib::MR_REMOTE_READ | rnetlib::MR_REMOTE_WRITE);
+      auto end = now_nsecs();
+      reg_nsecs += end - beg;
+
+      // the region is usable once the peer has acknowledged it.
+      beg = now_nsecs();
+      channel.SynRemoteMemoryRegionV(&lmr, 1);
+      channel.Recv(&ack, sizeof(ack));
+      end = now_nsecs();
+      syn_nsecs += end - beg;
+
+      beg = now_nsecs();
+      lmr.reset();
+      end = now_nsecs();
+      dereg_nsecs += end - beg;
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << size << "\t" << reg_nsecs / 1e3 / num_iters
+              << "\t" << dereg_nsecs / 1e3 / num_iters << "\t" << syn_nsecs / 1e3 / num_iters << std::endl;
+  }
+}
+
+int main(int argc, const char **argv) {
+  if (argc != 8) {
+    std::cerr << "Usage: " << argv[0] << " [addr] [port] [socket|ofi|verbs] [max_size] [window]"
+              << " [num_iters] [num_regions]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  if (!parse_prov(argv[3], prov)) {
+    std::cerr << "ERROR: unknown provider " << argv[3] << std::endl;
+    return 1;
+  }
+  rma_config conf;
+  conf.max_size = std::stoul(argv[4]);
+  conf.window = std::max<uint64_t>(std::stoul(argv[5]), 1);
+  conf.num_iters = std::max<uint64_t>(std::stoul(argv[6]), 1);
+  conf.num_regions = std::stoul(argv[7]);
+
+  // FIXME: handle errors
+  auto client = rnetlib::NewClient(prov);
+  auto channel = client->Connect(argv[1], static_cast<uint16_t>(std::stoul(argv[2])));
+  channel->Send(&conf, sizeof(conf));
+
+  rnetlib::RemoteMemoryRegion rmr;
+  channel->AckRemoteMemoryRegionV(&rmr, 1);
+
+  auto buf_len = conf.max_size * conf.window;
+  std::unique_ptr<char[]> buf(new char[buf_len]);
+  std::memset(buf.get(), 'a', buf_len);
+
+  // the slices of the region the ops are issued against
+  rnetlib::RmaWindow region(*channel, rmr);
+  print_latency(*channel, buf.get(), conf, region);
+  print_bandwidth(*channel, buf.get(), conf, region);
+  print_scatter_gather(*channel, buf.get(), conf, region);
+  print_registration(*channel, buf.get(), conf);
+
+  uint64_t cmd = CMD_FIN;
+  channel->Send(&cmd, sizeof(cmd));
+
+  return 0;
+}
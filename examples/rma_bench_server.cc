@@ -0,0 +1,56 @@
+#include <iostream>
+
+#include <rnetlib/rnetlib.h>
+
+#include "bench_util.h"
+
+struct rma_config {
+  uint64_t max_size;
+  uint64_t window;
+  uint64_t num_iters;
+  uint64_t num_regions;
+};
+
+enum RMACommand : uint64_t {
+  CMD_FIN = 0,
+  CMD_SYN
+};
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [port] [socket|ofi|verbs]" << std::endl;
+    return 1;
+  }
+
+  rnetlib::Prov prov;
+  if (!parse_prov(argv[2], prov)) {
+    std::cerr << "ERROR: unknown provider " << argv[2] << std::endl;
+    return 1;
+  }
+
+  // FIXME: handle errors
+  auto server = rnetlib::NewServer("", static_cast<uint16_t>(std::stoul(argv[1])), prov);
+  server->Listen();
+  auto channel = server->Accept();
+
+  rma_config conf;
+  channel->Recv(&conf, sizeof(conf));
+
+  // the target of every RMA op issued by the client.
+  auto buf_len = conf.max_size * conf.window;
+  std::unique_ptr<char[]> buf(new char[buf_len]);
+  std::memset(buf.get(), 0, buf_len);
+  auto lmr = channel->RegisterMemoryRegion(buf.get(), buf_len, rnetlib::MR_REMOTE_READ | rnetlib::MR_REMOTE_WRITE);
+  channel->SynRemoteMemoryRegionV(&lmr, 1);
+
+  // stay passive, except for acknowledging the regions registered in the registration phase.
+  uint64_t cmd = CMD_FIN;
+  while (channel->Recv(&cmd, sizeof(cmd)) == sizeof(cmd) && cmd == CMD_SYN) {
+    rnetlib::RemoteMemoryRegion rmr;
+    channel->AckRemoteMemoryRegionV(&rmr, 1);
+    uint64_t ack = 1;
+    channel->Send(&ack, sizeof(ack));
+  }
+
+  return 0;
+}
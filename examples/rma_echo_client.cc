@@ -20,12 +20,13 @@ int main(int argc, const char **argv) {
   channel->AckRemoteMemoryRegionV(&rmr, 1);
   channel->SynRemoteMemoryRegionV(&lmr, 1);
 
-  int fin = 1;
-  channel->Write(lmr, rmr);
-  channel->Send(&fin, sizeof(fin));
+  // the notification tells the peer that the data has landed, without a message of its own
+  uint32_t fin = 1;
+  channel->WriteNotify(lmr, rmr, fin);
   std::cout << "EchoClient: written " << msg << std::endl;
 
-  channel->Recv(&fin, sizeof(fin));
+  fin = 0;
+  channel->WaitNotify(fin);
   assert(msg == 10 && fin == 1);
   std::cout << "EchoClient: received " << msg << std::endl;
 
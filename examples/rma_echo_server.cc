@@ -22,13 +22,12 @@ int main(int argc, const char **argv) {
   channel->SynRemoteMemoryRegionV(&lmr, 1);
   channel->AckRemoteMemoryRegionV(&rmr, 1);
 
-  int fin = 0;
-  channel->Recv(&fin, sizeof(fin));
+  uint32_t fin = 0;
+  channel->WaitNotify(fin);
   assert(msg == 10 && fin == 1);
   std::cout << "EchoServer: received " << msg << std::endl;
 
-  channel->Write(lmr, rmr);
-  channel->Send(&fin, sizeof(fin));
+  channel->WriteNotify(lmr, rmr, fin);
   std::cout << "EchoServer: written " << msg << std::endl;
 
   return 0;
@@ -0,0 +1,34 @@
+#ifndef RNETLIB_ATOMIC_OP_H_
+#define RNETLIB_ATOMIC_OP_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rnetlib/remote_memory_region.h"
+
+namespace rnetlib {
+
+enum AtomicOpcode {
+  // adds (operand)
+  ATOMIC_FETCH_ADD = 0,
+  // replaces the word with (operand) if it equals (compare)
+  ATOMIC_COMPARE_SWAP,
+  // replaces the word with (operand)
+  ATOMIC_SWAP
+};
+
+// A 64-bit atomic operation on the word at (offset) bytes into a remote region.
+// The region has to be registered with MR_REMOTE_ATOMIC, and the word has to be 8-byte aligned.
+struct AtomicOp {
+  AtomicOpcode opcode;
+  RemoteMemoryRegion rmr;
+  size_t offset;
+  uint64_t operand;
+  uint64_t compare;
+  // the value of the word before the operation
+  uint64_t result;
+};
+
+} // namespace rnetlib
+
+#endif // RNETLIB_ATOMIC_OP_H_
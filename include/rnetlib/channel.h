@@ -1,9 +1,12 @@
 #ifndef RNETLIB_CHANNEL_H_
 #define RNETLIB_CHANNEL_H_
 
+#include "rnetlib/atomic_op.h"
 #include "rnetlib/event_loop.h"
 #include "rnetlib/local_memory_region.h"
+#include "rnetlib/perf_counters.h"
 #include "rnetlib/remote_memory_region.h"
+#include "rnetlib/wait_policy.h"
 
 namespace rnetlib {
 
@@ -33,6 +36,21 @@ class Channel {
 
   virtual size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) = 0;
 
+  // sends (msgcnt) messages one after another, the i-th of which is SendV(lmr[i], lmrcnts[i]).
+  // returns the # of messages sent in full. providers may send them with fewer operations than SendV() each.
+  virtual size_t SendMsgV(const LocalMemoryRegion::ptr *const *lmr, const size_t *lmrcnts, size_t msgcnt) {
+    for (size_t i = 0; i < msgcnt; i++) {
+      size_t len = 0;
+      for (size_t j = 0; j < lmrcnts[i]; j++) {
+        len += lmr[i][j]->GetLength();
+      }
+      if (SendV(lmr[i], lmrcnts[i]) != len) {
+        return i;
+      }
+    }
+    return msgcnt;
+  }
+
   virtual size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) = 0;
 
   virtual size_t Write(void *buf, size_t len, const RemoteMemoryRegion &rmr) = 0;
@@ -47,11 +65,65 @@ class Channel {
 
   virtual size_t ReadV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) = 0;
 
+  // writes (lmr) into (rmr) and then raises a notification of (value) at the peer, which takes it with WaitNotify()
+  // once the data has landed. notifications are taken in the order they have been raised.
+  // NOTE: a notification may take the place of a message in the order of receives (depending on the provider),
+  // so the peer has to wait for it before receiving the messages sent after it.
+  // NOTE: on sockets, a notification is a bare 4-byte message of (value), in order with the other messages and
+  // with nothing that tells it apart from them: a receive where the peer expects WaitNotify() takes it as data.
+  // writing (lmr) is not supported there, so WriteNotify() fails unless (lmr) is empty.
+  virtual bool WriteNotify(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr, uint32_t value) = 0;
+
+  // waits for the next notification raised by the peer as the wait policy says. returns false on error or timeout.
+  virtual bool WaitNotify(uint32_t &value) = 0;
+
+  // performs (cnt) atomic operations with all of them in flight at once, and returns the # of them done.
+  // the operations of one call are not ordered with each other.
+  // NOTE: only the ofi and verbs providers have atomics. socket channels do none of them, and return 0.
+  virtual size_t AtomicV(AtomicOp *ops, size_t cnt) = 0;
+
+  // adds (value) to the remote word, which was (prev).
+  bool FetchAdd(const RemoteMemoryRegion &rmr, size_t offset, uint64_t value, uint64_t &prev) {
+    AtomicOp op = {ATOMIC_FETCH_ADD, rmr, offset, value, 0, 0};
+    return DoAtomic(op, prev);
+  }
+
+  // replaces the remote word with (value) if it equals (compare). it was (prev), so the swap took if (prev == compare).
+  bool CompareSwap(const RemoteMemoryRegion &rmr, size_t offset, uint64_t compare, uint64_t value, uint64_t &prev) {
+    AtomicOp op = {ATOMIC_COMPARE_SWAP, rmr, offset, value, compare, 0};
+    return DoAtomic(op, prev);
+  }
+
+  // replaces the remote word with (value), which was (prev).
+  bool Swap(const RemoteMemoryRegion &rmr, size_t offset, uint64_t value, uint64_t &prev) {
+    AtomicOp op = {ATOMIC_SWAP, rmr, offset, value, 0, 0};
+    return DoAtomic(op, prev);
+  }
+
   virtual LocalMemoryRegion::ptr RegisterMemoryRegion(void *addr, size_t len, int type) const = 0;
 
   virtual void SynRemoteMemoryRegionV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) = 0;
 
   virtual void AckRemoteMemoryRegionV(RemoteMemoryRegion *rmr, size_t rmrcnt) = 0;
+
+  // counters of this channel (all zero unless built with RNETLIB_ENABLE_PERF_COUNTERS).
+  virtual PerfSnapshot GetPerfCounters() const = 0;
+
+  // how blocking operations wait for completions (ignored by providers that always block in the kernel).
+  virtual void SetWaitPolicy(const WaitPolicy &policy) {}
+
+  // whether a blocking send and a blocking receive (or WaitNotify()) can run on two threads at once, as long as
+  // no asynchronous operation is in flight. nothing else can, whatever this says.
+  virtual bool IsFullDuplex() const { return false; }
+
+ private:
+  bool DoAtomic(AtomicOp &op, uint64_t &prev) {
+    if (AtomicV(&op, 1) != 1) {
+      return false;
+    }
+    prev = op.result;
+    return true;
+  }
 };
 
 } // namespace rnetlib
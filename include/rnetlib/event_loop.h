@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "rnetlib/event_handler.h"
+#include "rnetlib/perf_counters.h"
 
 namespace rnetlib {
 
@@ -19,6 +20,9 @@ class EventLoop {
   virtual void AddHandler(EventHandler &handler) = 0;
 
   virtual int WaitAll(int timeout_millis) = 0;
+
+  // counters of this event loop (all zero unless built with RNETLIB_ENABLE_PERF_COUNTERS).
+  virtual PerfSnapshot GetPerfCounters() const = 0;
 };
 
 } // namespace rnetlib
@@ -9,7 +9,9 @@ enum MRType {
   MR_LOCAL_READ = 0,
   MR_LOCAL_WRITE = (1 << 0),
   MR_REMOTE_READ = (1 << 1),
-  MR_REMOTE_WRITE = (1 << 2)
+  MR_REMOTE_WRITE = (1 << 2),
+  // the target of atomic operations
+  MR_REMOTE_ATOMIC = (1 << 3)
 };
 
 class LocalMemoryRegion {
@@ -27,6 +29,26 @@ class LocalMemoryRegion {
   virtual uint64_t GetRKey() const = 0;
 };
 
+// (len) bytes at (offset) into a registered region, which shares the keys of the region and must not outlive it.
+class LocalMemoryRegionSlice : public LocalMemoryRegion {
+ public:
+  LocalMemoryRegionSlice(const LocalMemoryRegion &lmr, size_t offset, size_t len)
+      : lmr_(lmr), addr_(static_cast<char *>(lmr.GetAddr()) + offset), len_(len) {}
+
+  void *GetAddr() const override { return addr_; }
+
+  size_t GetLength() const override { return len_; }
+
+  void *GetLKey() const override { return lmr_.GetLKey(); }
+
+  uint64_t GetRKey() const override { return lmr_.GetRKey(); }
+
+ private:
+  const LocalMemoryRegion &lmr_;
+  void *addr_;
+  size_t len_;
+};
+
 } // namespace rnetlib
 
 #endif // RNETLIB_LOCAL_MEMORY_REGION_H_
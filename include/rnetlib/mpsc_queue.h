@@ -0,0 +1,77 @@
+#ifndef RNETLIB_MPSC_QUEUE_H_
+#define RNETLIB_MPSC_QUEUE_H_
+
+#include <atomic>
+
+namespace rnetlib {
+
+// a node of an MPSCQueue, which the elements derive from
+struct MPSCNode {
+  std::atomic<MPSCNode *> next;
+};
+
+// An intrusive lock-free queue with many producers and a single consumer (Vyukov's).
+// Push() is wait-free and can be called from any thread; Pop() and Empty() only from the consumer.
+// NOTE: a node must not be pushed again before it has been popped.
+template <typename T>
+class MPSCQueue {
+ public:
+  MPSCQueue() : head_(&stub_), tail_(&stub_) { stub_.next.store(nullptr, std::memory_order_relaxed); }
+
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  void Push(T *node) { PushNode(node); }
+
+  // returns nullptr if the queue is empty, or if the node next in line is still being pushed.
+  T *Pop() {
+    auto tail = tail_;
+    auto next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (!next) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      // a producer has taken the head, but not linked its node yet
+      return nullptr;
+    }
+    // the last node can only be taken from behind the stub
+    PushNode(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    return nullptr;
+  }
+
+  // false once a Push() has begun, even if Pop() cannot take its node yet.
+  bool Empty() const { return tail_ == &stub_ && head_.load() == &stub_; }
+
+ private:
+  // producers take the head, and link their nodes after it
+  std::atomic<MPSCNode *> head_;
+  // the consumer takes nodes from here
+  MPSCNode *tail_;
+  MPSCNode stub_;
+
+  void PushNode(MPSCNode *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    // sequentially consistent, so that a consumer going to sleep after Empty() either sees the node,
+    // or is seen sleeping by the producer
+    auto prev = head_.exchange(node);
+    prev->next.store(node, std::memory_order_release);
+  }
+};
+
+} // namespace rnetlib
+
+#endif // RNETLIB_MPSC_QUEUE_H_
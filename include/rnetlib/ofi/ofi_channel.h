@@ -1,48 +1,120 @@
 #ifndef RNETLIB_OFI_OFI_CHANNEL_H_
 #define RNETLIB_OFI_OFI_CHANNEL_H_
 
+#include <poll.h>
+
+#include <algorithm>
 #include <cstring>
+#include <deque>
 #include <vector>
 
 #include "rnetlib/channel.h"
 #include "rnetlib/eager_buffer.h"
+#include "rnetlib/event_handler.h"
 #include "rnetlib/ofi/ofi_endpoint.h"
 
 namespace rnetlib {
 namespace ofi {
 
-class OFIChannel : public Channel {
+class OFIChannel : public Channel, public EventHandler {
  public:
-  OFIChannel(OFIEndpoint &ep, fi_addr_t peer_addr, uint64_t peer_desc, uint64_t src_tag)
-      : ep_(ep), peer_addr_(peer_addr), peer_desc_(peer_desc), src_tag_(src_tag), dst_tag_(0) {
+  OFIChannel(const OFIEndpoint::ptr &ep, fi_addr_t peer_addr, uint64_t peer_desc, uint64_t src_tag)
+      : ep_(ep), peer_addr_(peer_addr), peer_desc_(peer_desc), src_tag_(src_tag), dst_tag_(0), multi_recv_(false) {
     std::memset(&tx_req_, 0, sizeof(tx_req_));
     std::memset(&rx_req_, 0, sizeof(rx_req_));
   }
 
-  ~OFIChannel() override { ep_.RemoveAddr(&peer_addr_); }
+  ~OFIChannel() override {
+    // the sends in flight get as long as the wait policy allows (a while, if it waits forever) to reach the peer.
+    auto timeout_millis = waiter_.GetPolicy().timeout_millis;
+    if (timeout_millis < 0) {
+      timeout_millis = kCloseTimeoutMillis;
+    }
+    Waiter waiter(WaitPolicy(WaitPolicy::WAIT_SPIN, timeout_millis));
+    DrainAsyncOps(send_ops_, waiter);
+    // the receives in flight never will, since the peer is going as well
+    for (auto &op : recv_ops_) {
+      if (op.in_place) {
+        // nothing posted
+        op.req.comp = op.req.req;
+      } else {
+        ep_->Cancel(&op.req);
+      }
+    }
+    DrainAsyncOps(recv_ops_, waiter);
+    // the contexts of the operations left (including those of blocking ones which have timed out) point to their
+    // requests, which are about to go
+    for (auto ops : {&send_ops_, &recv_ops_}) {
+      for (auto &op : *ops) {
+        ep_->Orphan(&op.req);
+      }
+    }
+    ep_->Cancel(&rx_req_);
+    ep_->Orphan(&tx_req_);
+    ep_->Orphan(&rx_req_);
+    ep_->RemoveAddr(&peer_addr_);
+  }
 
   uint64_t GetDesc() const override { return peer_desc_; }
 
-  size_t Send(void *buf, size_t len) override { return Send(RegisterMemoryRegion(buf, len, MR_LOCAL_READ)); }
+  size_t Send(void *buf, size_t len) override {
+    if (len > 0 && len <= GetInjectLimit()) {
+      // tiny messages are injected: no registration, no context and no completion to wait for
+      RNETLIB_PROBE1(send_entry, this);
+      auto ret = multi_recv_ ? ep_->InjectData(buf, len, peer_addr_, dst_tag_)
+                             : ep_->Inject(buf, len, peer_addr_, dst_tag_);
+      if (ret != 0) {
+        return 0;
+      }
+      perf_.Add(PERF_SEND_OPS);
+      perf_.Add(PERF_SEND_BYTES, len);
+      RNETLIB_PROBE2(send_return, this, len);
+      return len;
+    }
+    return Send(RegisterMemoryRegion(buf, len, MR_LOCAL_READ));
+  }
 
-  size_t Recv(void *buf, size_t len) override { return Recv(RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE)); }
+  size_t Recv(void *buf, size_t len) override {
+    if (multi_recv_ && len <= OFIEndpoint::kMultiRecvMsgSize) {
+      // copied out of a multi-receive buffer, so nothing has to be registered
+      struct iovec iov = {buf, len};
+      return RecvSmall(&iov, 1);
+    }
+    return Recv(RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE));
+  }
 
   size_t Send(const LocalMemoryRegion::ptr &lmr) override { return SendV(&lmr, 1); }
 
   size_t Recv(const LocalMemoryRegion::ptr &lmr) override { return RecvV(&lmr, 1); }
 
   size_t ISend(void *buf, size_t len, const EventLoop::ptr &evloop) override {
-    // FIXME: implement this
-    return 0;
+    if (len > 0 && len <= GetInjectLimit()) {
+      // done as soon as it is injected
+      return Send(buf, len);
+    }
+    auto lmr = RegisterMemoryRegion(buf, len, MR_LOCAL_READ);
+    auto ret = PostISendV(&lmr, 1);
+    if (ret > 0) {
+      // keep the region registered until the transfer completes
+      send_ops_.back().lmr = std::move(lmr);
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t IRecv(void *buf, size_t len, const EventLoop::ptr &evloop) override {
-    // FIXME: implement this
-    return 0;
+    auto lmr = RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE);
+    auto ret = PostIRecvV(&lmr, 1);
+    if (ret > 0) {
+      recv_ops_.back().lmr = std::move(lmr);
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t SendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
     assert(tx_req_.req == 0);
+    RNETLIB_PROBE1(send_entry, this);
     size_t sent_len = 0;
     std::vector<struct iovec> iov;
     std::vector<void *> desc;
@@ -60,16 +132,30 @@ class OFIChannel : public Channel {
       sent_len += len;
     }
 
-    if (ep_.PostSend(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &tx_req_)) {
-      return 0;
+    bool ok;
+    if (multi_recv_ && sent_len <= OFIEndpoint::kMultiRecvMsgSize) {
+      // a small message takes a CQ entry even with the tx counter
+      if (ep_->PostSendData(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &tx_req_)) {
+        return 0;
+      }
+      ep_->PollTxCQ(tx_req_.req, &tx_req_, &waiter_);
+      ok = (tx_req_.req == 0);
+    } else {
+      if (ep_->PostSend(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &tx_req_)) {
+        return 0;
+      }
+      ok = ep_->WaitTx(&tx_req_, &waiter_);
     }
-
-    ep_.PollTxCQ(tx_req_.req, &tx_req_);
-    return (tx_req_.req == 0) ? sent_len : 0;
+    perf_.Add(PERF_SEND_OPS);
+    perf_.Add(PERF_SEND_BYTES, sent_len);
+    auto ret = ok ? sent_len : 0;
+    RNETLIB_PROBE2(send_return, this, ret);
+    return ret;
   }
 
   size_t RecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
     assert(rx_req_.req == 0);
+    RNETLIB_PROBE1(recv_entry, this);
     size_t recvd_len = 0;
     std::vector<struct iovec> iov;
     std::vector<void *> desc;
@@ -87,20 +173,79 @@ class OFIChannel : public Channel {
       recvd_len += len;
     }
 
-    ep_.PostRecv(iov.data(), desc.data(), iov.size(), src_tag_, &rx_req_);
+    if (multi_recv_ && recvd_len <= OFIEndpoint::kMultiRecvMsgSize) {
+      return RecvSmall(iov.data(), iov.size());
+    }
+    ep_->PostRecv(iov.data(), desc.data(), iov.size(), src_tag_, &rx_req_);
+
+    ep_->PollRxCQ(rx_req_.req, &rx_req_, &waiter_);
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, recvd_len);
+    auto ret = (rx_req_.req == 0) ? recvd_len : 0;
+    RNETLIB_PROBE2(recv_return, this, ret);
+    return ret;
+  }
 
-    ep_.PollRxCQ(rx_req_.req, &rx_req_);
-    return (rx_req_.req == 0) ? recvd_len : 0;
+  // the messages are all posted before any of them is waited for, with a single WaitTx().
+  size_t SendMsgV(const LocalMemoryRegion::ptr *const *lmr, const size_t *lmrcnts, size_t msgcnt) override {
+    assert(tx_req_.req == 0);
+    RNETLIB_PROBE1(send_entry, this);
+    RNETLIB_TRACE_SCOPE("ofi_sendmsgv", msgcnt);
+    size_t num_posted = 0, sent_len = 0;
+    std::vector<struct iovec> iov;
+    std::vector<void *> desc;
+
+    for (; num_posted < msgcnt; num_posted++) {
+      iov.clear();
+      desc.clear();
+      size_t len = 0;
+      for (size_t i = 0; i < lmrcnts[num_posted]; i++) {
+        auto &msg_lmr = lmr[num_posted][i];
+        if (msg_lmr->GetLength() > 0) {
+          iov.push_back({msg_lmr->GetAddr(), msg_lmr->GetLength()});
+          desc.push_back(msg_lmr->GetLKey());
+          len += msg_lmr->GetLength();
+        }
+      }
+
+      ssize_t ret;
+      if (multi_recv_ && len <= OFIEndpoint::kMultiRecvMsgSize) {
+        ret = ep_->PostSendData(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &tx_req_);
+      } else {
+        ret = ep_->PostSend(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &tx_req_);
+      }
+      if (ret) {
+        // error
+        break;
+      }
+      sent_len += len;
+    }
+
+    // the ones posted so far are waited for even on error, so that tx_req_ is free again.
+    auto ok = ep_->WaitTx(&tx_req_, &waiter_);
+    perf_.Add(PERF_SEND_OPS, num_posted);
+    perf_.Add(PERF_SEND_BYTES, sent_len);
+    auto ret = ok ? num_posted : 0;
+    RNETLIB_PROBE2(send_return, this, sent_len);
+    return ret;
   }
 
+  // (lmr) has to stay registered until (evloop) has completed the transfer.
   size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
-    // FIXME: implement this
-    return 0;
+    auto ret = PostISendV(lmr, lmrcnt);
+    if (ret > 0) {
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
+  // (lmr) has to stay registered until (evloop) has completed the transfer.
   size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
-    // FIXME: implement this
-    return 0;
+    auto ret = PostIRecvV(lmr, lmrcnt);
+    if (ret > 0) {
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t Write(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
@@ -121,6 +266,7 @@ class OFIChannel : public Channel {
 
   size_t WriteV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
     assert(tx_req_.req == 0);
+    RNETLIB_PROBE1(write_entry, this);
     size_t len, total_len = 0;
     struct fi_msg_rma msg;
     std::memset(&msg, 0, sizeof(msg));
@@ -136,7 +282,7 @@ class OFIChannel : public Channel {
       if (len > 0) {
         assert(len == rmr[i].length);
         iov.push_back({lmr[i]->GetAddr(), len});
-        rma_iov.push_back({0, rmr[i].length, rmr[i].rkey});
+        rma_iov.push_back({rmr[i].addr, rmr[i].length, rmr[i].rkey});
         desc.push_back(lmr[i]->GetLKey());
         total_len += len;
       }
@@ -149,13 +295,18 @@ class OFIChannel : public Channel {
     msg.rma_iov_count = rma_iov.size();
     msg.desc = desc.data();
 
-    ep_.PostWrite(&msg, &tx_req_);
-    ep_.PollTxCQ(tx_req_.req, &tx_req_);
-    return (tx_req_.req == 0) ? total_len : 0;
+    ep_->PostWrite(&msg, &tx_req_);
+    auto ok = ep_->WaitTx(&tx_req_, &waiter_);
+    perf_.Add(PERF_WRITE_OPS, iov.size());
+    perf_.Add(PERF_WRITE_BYTES, total_len);
+    auto ret = ok ? total_len : 0;
+    RNETLIB_PROBE2(write_return, this, ret);
+    return ret;
   }
 
   size_t ReadV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
     assert(tx_req_.req == 0);
+    RNETLIB_PROBE1(read_entry, this);
     size_t len, total_len = 0;
     struct fi_msg_rma msg;
     std::memset(&msg, 0, sizeof(msg));
@@ -171,7 +322,7 @@ class OFIChannel : public Channel {
       if (len > 0) {
         assert(len == rmr[i].length);
         iov.push_back({lmr[i]->GetAddr(), len});
-        rma_iov.push_back({0, rmr[i].length, rmr[i].rkey});
+        rma_iov.push_back({rmr[i].addr, rmr[i].length, rmr[i].rkey});
         desc.push_back(lmr[i]->GetLKey());
         total_len += len;
       }
@@ -184,13 +335,64 @@ class OFIChannel : public Channel {
     msg.rma_iov_count = rma_iov.size();
     msg.desc = desc.data();
 
-    ep_.PostRead(&msg, &tx_req_);
-    ep_.PollTxCQ(tx_req_.req, &tx_req_);
-    return (tx_req_.req == 0) ? total_len : 0;
+    ep_->PostRead(&msg, &tx_req_);
+    auto ok = ep_->WaitTx(&tx_req_, &waiter_);
+    perf_.Add(PERF_READ_OPS, iov.size());
+    perf_.Add(PERF_READ_BYTES, total_len);
+    auto ret = ok ? total_len : 0;
+    RNETLIB_PROBE2(read_return, this, ret);
+    return ret;
+  }
+
+  bool WriteNotify(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr, uint32_t value) override {
+    assert(tx_req_.req == 0);
+    RNETLIB_PROBE1(write_entry, this);
+    auto len = lmr->GetLength();
+    assert(len == rmr.length);
+
+    if (len <= ep_->GetInjectSize()) {
+      if (ep_->InjectWriteData(lmr->GetAddr(), len, dst_tag_, value, peer_addr_, rmr.addr, rmr.rkey) != 0) {
+        return false;
+      }
+      perf_.Add(PERF_WRITE_OPS);
+      perf_.Add(PERF_WRITE_BYTES, len);
+      RNETLIB_PROBE2(write_return, this, len);
+      return true;
+    }
+    if (ep_->PostWriteData(lmr->GetAddr(), len, lmr->GetLKey(), dst_tag_, value, peer_addr_, rmr.addr, rmr.rkey,
+                          &tx_req_)) {
+      return false;
+    }
+    ep_->PollTxCQ(tx_req_.req, &tx_req_, &waiter_);
+    perf_.Add(PERF_WRITE_OPS);
+    perf_.Add(PERF_WRITE_BYTES, len);
+    auto ret = (tx_req_.req == 0);
+    RNETLIB_PROBE2(write_return, this, ret ? len : 0);
+    return ret;
+  }
+
+  bool WaitNotify(uint32_t &value) override { return ep_->WaitNotify(src_tag_, value, &waiter_); }
+
+  size_t AtomicV(AtomicOp *ops, size_t cnt) override {
+    assert(tx_req_.req == 0);
+    // the operands are taken from and the results are put into (ops) directly
+    auto lmr = RegisterMemoryRegion(ops, sizeof(AtomicOp) * cnt, MR_LOCAL_READ | MR_LOCAL_WRITE);
+    if (!lmr) {
+      return 0;
+    }
+
+    size_t num_posted = 0;
+    while (num_posted < cnt && ep_->PostAtomic(ops[num_posted], lmr->GetLKey(), peer_addr_, &tx_req_) == 0) {
+      num_posted++;
+    }
+
+    ep_->PollTxCQ(tx_req_.req, &tx_req_, &waiter_);
+    perf_.Add(PERF_ATOMIC_OPS, num_posted);
+    return (tx_req_.req == 0) ? num_posted : 0;
   }
 
   LocalMemoryRegion::ptr RegisterMemoryRegion(void *addr, size_t len, int type) const override {
-    return ep_.RegisterMemoryRegion(addr, len, type);
+    return ep_->RegisterMemoryRegion(addr, len, type);
   }
 
   void SynRemoteMemoryRegionV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
@@ -199,6 +401,10 @@ class OFIChannel : public Channel {
 
     for (auto i = 0; i < lmrcnt; i++) {
       rmrs.emplace_back(*lmr[i]);
+      if (!ep_->UsesVirtAddr()) {
+        // the region is addressed by offsets from its beginning
+        rmrs.back().addr = 0;
+      }
     }
 
     Send(rmrs.data(), sizeof(RemoteMemoryRegion) * rmrs.size());
@@ -208,16 +414,245 @@ class OFIChannel : public Channel {
     Recv(rmr, sizeof(RemoteMemoryRegion) * rmrcnt);
   }
 
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
+  void SetWaitPolicy(const WaitPolicy &policy) override { waiter_.SetPolicy(policy); }
+
   void SetDestTag(uint64_t dst_tag) { dst_tag_ = dst_tag; }
 
+  // small messages go through the multi-receive buffers of the endpoints, which both sides have agreed on.
+  // NOTE: each side tells small messages by its own length of them, so a message has to be received with the
+  // length it has been sent with.
+  void SetMultiRecv() { multi_recv_ = true; }
+
+  // takes the next small message (of at most OFIEndpoint::kMultiRecvMsgSize bytes) where it has landed, without
+  // copying it. it has to be handed back with Release() once it has been handled. fails without OPT_MULTI_RECV.
+  bool RecvInPlace(struct ofi_inplace_msg &msg) {
+    if (!multi_recv_) {
+      return false;
+    }
+    RNETLIB_PROBE1(recv_entry, this);
+    if (!ep_->WaitInPlace(src_tag_, msg, &waiter_)) {
+      return false;
+    }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, msg.len);
+    RNETLIB_PROBE2(recv_return, this, msg.len);
+    return true;
+  }
+
+  void Release(const struct ofi_inplace_msg &msg) { ep_->ReleaseInPlace(msg); }
+
+  const OFIEndpoint::ptr &GetEndpoint() const { return ep_; }
+
+  // the peer of this channel has moved to (peer_addr), e.g., to an endpoint of its own.
+  void SetPeerAddr(fi_addr_t peer_addr) {
+    ep_->RemoveAddr(&peer_addr_);
+    peer_addr_ = peer_addr;
+  }
+
+  int OnEvent(int event_type, void *arg) override {
+    RNETLIB_TRACE_SCOPE("ofi_on_event", event_type);
+    ProgressAsyncOps();
+
+    return (send_ops_.empty() && recv_ops_.empty()) ? MAY_BE_REMOVED : 0;
+  }
+
+  int OnError(int error_type) override { return MAY_BE_REMOVED; }
+
+  void *GetHandlerID() const override { return const_cast<OFIChannel *>(this); }
+
+  short GetEventType() const override { return (send_ops_.empty() && recv_ops_.empty()) ? 0 : POLLIN; }
+
  private:
-  OFIEndpoint &ep_;
+  // how long the destructor waits for the asynchronous operations in flight, unless the wait policy says otherwise
+  static const int kCloseTimeoutMillis = 1000;
+
+  // an asynchronous operation, which completes once every post of (req) has completed
+  struct AsyncOp {
+    explicit AsyncOp(size_t len) : len(len) { std::memset(&req, 0, sizeof(req)); }
+
+    struct ofi_req req;
+    size_t len;
+    // registered on behalf of ISend/IRecv
+    LocalMemoryRegion::ptr lmr;
+    // recv only: a small message copied out of a multi-receive buffer into (iov), rather than posted
+    bool in_place = false;
+    std::vector<struct iovec> iov;
+
+    bool IsDone() const { return req.comp == req.req; }
+  };
+
+  // channels keep their endpoint alive
+  OFIEndpoint::ptr ep_;
   fi_addr_t peer_addr_;
   uint64_t peer_desc_;
   uint64_t src_tag_;
   uint64_t dst_tag_;
+  bool multi_recv_;
   struct ofi_req tx_req_;
   struct ofi_req rx_req_;
+  // the contexts of the posts point to the requests of the operations, which a deque never moves
+  std::deque<AsyncOp> send_ops_;
+  std::deque<AsyncOp> recv_ops_;
+  PerfCounters perf_;
+  Waiter waiter_;
+
+  // posts the sends of SendV() without waiting for their completions.
+  size_t PostISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) {
+    RNETLIB_TRACE_SCOPE("ofi_isendv", lmrcnt);
+    std::vector<struct iovec> iov;
+    std::vector<void *> desc;
+    iov.reserve(lmrcnt);
+    desc.reserve(lmrcnt);
+
+    send_ops_.emplace_back(0);
+    auto &op = send_ops_.back();
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      if (len > 0) {
+        iov.push_back({lmr[i]->GetAddr(), len});
+        desc.push_back(lmr[i]->GetLKey());
+        op.len += len;
+      }
+    }
+
+    // each send has to be told apart, so it takes a CQ entry rather than the tx counter.
+    if (multi_recv_ && op.len <= OFIEndpoint::kMultiRecvMsgSize) {
+      ep_->PostSendData(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &op.req);
+    } else {
+      ep_->PostSend(iov.data(), desc.data(), iov.size(), peer_addr_, dst_tag_, &op.req, false);
+    }
+    if (op.req.req == 0 && !iov.empty()) {
+      // error
+      send_ops_.pop_back();
+      return 0;
+    }
+    perf_.Add(PERF_SEND_OPS);
+    perf_.Add(PERF_SEND_BYTES, op.len);
+    RNETLIB_TRACE_INSTANT("ofi_isend", op.len);
+
+    return op.len;
+  }
+
+  // posts the receives of RecvV() without waiting for their completions.
+  size_t PostIRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) {
+    RNETLIB_TRACE_SCOPE("ofi_irecvv", lmrcnt);
+    std::vector<struct iovec> iov;
+    std::vector<void *> desc;
+    iov.reserve(lmrcnt);
+    desc.reserve(lmrcnt);
+
+    recv_ops_.emplace_back(0);
+    auto &op = recv_ops_.back();
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      if (len > 0) {
+        iov.push_back({lmr[i]->GetAddr(), len});
+        desc.push_back(lmr[i]->GetLKey());
+        op.len += len;
+      }
+    }
+
+    if (multi_recv_ && op.len <= OFIEndpoint::kMultiRecvMsgSize) {
+      // nothing to post: the op takes the next small message to this channel
+      op.in_place = true;
+      op.iov = std::move(iov);
+      op.req.req = 1;
+    } else {
+      ep_->PostRecv(iov.data(), desc.data(), iov.size(), src_tag_, &op.req);
+    }
+    if (op.req.req == 0 && !iov.empty()) {
+      // error
+      recv_ops_.pop_back();
+      return 0;
+    }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, op.len);
+    RNETLIB_TRACE_INSTANT("ofi_irecv", op.len);
+
+    return op.len;
+  }
+
+  // receives a small message out of the multi-receive buffers.
+  size_t RecvSmall(const struct iovec *iov, size_t iovcnt) {
+    RNETLIB_PROBE1(recv_entry, this);
+    struct ofi_inplace_msg msg;
+    if (!ep_->WaitInPlace(src_tag_, msg, &waiter_)) {
+      return 0;
+    }
+    auto ret = CopyOut(msg, iov, iovcnt);
+    ep_->ReleaseInPlace(msg);
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, ret);
+    RNETLIB_PROBE2(recv_return, this, ret);
+    return ret;
+  }
+
+  // scatters (msg) into (iov), and returns the # of bytes copied.
+  static size_t CopyOut(const struct ofi_inplace_msg &msg, const struct iovec *iov, size_t iovcnt) {
+    size_t copied = 0;
+    for (size_t i = 0; i < iovcnt && copied < msg.len; i++) {
+      auto cpylen = std::min<size_t>(iov[i].iov_len, msg.len - copied);
+      std::memcpy(iov[i].iov_base, static_cast<char *>(msg.buf) + copied, cpylen);
+      copied += cpylen;
+    }
+    return copied;
+  }
+
+  // lets (evloop) complete the asynchronous operations unless they have completed already.
+  void WatchAsyncOps(const EventLoop::ptr &evloop) {
+    ProgressAsyncOps();
+    if (GetEventType() != 0) {
+      evloop->AddHandler(*this);
+    }
+  }
+
+  // the largest message Send() injects. with multi-receive buffers, an untagged message larger than a small one
+  // would land in them while the peer waits for it with a tagged receive.
+  size_t GetInjectLimit() const {
+    auto limit = ep_->GetInjectSize();
+    if (multi_recv_ && limit > OFIEndpoint::kMultiRecvMsgSize) {
+      limit = OFIEndpoint::kMultiRecvMsgSize;
+    }
+    return limit;
+  }
+
+  // waits until the operations of (ops) have completed or (waiter) times out.
+  void DrainAsyncOps(const std::deque<AsyncOp> &ops, Waiter &waiter) {
+    waiter.Begin();
+    while (!ops.empty()) {
+      ProgressAsyncOps();
+      if (!ops.empty() && waiter.OnEmptyPoll() == Waiter::WAIT_TIMED_OUT) {
+        break;
+      }
+    }
+  }
+
+  // the operations of a queue complete in order, even if their posts do not.
+  void ProgressAsyncOps() {
+    ep_->Progress();
+    for (auto &op : recv_ops_) {
+      struct ofi_inplace_msg msg;
+      if (!op.in_place || op.IsDone()) {
+        continue;
+      }
+      if (!ep_->TakeInPlace(src_tag_, msg)) {
+        break;
+      }
+      CopyOut(msg, op.iov.data(), op.iov.size());
+      ep_->ReleaseInPlace(msg);
+      op.req.comp++;
+    }
+    while (!send_ops_.empty() && send_ops_.front().IsDone()) {
+      RNETLIB_TRACE_INSTANT("ofi_isend_done", send_ops_.front().len);
+      send_ops_.pop_front();
+    }
+    while (!recv_ops_.empty() && recv_ops_.front().IsDone()) {
+      RNETLIB_TRACE_INSTANT("ofi_irecv_done", recv_ops_.front().len);
+      recv_ops_.pop_front();
+    }
+  }
 };
 
 } // namespace ofi
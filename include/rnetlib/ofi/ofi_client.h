@@ -12,7 +12,11 @@ namespace ofi {
 
 class OFIClient : public Client {
  public:
-  explicit OFIClient(uint64_t self_desc) : ep_(OFIEndpoint::GetInstance(nullptr, nullptr)), self_desc_(self_desc) {
+  // with (private_ep), the channels of this client share an endpoint of their own rather than that of the process.
+  // with (multi_recv), small messages land in the multi-receive buffers of the endpoint, if the server agrees.
+  explicit OFIClient(uint64_t self_desc, bool private_ep = false, bool multi_recv = false)
+      : ep_(private_ep ? OFIEndpoint::New(nullptr, nullptr) : OFIEndpoint::GetInstance(nullptr, nullptr)),
+        self_desc_(self_desc), multi_recv_(multi_recv) {
     std::memset(&tx_req_, 0, sizeof(tx_req_));
   }
 
@@ -20,29 +24,48 @@ class OFIClient : public Client {
 
   Channel::ptr Connect(const std::string &peer_addr, uint16_t peer_port, uint64_t peer_desc) override {
     fi_addr_t fi_addr = FI_ADDR_UNSPEC;
-    ep_.InsertAddr(peer_addr.c_str(), peer_port, &fi_addr);
+    ep_->InsertAddr(peer_addr.c_str(), peer_port, &fi_addr);
 
-    auto &self_addrinfo = ep_.GetBindAddrInfo();
+    auto &self_addrinfo = ep_->GetBindAddrInfo();
     self_addrinfo.desc = self_desc_;
-    self_addrinfo.src_tag = ep_.GetNewSrcTag();
-    auto lmr = ep_.RegisterMemoryRegion(&self_addrinfo, sizeof(self_addrinfo), MR_LOCAL_READ);
+    self_addrinfo.src_tag = ep_->GetNewSrcTag();
+    self_addrinfo.flags = (multi_recv_ && ep_->EnableMultiRecv()) ? OFI_ADDRINFO_MULTI_RECV : 0;
     std::unique_ptr<OFIChannel> ch(new OFIChannel(ep_, fi_addr, peer_desc, self_addrinfo.src_tag));
 
-    ep_.PostSend(lmr->GetAddr(), lmr->GetLength(), lmr->GetLKey(), fi_addr,
-                 (TAG_PROTO_CTR << OFI_TAG_SOURCE_BITS), &tx_req_);
-    ep_.PollTxCQ(tx_req_.req, &tx_req_);
-    assert(tx_req_.req == 0);
+    if (sizeof(self_addrinfo) <= ep_->GetInjectSize()) {
+      if (ep_->Inject(&self_addrinfo, sizeof(self_addrinfo), fi_addr, (TAG_PROTO_CTR << OFI_TAG_SOURCE_BITS)) != 0) {
+        // error
+        return nullptr;
+      }
+    } else {
+      auto lmr = ep_->RegisterMemoryRegion(&self_addrinfo, sizeof(self_addrinfo), MR_LOCAL_READ);
+      ep_->PostSend(lmr->GetAddr(), lmr->GetLength(), lmr->GetLKey(), fi_addr,
+                   (TAG_PROTO_CTR << OFI_TAG_SOURCE_BITS), &tx_req_);
+      ep_->PollTxCQ(tx_req_.req, &tx_req_);
+      assert(tx_req_.req == 0);
+    }
 
-    uint64_t dst_tag = 0;
-    ch->Recv(&dst_tag, sizeof(dst_tag));
-    ch->SetDestTag(dst_tag);
+    struct ofi_addrinfo peer_ai;
+    ch->Recv(&peer_ai, sizeof(peer_ai));
+    if (peer_ai.addrlen > 0) {
+      // the server has given the channel an endpoint of its own
+      fi_addr_t ch_addr = FI_ADDR_UNSPEC;
+      ep_->InsertAddr(&peer_ai.addr, &ch_addr);
+      ch->SetPeerAddr(ch_addr);
+    }
+    ch->SetDestTag(peer_ai.src_tag);
+    if (peer_ai.flags & OFI_ADDRINFO_MULTI_RECV) {
+      ch->SetMultiRecv();
+    }
+    RNETLIB_PROBE2(connect, ch.get(), peer_desc);
 
     return std::move(ch);
   }
 
  private:
-  OFIEndpoint &ep_;
+  OFIEndpoint::ptr ep_;
   uint64_t self_desc_;
+  bool multi_recv_;
   struct ofi_req tx_req_;
 };
 
@@ -0,0 +1,102 @@
+#ifndef RNETLIB_OFI_OFI_CONTEXT_POOL_H_
+#define RNETLIB_OFI_OFI_CONTEXT_POOL_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "rnetlib/perf_counters.h"
+
+namespace rnetlib {
+namespace ofi {
+
+// A freelist of operation contexts (T), so that posting an operation and taking its completion cost no allocator
+// calls. The contexts are carved out of cache-aligned slabs, a slab at a time up to (max_entries) contexts,
+// and any context beyond that comes from the heap and goes back to it.
+// NOTE: this is not thread-safe, just like the endpoint is not.
+template <typename T>
+class OFIContextPool {
+ public:
+  explicit OFIContextPool(PerfCounters &perf) : perf_(perf), max_entries_(0), num_entries_(0), free_(nullptr) {}
+
+  void SetMaxEntries(size_t max_entries) { max_entries_ = max_entries; }
+
+  T *Get() {
+    if (!free_ && !Grow()) {
+      perf_.Add(PERF_CTX_ALLOCS);
+      auto entry = new Entry;
+      entry->pooled = false;
+      return &entry->value;
+    }
+
+    auto entry = free_;
+    free_ = entry->next;
+    return &entry->value;
+  }
+
+  void Put(T *value) {
+    // (value) is the first member of its entry
+    auto entry = reinterpret_cast<Entry *>(value);
+    if (!entry->pooled) {
+      delete entry;
+      return;
+    }
+
+    entry->next = free_;
+    free_ = entry;
+  }
+
+ private:
+  struct Entry {
+    T value;
+    Entry *next;
+    // false for the entries taken from the heap
+    bool pooled;
+  };
+
+  struct SlabDeleter {
+    void operator()(char *slab) const { std::free(slab); }
+  };
+
+  static const size_t kCacheLineSize = 64;
+  static const size_t kSlabEntries = 256;
+  // entries padded to whole cache lines, so that no two contexts in flight share one
+  static const size_t kEntrySize = (sizeof(Entry) + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+
+  PerfCounters &perf_;
+  size_t max_entries_;
+  size_t num_entries_;
+  Entry *free_;
+  std::vector<std::unique_ptr<char, SlabDeleter>> slabs_;
+
+  bool Grow() {
+    auto num_adding = std::min(kSlabEntries, max_entries_ - num_entries_);
+    if (num_adding == 0) {
+      return false;
+    }
+
+    void *slab = nullptr;
+    if (posix_memalign(&slab, kCacheLineSize, kEntrySize * num_adding) != 0) {
+      return false;
+    }
+    perf_.Add(PERF_CTX_ALLOCS);
+    slabs_.emplace_back(static_cast<char *>(slab));
+
+    for (size_t i = 0; i < num_adding; i++) {
+      auto entry = new (static_cast<char *>(slab) + i * kEntrySize) Entry;
+      entry->pooled = true;
+      entry->next = free_;
+      free_ = entry;
+    }
+    num_entries_ += num_adding;
+
+    return true;
+  }
+};
+
+} // namespace ofi
+} // namespace rnetlib
+
+#endif // RNETLIB_OFI_OFI_CONTEXT_POOL_H_
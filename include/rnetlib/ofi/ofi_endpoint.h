@@ -3,14 +3,26 @@
 
 #include <rdma/fabric.h>
 #include "rdma/fi_cm.h"
+#include <rdma/fi_atomic.h>
 #include <rdma/fi_domain.h>
 #include <rdma/fi_endpoint.h>
 #include <rdma/fi_rma.h>
 #include <rdma/fi_tagged.h>
 
+#include <atomic>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <string>
-
+#include <unordered_map>
+#include <vector>
+
+#include "rnetlib/atomic_op.h"
+#include "rnetlib/perf_counters.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
+#include "rnetlib/wait_policy.h"
+#include "rnetlib/ofi/ofi_context_pool.h"
 #include "rnetlib/ofi/ofi_local_memory_region.h"
 
 #define OFI_VERSION FI_VERSION(1, 5)
@@ -25,17 +37,19 @@
 
 #define OFI_CTX_NEW(ctx, req)  \
   do {                         \
-    (ctx) = new ofi_context;   \
+    (ctx) = ctx_pool_.Get();   \
     (ctx)->req = req;          \
+    LinkCtx(ctx);              \
   } while (0)                  \
 
-#define OFI_CTX_FREE(ctx) \
-  do {                    \
-    if (ctx)  {           \
-      delete (ctx);       \
-      (ctx) = nullptr;      \
-    }                     \
-  } while (0)             \
+#define OFI_CTX_FREE(ctx)     \
+  do {                        \
+    if (ctx)  {               \
+      UnlinkCtx(ctx);         \
+      ctx_pool_.Put(ctx);     \
+      (ctx) = nullptr;        \
+    }                         \
+  } while (0)                 \
 
 #define OFI_PRINTERR(tag, err)                                     \
   do {                                                             \
@@ -63,12 +77,31 @@
         OFI_PRINTERR(post, ret);                                          \
         OFI_CTX_FREE(ctx);                                                \
         return 0;                                                         \
-      } else if (info_->domain_attr->data_progress != FI_PROGRESS_AUTO) { \
+      }                                                                   \
+      perf_.Add(PERF_POST_RETRIES);                                       \
+      if (info_->domain_attr->data_progress != FI_PROGRESS_AUTO) {        \
         comp_func(1, (ctx)->req);                                         \
       }                                                                   \
     }                                                                     \
   } while (0)                                                             \
 
+// posts an operation of (req) that completes on the tx counter only, without a context or a CQ entry.
+#define OFI_POST_COUNTED(post_func, req)                                  \
+  do {                                                                    \
+    while (true) {                                                        \
+      ssize_t ret = post_func;                                            \
+      if (ret == 0) {                                                     \
+        (req)->cntr_target = ++num_tx_posted_;                            \
+        break;                                                            \
+      } else if (ret != -FI_EAGAIN) {                                     \
+        OFI_PRINTERR(post, ret);                                          \
+        return 0;                                                         \
+      }                                                                   \
+      perf_.Add(PERF_POST_RETRIES);                                       \
+      ProgressTxCQ();                                                     \
+    }                                                                     \
+  } while (0)                                                             \
+
 namespace rnetlib {
 namespace ofi {
 
@@ -77,29 +110,56 @@ enum TagProto : uint64_t {
   TAG_PROTO_CTR
 };
 
+// the sender of an ofi_addrinfo takes small messages into multi-receive buffers
+#define OFI_ADDRINFO_MULTI_RECV (1ULL << 0)
+
 struct ofi_addrinfo {
   char addr[FI_NAME_MAX];
   size_t addrlen;
   uint64_t desc;
   uint64_t src_tag;
+  uint64_t flags;
+};
+
+// a small message in a multi-receive buffer of the endpoint, which stays there until it is released.
+struct ofi_inplace_msg {
+  void *buf;
+  size_t len;
+  void *owner;
 };
 
 struct ofi_req {
   uint64_t req;
   uint64_t comp;
+  // for the operations counted on the tx counter: the value the counter reaches once they have completed
+  // (0 if there are none), and the # of errors it had before they were posted
+  uint64_t cntr_target;
+  uint64_t cntr_errors;
 };
 
+// NOTE: an endpoint is not thread-safe. threads that communicate in parallel need endpoints of their own.
 class OFIEndpoint {
  public:
-  static OFIEndpoint &GetInstance(const char *addr, const char *port) {
-    static OFIEndpoint ep(addr, port);
+  using ptr = std::shared_ptr<OFIEndpoint>;
+
+  // the endpoint shared by the clients and servers that do not have one of their own.
+  static ptr GetInstance(const char *addr, const char *port) {
+    static ptr ep(new OFIEndpoint(addr, port));
     return ep;
   }
 
+  // a new endpoint with its own CQs, address vector and contexts. it lives as long as the channels on it,
+  // and the regions registered with it have to be released before it goes.
+  static ptr New(const char *addr, const char *port) { return ptr(new OFIEndpoint(addr, port)); }
+
   virtual ~OFIEndpoint() = default;
 
+  // counters of all the OFI endpoints in this process.
+  static PerfSnapshot GetPerfCounters() { return GetCounters().Snapshot(); }
+
   LocalMemoryRegion::ptr RegisterMemoryRegion(void *buf, size_t len, int type) {
-    static uint64_t requested_key = 0;
+    // keys are unique across the endpoints, which may register regions from several threads
+    static std::atomic<uint64_t> requested_key(0);
     uint64_t access = 0;
 
     if (type & MR_REMOTE_READ) {
@@ -108,6 +168,9 @@ class OFIEndpoint {
     if (type & MR_REMOTE_WRITE) {
       access |= FI_REMOTE_WRITE;
     }
+    if (type & MR_REMOTE_ATOMIC) {
+      access |= (FI_REMOTE_READ | FI_REMOTE_WRITE);
+    }
 
     if ((info_->mode & FI_LOCAL_MR) || (info_->domain_attr->mr_mode & FI_MR_LOCAL)) {
       if (type & MR_LOCAL_READ) {
@@ -122,12 +185,16 @@ class OFIEndpoint {
       }
     }
 
+    RNETLIB_TRACE_SCOPE("ofi_reg_mr", len);
+    RNETLIB_PROBE2(mr_reg_entry, buf, len);
+    perf_.Add(PERF_MR_REGS);
     struct fid_mr *tmp_mr = nullptr;
     auto ret = fi_mr_reg(domain_.get(), buf, len, access, 0, requested_key++, 0, &tmp_mr, nullptr);
     if (ret) {
       OFI_PRINTERR(mr_reg, ret);
       return nullptr;
     }
+    RNETLIB_PROBE2(mr_reg_return, buf, len);
 
     return LocalMemoryRegion::ptr(new OFILocalMemoryRegion(tmp_mr, buf, len));
   }
@@ -137,18 +204,37 @@ class OFIEndpoint {
     OFI_CTX_NEW(ctx, req);
 
     OFI_POST(fi_tsend(ep_.get(), buf, len, desc, dst_addr, tag, &ctx->ctx), PollTxCQ, ctx);
+    CountTx();
+    RNETLIB_TRACE_INSTANT("ofi_post_send", len);
 
     return 0;
   }
 
-  ssize_t PostSend(struct iovec *iov, void **desc, size_t cnt, fi_addr_t dst_addr, uint64_t tag, struct ofi_req *req) {
+  // a batch of sends, which is waited for with WaitTx(). unless (counted), they complete on the tx CQ even with
+  // the tx counter, so that (req) tells when they are done.
+  ssize_t PostSend(struct iovec *iov, void **desc, size_t cnt, fi_addr_t dst_addr, uint64_t tag, struct ofi_req *req,
+                   bool counted = true) {
     struct ofi_context *ctx = nullptr;
     size_t offset = 0;
+    counted = counted && BeginCounted(req);
 
     while (offset < cnt) {
       auto num_iov = ((cnt - offset) > max_msg_iov_) ? max_msg_iov_ : (cnt - offset);
-      OFI_CTX_NEW(ctx, req);
-      OFI_POST(fi_tsendv(ep_.get(), iov + offset, desc, num_iov, dst_addr, tag, &ctx->ctx), PollTxCQ, ctx);
+      if (counted) {
+        struct fi_msg_tagged msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov + offset;
+        msg.desc = desc + offset;
+        msg.iov_count = num_iov;
+        msg.addr = dst_addr;
+        msg.tag = tag;
+        OFI_POST_COUNTED(fi_tsendmsg(ep_.get(), &msg, GetCountedFlags()), req);
+      } else {
+        OFI_CTX_NEW(ctx, req);
+        OFI_POST(fi_tsendv(ep_.get(), iov + offset, desc + offset, num_iov, dst_addr, tag, &ctx->ctx), PollTxCQ, ctx);
+        CountTx();
+      }
+      RNETLIB_TRACE_INSTANT("ofi_post_send", num_iov);
       offset += num_iov;
     }
 
@@ -160,6 +246,7 @@ class OFIEndpoint {
     OFI_CTX_NEW(ctx, req);
 
     OFI_POST(fi_trecv(ep_.get(), buf, len, desc, 0, tag, 0, &ctx->ctx), PollRxCQ, ctx);
+    RNETLIB_TRACE_INSTANT("ofi_post_recv", len);
 
     return 0;
   }
@@ -172,64 +259,380 @@ class OFIEndpoint {
       auto num_iov = ((cnt - offset) > max_msg_iov_) ? max_msg_iov_ : (cnt - offset);
       OFI_CTX_NEW(ctx, req);
       OFI_POST(fi_trecvv(ep_.get(), iov + offset, desc, num_iov, 0, tag, 0, &ctx->ctx), PollRxCQ, ctx);
+      RNETLIB_TRACE_INSTANT("ofi_post_recv", num_iov);
       offset += num_iov;
     }
 
     return 0;
   }
 
+  // bulk RMA writes, which are waited for with WaitTx().
   ssize_t PostWrite(struct fi_msg_rma *msg, struct ofi_req *req) {
     struct ofi_context *ctx = nullptr;
     size_t offset = 0, iovcnt = msg->iov_count;
     auto msg_iov_head = msg->msg_iov;
     auto rma_iov_head = msg->rma_iov;
     auto desc_head = msg->desc;
+    auto counted = BeginCounted(req);
 
     while (offset < iovcnt) {
-      OFI_CTX_NEW(ctx, req);
       auto num_iov = ((iovcnt - offset) > max_rma_iov_) ? max_rma_iov_ : (iovcnt - offset);
       msg->msg_iov = msg_iov_head + offset;
       msg->iov_count = num_iov;
       msg->rma_iov = rma_iov_head + offset;
       msg->rma_iov_count = num_iov;
       msg->desc = desc_head + offset;
-      msg->context = &ctx->ctx;
-      OFI_POST(fi_writemsg(ep_.get(), msg, 0), PollTxCQ, ctx);
+      if (counted) {
+        msg->context = nullptr;
+        OFI_POST_COUNTED(fi_writemsg(ep_.get(), msg, GetCountedFlags()), req);
+      } else {
+        OFI_CTX_NEW(ctx, req);
+        msg->context = &ctx->ctx;
+        OFI_POST(fi_writemsg(ep_.get(), msg, 0), PollTxCQ, ctx);
+        CountTx();
+      }
+      RNETLIB_TRACE_INSTANT("ofi_post_write", num_iov);
       offset += num_iov;
     }
 
     return 0;
   }
 
+  // bulk RMA reads, which are waited for with WaitTx().
   ssize_t PostRead(struct fi_msg_rma *msg, struct ofi_req *req) {
     struct ofi_context *ctx = nullptr;
     size_t offset = 0, iovcnt = msg->iov_count;
     auto msg_iov_head = msg->msg_iov;
     auto rma_iov_head = msg->rma_iov;
     auto desc_head = msg->desc;
+    auto counted = BeginCounted(req);
 
     while (offset < iovcnt) {
-      OFI_CTX_NEW(ctx, req);
       auto num_iov = ((iovcnt - offset) > max_rma_iov_) ? max_rma_iov_ : (iovcnt - offset);
       msg->msg_iov = msg_iov_head + offset;
       msg->iov_count = num_iov;
       msg->rma_iov = rma_iov_head + offset;
       msg->rma_iov_count = num_iov;
       msg->desc = desc_head + offset;
-      msg->context = &ctx->ctx;
-      OFI_POST(fi_readmsg(ep_.get(), msg, 0), PollTxCQ, ctx);
+      if (counted) {
+        msg->context = nullptr;
+        OFI_POST_COUNTED(fi_readmsg(ep_.get(), msg, GetCountedFlags()), req);
+      } else {
+        OFI_CTX_NEW(ctx, req);
+        msg->context = &ctx->ctx;
+        OFI_POST(fi_readmsg(ep_.get(), msg, 0), PollTxCQ, ctx);
+        CountTx();
+      }
+      RNETLIB_TRACE_INSTANT("ofi_post_read", num_iov);
       offset += num_iov;
     }
 
     return 0;
   }
 
-  size_t PollTxCQ(size_t count, struct ofi_req *req) { return PollCQ(tx_cq_.get(), count, req); }
+  // posts (op) on the word at (op.offset) into the peer's region. (desc) is that of the memory holding (op).
+  ssize_t PostAtomic(AtomicOp &op, void *desc, fi_addr_t dst_addr, struct ofi_req *req) {
+    if (!has_atomics_) {
+      return -FI_EOPNOTSUPP;
+    }
+
+    struct ofi_context *ctx = nullptr;
+    auto addr = op.rmr.addr + op.offset;
+    OFI_CTX_NEW(ctx, req);
+    switch (op.opcode) {
+      case ATOMIC_FETCH_ADD:
+        OFI_POST(fi_fetch_atomic(ep_.get(), &op.operand, 1, desc, &op.result, desc, dst_addr, addr, op.rmr.rkey,
+                                 FI_UINT64, FI_SUM, &ctx->ctx), PollTxCQ, ctx);
+        break;
+      case ATOMIC_COMPARE_SWAP:
+        OFI_POST(fi_compare_atomic(ep_.get(), &op.operand, 1, desc, &op.compare, desc, &op.result, desc, dst_addr,
+                                   addr, op.rmr.rkey, FI_UINT64, FI_CSWAP, &ctx->ctx), PollTxCQ, ctx);
+        break;
+      case ATOMIC_SWAP:
+        OFI_POST(fi_fetch_atomic(ep_.get(), &op.operand, 1, desc, &op.result, desc, dst_addr, addr, op.rmr.rkey,
+                                 FI_UINT64, FI_ATOMIC_WRITE, &ctx->ctx), PollTxCQ, ctx);
+        break;
+    }
+    CountTx();
+    RNETLIB_TRACE_INSTANT("ofi_post_atomic", op.opcode);
+
+    return 0;
+  }
+
+  // true if remote regions are addressed by virtual addresses, rather than by offsets from their beginning.
+  bool UsesVirtAddr() const {
+    return (info_->domain_attr->mr_mode == FI_MR_BASIC) || (info_->domain_attr->mr_mode & FI_MR_VIRT_ADDR);
+  }
+
+  // writes (buf) into (addr) of the region of (key) and raises a notification of (value) at the peer,
+  // which is taken by the channel receiving with (tag).
+  ssize_t PostWriteData(void *buf, size_t len, void *desc, uint64_t tag, uint32_t value, fi_addr_t dst_addr,
+                        uint64_t addr, uint64_t key, struct ofi_req *req) {
+    struct ofi_context *ctx = nullptr;
+    OFI_CTX_NEW(ctx, req);
+    OFI_POST(fi_writedata(ep_.get(), buf, len, desc, ToNotifyData(tag, value), dst_addr, addr, key, &ctx->ctx),
+             PollTxCQ, ctx);
+    CountTx();
+    RNETLIB_TRACE_INSTANT("ofi_post_write_data", len);
+
+    return 0;
+  }
+
+  // the largest message that can be injected
+  size_t GetInjectSize() const { return info_->tx_attr->inject_size; }
+
+  // sends (buf) of at most GetInjectSize() bytes without a context, and without a completion to wait for.
+  // (buf) can be reused as soon as this returns.
+  ssize_t Inject(const void *buf, size_t len, fi_addr_t dst_addr, uint64_t tag) {
+    while (true) {
+      auto ret = fi_tinject(ep_.get(), buf, len, dst_addr, tag);
+      if (ret != -FI_EAGAIN) {
+        if (ret) {
+          OFI_PRINTERR(inject, ret);
+        } else {
+          CountTx(false);
+        }
+        RNETLIB_TRACE_INSTANT("ofi_inject", len);
+        return ret;
+      }
+      perf_.Add(PERF_POST_RETRIES);
+      ProgressTxCQ();
+    }
+  }
+
+  // fi_writedata() of at most GetInjectSize() bytes, which is done once this returns as Inject() is.
+  ssize_t InjectWriteData(const void *buf, size_t len, uint64_t tag, uint32_t value, fi_addr_t dst_addr,
+                          uint64_t addr, uint64_t key) {
+    while (true) {
+      auto ret = fi_inject_writedata(ep_.get(), buf, len, ToNotifyData(tag, value), dst_addr, addr, key);
+      if (ret != -FI_EAGAIN) {
+        if (ret) {
+          OFI_PRINTERR(inject_writedata, ret);
+        } else {
+          CountTx(false);
+        }
+        RNETLIB_TRACE_INSTANT("ofi_inject_write_data", len);
+        return ret;
+      }
+      perf_.Add(PERF_POST_RETRIES);
+      ProgressTxCQ();
+    }
+  }
+
+  // waits for the next notification to the channel receiving with (tag).
+  // remote CQ data consumes an untagged receive, one of which is kept posted while someone is waiting.
+  // with multi-receive buffers, those take the notifications instead.
+  bool WaitNotify(uint64_t tag, uint32_t &value, Waiter *waiter) {
+    auto &notifications = notifications_[ToNotifyKey(tag)];
+
+    while (notifications.empty()) {
+      if (!mrecv_bufs_.empty()) {
+        if (!WaitMultiRecv(waiter)) {
+          return false;
+        }
+        continue;
+      }
+      if (notify_req_.req == 0) {
+        struct ofi_context *ctx = nullptr;
+        auto req = &notify_req_;
+        OFI_CTX_NEW(ctx, req);
+        OFI_POST(fi_recv(ep_.get(), nullptr, 0, nullptr, FI_ADDR_UNSPEC, &ctx->ctx), PollRxCQ, ctx);
+      }
+      PollRxCQ(notify_req_.req, &notify_req_, waiter);
+      if (notify_req_.req != 0) {
+        // timed out, but the receive stays posted for the next wait
+        return false;
+      }
+    }
+    value = notifications.front();
+    notifications.pop_front();
+
+    return true;
+  }
+
+  // the largest small message, which lands in a multi-receive buffer
+  static const size_t kMultiRecvMsgSize = 4096;
+
+  // posts the multi-receive buffers small messages land in, unless they have been posted already.
+  // returns false if the provider cannot take them, in which case small messages are received as usual.
+  // the untagged receive WaitNotify() may have left posted is cancelled first, so that it takes no small message.
+  bool EnableMultiRecv() {
+    if (!(info_->caps & FI_MULTI_RECV) || info_->domain_attr->cq_data_size < sizeof(uint64_t)) {
+      // the tag of the receiving channel goes in the CQ data
+      return false;
+    }
+    if (mrecv_bufs_.empty()) {
+      if (notify_req_.req > 0) {
+        // it completes with FI_ECANCELED, or with a notification that has come in the meantime
+        Cancel(&notify_req_);
+        PollRxCQ(notify_req_.req, &notify_req_);
+      }
+      for (size_t i = 0; i < kNumMultiRecvBufs; i++) {
+        std::unique_ptr<MultiRecvBuf> mbuf(new MultiRecvBuf);
+        mbuf->buf.reset(new char[kMultiRecvBufSize]);
+        mbuf->lmr = RegisterMemoryRegion(mbuf->buf.get(), kMultiRecvBufSize, MR_LOCAL_WRITE);
+        if (!mbuf->lmr) {
+          mrecv_bufs_.clear();
+          return false;
+        }
+        mbuf->ctx.req = &mrecv_req_;
+        mbuf->num_held = 0;
+        mbuf->posted = false;
+        mrecv_bufs_.push_back(std::move(mbuf));
+      }
+      PostMultiRecvBufs();
+    }
+    return true;
+  }
+
+  // sends (iov) as a small message to the multi-receive buffers of the peer, for the channel receiving with (tag).
+  ssize_t PostSendData(struct iovec *iov, void **desc, size_t cnt, fi_addr_t dst_addr, uint64_t tag,
+                       struct ofi_req *req) {
+    struct ofi_context *ctx = nullptr;
+    struct fi_msg msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.desc = desc;
+    msg.iov_count = cnt;
+    msg.addr = dst_addr;
+    msg.data = ToNotifyData(tag, 0);
+    OFI_CTX_NEW(ctx, req);
+    msg.context = &ctx->ctx;
+    OFI_POST(fi_sendmsg(ep_.get(), &msg, info_->tx_attr->op_flags | FI_REMOTE_CQ_DATA), PollTxCQ, ctx);
+    CountTx();
+    RNETLIB_TRACE_INSTANT("ofi_post_send_data", cnt);
+
+    return 0;
+  }
+
+  // PostSendData() of at most GetInjectSize() bytes, which is done once this returns as Inject() is.
+  ssize_t InjectData(const void *buf, size_t len, fi_addr_t dst_addr, uint64_t tag) {
+    while (true) {
+      auto ret = fi_injectdata(ep_.get(), buf, len, ToNotifyData(tag, 0), dst_addr);
+      if (ret != -FI_EAGAIN) {
+        if (ret) {
+          OFI_PRINTERR(injectdata, ret);
+        } else {
+          CountTx(false);
+        }
+        RNETLIB_TRACE_INSTANT("ofi_inject_data", len);
+        return ret;
+      }
+      perf_.Add(PERF_POST_RETRIES);
+      ProgressTxCQ();
+    }
+  }
+
+  // takes the next small message to the channel receiving with (tag), if it has come.
+  bool TakeInPlace(uint64_t tag, struct ofi_inplace_msg &msg) {
+    auto &msgs = inplace_msgs_[ToNotifyKey(tag)];
+    if (msgs.empty()) {
+      return false;
+    }
+    msg = msgs.front();
+    msgs.pop_front();
+    return true;
+  }
+
+  // waits for the next small message to the channel receiving with (tag).
+  bool WaitInPlace(uint64_t tag, struct ofi_inplace_msg &msg, Waiter *waiter) {
+    while (!TakeInPlace(tag, msg)) {
+      if (!WaitMultiRecv(waiter)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // hands a small message back, and its buffer back to the provider once nothing in it is held any more.
+  void ReleaseInPlace(const struct ofi_inplace_msg &msg) {
+    static_cast<MultiRecvBuf *>(msg.owner)->num_held--;
+    PostMultiRecvBufs();
+  }
+
+  // waits for the operations posted with (req) by PostSend(iov), PostWrite() or PostRead(), whether they are
+  // counted or have contexts. returns false if any of them has failed or the wait has timed out.
+  bool WaitTx(struct ofi_req *req, Waiter *waiter) {
+    auto ok = true;
+    if (req->cntr_target > 0) {
+      ok = WaitTxCounter(req, waiter);
+      req->cntr_target = 0;
+    }
+    if (req->req > 0) {
+      PollTxCQ(req->req, req, waiter);
+    }
+    return ok && (req->req == 0);
+  }
+
+  // cancels the operations of (req) still in flight, which then complete with FI_ECANCELED (or as usual, if they
+  // have completed already). providers may not cancel sends.
+  void Cancel(struct ofi_req *req) {
+    for (auto ctx = ctxs_.next; ctx != &ctxs_; ctx = ctx->next) {
+      if (ctx->req == req) {
+        auto ret = fi_cancel(&ep_->fid, &ctx->ctx);
+        if (ret != 0 && ret != -FI_ENOENT) {
+          OFI_PRINTERR(cancel, ret);
+        }
+      }
+    }
+  }
+
+  // lets the endpoint take the completions of the operations of (req) still in flight, so that (req) can go away.
+  void Orphan(struct ofi_req *req) {
+    for (auto ctx = ctxs_.next; ctx != &ctxs_; ctx = ctx->next) {
+      if (ctx->req == req) {
+        ctx->req = &orphan_req_;
+      }
+    }
+  }
+
+  // takes every completion available now from both CQs, which completes the requests of their contexts.
+  // this is how the asynchronous operations of the channels make progress.
+  void Progress() {
+    PostMultiRecvBufs();
+    ProgressCQ(tx_cq_.get());
+    ProgressCQ(rx_cq_.get());
+  }
 
-  size_t PollRxCQ(size_t count, struct ofi_req *req) { return PollCQ(rx_cq_.get(), count, req); }
+  // appends the fds which become readable once the CQs have completions, or returns false if the CQs have none.
+  bool GetWaitFDs(std::vector<int> &fds) const {
+    if (tx_cq_fd_ < 0 || rx_cq_fd_ < 0) {
+      return false;
+    }
+    fds.push_back(tx_cq_fd_);
+    fds.push_back(rx_cq_fd_);
+    return true;
+  }
+
+  // returns true if it is safe to sleep on the fds of GetWaitFDs(), i.e., the CQs have nothing to take now.
+  // providers also make progress in here, which is why the fds must not be polled without it.
+  bool TryWait() {
+    struct fid *fids[] = {&tx_cq_->fid, &rx_cq_->fid};
+    return (fi_trywait(fabric_.get(), fids, 2) == FI_SUCCESS);
+  }
+
+  // whether Kick() is needed for transfers to move, and is safe to call from another thread.
+  bool NeedsKick() const {
+    return (info_->domain_attr->data_progress != FI_PROGRESS_AUTO && info_->domain_attr->threading == FI_THREAD_SAFE);
+  }
+
+  // drives the provider without taking any completion, so that it does not race with the thread which does.
+  void Kick() {
+    fi_cq_read(tx_cq_.get(), nullptr, 0);
+    fi_cq_read(rx_cq_.get(), nullptr, 0);
+  }
+
+  // (waiter) decides whether to spin or to sleep on the CQ, and when to give up (spins forever without it).
+  size_t PollTxCQ(size_t count, struct ofi_req *req, Waiter *waiter = nullptr) {
+    return PollCQ(tx_cq_.get(), count, req, waiter);
+  }
+
+  size_t PollRxCQ(size_t count, struct ofi_req *req, Waiter *waiter = nullptr) {
+    return PollCQ(rx_cq_.get(), count, req, waiter);
+  }
 
   uint64_t GetNewSrcTag() const {
-    static uint64_t source_tag = 1;
+    static std::atomic<uint64_t> source_tag(1);
     return ((TAG_PROTO_MSG << OFI_TAG_SOURCE_BITS) | source_tag++);
   }
 
@@ -247,6 +650,15 @@ class OFIEndpoint {
     }
   }
 
+  // inserts (count) addresses packed one after another with a single call. returns the # of those inserted.
+  size_t InsertAddrs(const void *addrs, size_t count, fi_addr_t *fi_addrs) {
+    int ret = fi_av_insert(av_.get(), addrs, count, fi_addrs, 0, nullptr);
+    if (ret < static_cast<int>(count)) {
+      OFI_PRINTERR(av_insert, ret);
+    }
+    return (ret < 0) ? 0 : static_cast<size_t>(ret);
+  }
+
   void RemoveAddr(fi_addr_t *fi_addr) {
     int ret = fi_av_remove(av_.get(), fi_addr, 1, 0);
     if (ret < 0) {
@@ -257,36 +669,91 @@ class OFIEndpoint {
   struct ofi_addrinfo &GetBindAddrInfo() { return bind_addr_; }
 
  private:
+  // the # of peers the AV is sized for up front, which it may grow past
+  static const size_t kAVCount = 4096;
+
   struct ofi_context {
     struct fi_context ctx;
     struct ofi_req *req;
+    // the contexts in flight are linked together, so that Cancel() and Orphan() can find those of a request
+    struct ofi_context *prev;
+    struct ofi_context *next;
+  };
+
+  // a large buffer small messages land in one after another (FI_MULTI_RECV)
+  struct MultiRecvBuf {
+    struct ofi_context ctx;
+    std::unique_ptr<char[]> buf;
+    LocalMemoryRegion::ptr lmr;
+    // # of the messages in the buffer which have not been released yet
+    size_t num_held;
+    // false once the provider is done with the buffer
+    bool posted;
   };
 
+  static const size_t kNumMultiRecvBufs = 4;
+  static const size_t kMultiRecvBufSize = 1 << 20;
+
   template <typename T>
   using ofi_ptr = std::unique_ptr<T, std::function<void(T *)>>;
 
   template <typename T>
   static void fid_deleter(T *fd) { OFI_CALL(fi_close(reinterpret_cast<struct fid *>(fd)), fid_close); }
 
+  // declared first, so that it is destroyed after the endpoint, which may still hold contexts
+  OFIContextPool<struct ofi_context> ctx_pool_;
   ofi_ptr<struct fi_info> hints_;
   ofi_ptr<struct fi_info> info_;
   ofi_ptr<struct fid_fabric> fabric_;
   ofi_ptr<struct fid_domain> domain_;
   ofi_ptr<struct fid_cq> tx_cq_;
   ofi_ptr<struct fid_cq> rx_cq_;
+  ofi_ptr<struct fid_cntr> tx_cntr_;
   ofi_ptr<struct fid_av> av_;
   ofi_ptr<struct fid_ep> ep_;
   size_t max_msg_iov_;
   size_t max_rma_iov_;
+  // whether the CQs have a wait object to sleep on
+  bool cq_waitable_;
+  // the fds of the CQs to poll() on (-1 unless their wait objects are fds)
+  int tx_cq_fd_;
+  int rx_cq_fd_;
+  bool cntr_waitable_;
+  // whether the provider supports atomic operations
+  bool has_atomics_;
+  // the # of operations posted to the tx side, which the tx counter counts up to once they have all completed
+  uint64_t num_tx_posted_;
+  // the # of the tx operations with a context whose completions have not been taken from the tx CQ yet
+  uint64_t num_tx_ctx_pending_;
+  // notifications taken from the rx CQ, by the tag of the channel they are raised to
+  std::unordered_map<uint64_t, std::deque<uint32_t>> notifications_;
+  struct ofi_req notify_req_;
+  // the head of the contexts in flight
+  struct ofi_context ctxs_;
+  // takes the completions of the operations whose requests have gone
+  struct ofi_req orphan_req_;
+  std::vector<std::unique_ptr<MultiRecvBuf>> mrecv_bufs_;
+  // counts what lands in the multi-receive buffers
+  struct ofi_req mrecv_req_;
+  // small messages in the multi-receive buffers, by the tag of the channel they are sent to
+  std::unordered_map<uint64_t, std::deque<struct ofi_inplace_msg>> inplace_msgs_;
   struct ofi_addrinfo bind_addr_;
+  PerfCounters &perf_;
+
+  static PerfCounters &GetCounters() {
+    static PerfCounters counters;
+    return counters;
+  }
 
   OFIEndpoint(const char *addr, const char *port)
-      : hints_(fi_allocinfo(), fi_freeinfo), info_(nullptr, fi_freeinfo),
+      : ctx_pool_(GetCounters()), hints_(fi_allocinfo(), fi_freeinfo), info_(nullptr, fi_freeinfo),
         fabric_(nullptr, fid_deleter<struct fid_fabric>), domain_(nullptr, fid_deleter<struct fid_domain>),
         tx_cq_(nullptr, fid_deleter<struct fid_cq>), rx_cq_(nullptr, fid_deleter<struct fid_cq>),
-        av_(nullptr, fid_deleter<struct fid_av>), ep_(nullptr, fid_deleter<struct fid_ep>) {
-    hints_->caps = FI_MSG | FI_RMA | FI_TAGGED;
-    hints_->mode = FI_CONTEXT | FI_ASYNC_IOV;
+        tx_cntr_(nullptr, fid_deleter<struct fid_cntr>), av_(nullptr, fid_deleter<struct fid_av>),
+        ep_(nullptr, fid_deleter<struct fid_ep>), tx_cq_fd_(-1), rx_cq_fd_(-1), cntr_waitable_(false),
+        num_tx_posted_(0), num_tx_ctx_pending_(0), perf_(GetCounters()) {
+    hints_->caps = FI_MSG | FI_RMA | FI_TAGGED | FI_ATOMIC | FI_MULTI_RECV;
+    hints_->mode = FI_CONTEXT | FI_ASYNC_IOV | FI_RX_CQ_DATA;
     hints_->domain_attr->resource_mgmt = FI_RM_ENABLED;
     hints_->ep_attr->type = FI_EP_RDM;
     hints_->ep_attr->mem_tag_format = OFI_TAG_PROTO_MASK | OFI_TAG_SOURCE_MASK;
@@ -297,10 +764,29 @@ class OFIEndpoint {
     hints_->tx_attr->msg_order = FI_ORDER_SAS;
     hints_->tx_attr->op_flags = FI_DELIVERY_COMPLETE | FI_COMPLETION;
 
-    // get provider information
+    // get provider information. multi-receive buffers and atomics are optional: atomics are given up first, as multi-receive buffers are what
+    // eager receives are built on.
+    const uint64_t optional_caps[] = {FI_ATOMIC, FI_MULTI_RECV, FI_ATOMIC | FI_MULTI_RECV};
+    const uint64_t all_caps = hints_->caps;
     struct fi_info *tmp_info = nullptr;
-    OFI_CALL(fi_getinfo(OFI_VERSION, addr, port, 0, hints_.get(), &tmp_info), getinfo);
+    int rc;
+    size_t i = 0;
+    while ((rc = fi_getinfo(OFI_VERSION, addr, port, 0, hints_.get(), &tmp_info)) != 0 &&
+           i < sizeof(optional_caps) / sizeof(optional_caps[0])) {
+      hints_->caps = all_caps & ~optional_caps[i++];
+    }
+    OFI_CALL(rc, getinfo);
     info_.reset(tmp_info);
+    has_atomics_ = ((info_->caps & FI_ATOMIC) != 0);
+    std::memset(&notify_req_, 0, sizeof(notify_req_));
+    std::memset(&mrecv_req_, 0, sizeof(mrecv_req_));
+    std::memset(&orphan_req_, 0, sizeof(orphan_req_));
+    ctxs_.prev = ctxs_.next = &ctxs_;
+
+#ifndef RNETLIB_DISABLE_OFI_CONTEXT_POOL
+    // as many contexts as the queues can hold operations in flight
+    ctx_pool_.SetMaxEntries(info_->tx_attr->size + info_->rx_attr->size);
+#endif // RNETLIB_DISABLE_OFI_CONTEXT_POOL
 
     max_msg_iov_ = std::min(info_->tx_attr->iov_limit, info_->rx_attr->iov_limit);
     max_rma_iov_ = info_->tx_attr->rma_iov_limit;
@@ -318,14 +804,23 @@ class OFIEndpoint {
     // initialize completion queues
     struct fi_cq_attr cq_attr;
     std::memset(&cq_attr, 0, sizeof(cq_attr));
-    cq_attr.wait_obj = FI_WAIT_NONE;
+    // a wait object lets blocking operations sleep on the CQs (see WaitPolicy), and an fd lets OFIEventLoop poll()
+    // on them. providers without one are polled only.
+    cq_attr.wait_obj = FI_WAIT_FD;
     cq_attr.format = FI_CQ_FORMAT_TAGGED;
 
     // outgoing completion queue
     cq_attr.size = info_->tx_attr->size;
     struct fid_cq *tmp_txcq = nullptr;
-    OFI_CALL(fi_cq_open(domain_.get(), &cq_attr, &tmp_txcq, nullptr), cq_open);
+    if (fi_cq_open(domain_.get(), &cq_attr, &tmp_txcq, nullptr) != 0) {
+      cq_attr.wait_obj = FI_WAIT_UNSPEC;
+      if (fi_cq_open(domain_.get(), &cq_attr, &tmp_txcq, nullptr) != 0) {
+        cq_attr.wait_obj = FI_WAIT_NONE;
+        OFI_CALL(fi_cq_open(domain_.get(), &cq_attr, &tmp_txcq, nullptr), cq_open);
+      }
+    }
     tx_cq_.reset(tmp_txcq);
+    cq_waitable_ = (cq_attr.wait_obj != FI_WAIT_NONE);
 
     // incoming completion queue
     cq_attr.size = info_->rx_attr->size;
@@ -333,13 +828,40 @@ class OFIEndpoint {
     OFI_CALL(fi_cq_open(domain_.get(), &cq_attr, &tmp_rxcq, nullptr), cq_open);
     rx_cq_.reset(tmp_rxcq);
 
-    // TODO: retrieve completion with fi_cntr?
+    if (cq_attr.wait_obj == FI_WAIT_FD && (fi_control(&tx_cq_->fid, FI_GETWAIT, &tx_cq_fd_) != 0
+        || fi_control(&rx_cq_->fid, FI_GETWAIT, &rx_cq_fd_) != 0)) {
+      // blocking operations can still sleep in fi_cq_sread()
+      tx_cq_fd_ = rx_cq_fd_ = -1;
+    }
+
+#ifdef RNETLIB_ENABLE_OFI_COUNTERS
+    // bulk RMA and send batches only need to know that all of them have finished, so they complete on a counter
+    // of the tx operations instead of taking a context and a CQ entry each.
+    // the tx CQ is left for the operations that have to be told apart, which are posted with FI_COMPLETION.
+    if (info_->domain_attr->cntr_cnt > 0) {
+      struct fi_cntr_attr cntr_attr;
+      std::memset(&cntr_attr, 0, sizeof(cntr_attr));
+      cntr_attr.events = FI_CNTR_EVENTS_COMP;
+      cntr_attr.wait_obj = FI_WAIT_UNSPEC;
+      struct fid_cntr *tmp_cntr = nullptr;
+      if (fi_cntr_open(domain_.get(), &cntr_attr, &tmp_cntr, nullptr) != 0) {
+        cntr_attr.wait_obj = FI_WAIT_NONE;
+        if (fi_cntr_open(domain_.get(), &cntr_attr, &tmp_cntr, nullptr) != 0) {
+          // the CQ does it all
+          tmp_cntr = nullptr;
+        }
+      }
+      tx_cntr_.reset(tmp_cntr);
+      cntr_waitable_ = (cntr_attr.wait_obj != FI_WAIT_NONE);
+    }
+#endif // RNETLIB_ENABLE_OFI_COUNTERS
 
     // open address vector
+    // a table keeps the addresses of thousands of peers compact, and fi_addr_t is just an index into it.
     struct fi_av_attr av_attr;
     std::memset(&av_attr, 0, sizeof(av_attr));
-    av_attr.type = FI_AV_MAP;
-    av_attr.count = 32; // FIXME: actual # of procs.?
+    av_attr.type = FI_AV_TABLE;
+    av_attr.count = kAVCount;
 
     struct fid_av *tmp_av = nullptr;
     OFI_CALL(fi_av_open(domain_.get(), &av_attr, &tmp_av, nullptr), av_open);
@@ -350,9 +872,20 @@ class OFIEndpoint {
     OFI_CALL(fi_endpoint(domain_.get(), info_.get(), &tmp_ep, nullptr), endpoint);
     ep_.reset(tmp_ep);
 
+    if (info_->caps & FI_MULTI_RECV) {
+      // a multi-receive buffer is given back once it has no room for another small message
+      size_t min_multi_recv = kMultiRecvMsgSize;
+      OFI_CALL(fi_setopt(&ep_->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV, &min_multi_recv, sizeof(min_multi_recv)),
+               setopt);
+    }
+
     // bind resources to the endpoint
     OFI_CALL(fi_ep_bind(ep_.get(), &av_->fid, 0), ep_bind);
-    OFI_CALL(fi_ep_bind(ep_.get(), &tx_cq_->fid, FI_TRANSMIT), ep_bind);
+    if (tx_cntr_ && fi_ep_bind(ep_.get(), &tx_cntr_->fid, FI_SEND | FI_WRITE | FI_READ) != 0) {
+      tx_cntr_.reset();
+    }
+    OFI_CALL(fi_ep_bind(ep_.get(), &tx_cq_->fid, tx_cntr_ ? (FI_TRANSMIT | FI_SELECTIVE_COMPLETION) : FI_TRANSMIT),
+             ep_bind);
     OFI_CALL(fi_ep_bind(ep_.get(), &rx_cq_->fid, FI_RECV), ep_bind);
 
     // enable endpoint
@@ -363,35 +896,293 @@ class OFIEndpoint {
     OFI_CALL(fi_getname(&ep_->fid, &bind_addr_.addr, &bind_addr_.addrlen), getname);
   }
 
-  size_t PollCQ(struct fid_cq *cq, size_t count, struct ofi_req *req) {
+  // the remote CQ data of a notification carries the tag of the channel it is raised to above the value,
+  // unless the provider has no room for it. then the notifications of all the channels go together.
+  // FIXME: tell them apart without the tag
+  uint64_t ToNotifyData(uint64_t tag, uint32_t value) const {
+    return (info_->domain_attr->cq_data_size >= sizeof(uint64_t)) ? ((tag & OFI_TAG_SOURCE_MASK) << 32) | value : value;
+  }
+
+  uint64_t ToNotifyKey(uint64_t tag) const {
+    return (info_->domain_attr->cq_data_size >= sizeof(uint64_t)) ? (tag & OFI_TAG_SOURCE_MASK) : 0;
+  }
+
+  void LinkCtx(struct ofi_context *ctx) {
+    ctx->prev = &ctxs_;
+    ctx->next = ctxs_.next;
+    ctxs_.next->prev = ctx;
+    ctxs_.next = ctx;
+  }
+
+  void UnlinkCtx(struct ofi_context *ctx) {
+    ctx->prev->next = ctx->next;
+    ctx->next->prev = ctx->prev;
+  }
+
+  // the flags of the operations that complete on the tx counter only
+  uint64_t GetCountedFlags() const { return info_->tx_attr->op_flags & ~FI_COMPLETION; }
+
+  // every tx operation adds to the tx counter, so those with a context (or injected, without one) are counted
+  // as well.
+  void CountTx(bool has_ctx = true) {
+    if (tx_cntr_) {
+      num_tx_posted_++;
+      if (has_ctx) {
+        num_tx_ctx_pending_++;
+      }
+    }
+  }
+
+  // whether the operations posted next with (req) can complete on the tx counter.
+  // they cannot while an operation with a context is in flight, such as an asynchronous send the peer has not
+  // received yet, since the counter reaching their target would then depend on it as well. injected ones are left
+  // out of this, since they complete without the peer.
+  bool BeginCounted(struct ofi_req *req) {
+    if (!tx_cntr_ || num_tx_ctx_pending_ > 0) {
+      return false;
+    }
+    if (req->cntr_target == 0) {
+      // the failures of earlier operations are none of theirs
+      req->cntr_errors = fi_cntr_readerr(tx_cntr_.get());
+    }
+    return true;
+  }
+
+  // called for every completion taken from (cq), including failed ones.
+  void OnCompletion(struct fid_cq *cq) {
+    if (tx_cntr_ && cq == tx_cq_.get() && num_tx_ctx_pending_ > 0) {
+      num_tx_ctx_pending_--;
+    }
+  }
+
+  // waits until the tx counter reaches the target of (req), which nothing posted after it adds to.
+  bool WaitTxCounter(struct ofi_req *req, Waiter *waiter) {
+    uint64_t num_done = 0, num_errors = 0, num_empty_polls = 0;
+    bool sleep = false, timed_out = false;
+    RNETLIB_TRACE_SCOPE("ofi_wait_cntr", req->cntr_target);
+
+    if (waiter) {
+      waiter->Begin();
+    }
+    while (true) {
+      if (sleep) {
+        // returns early once an operation has failed, and -FI_ETIMEDOUT once the sleep has timed out
+        fi_cntr_wait(tx_cntr_.get(), req->cntr_target - num_errors, waiter->GetSleepMillis());
+        sleep = false;
+      }
+      perf_.Add(PERF_CQ_POLLS);
+      num_errors = fi_cntr_readerr(tx_cntr_.get());
+      num_done = fi_cntr_read(tx_cntr_.get());
+      if (num_done + num_errors >= req->cntr_target) {
+        break;
+      }
+      perf_.Add(PERF_CQ_EMPTY_POLLS);
+      num_empty_polls++;
+      if (waiter) {
+        auto action = waiter->OnEmptyPoll();
+        if (action == Waiter::WAIT_TIMED_OUT) {
+          perf_.Add(PERF_CQ_TIMEOUTS);
+          timed_out = true;
+          break;
+        }
+        sleep = (action == Waiter::WAIT_SLEEP && cntr_waitable_);
+        if (sleep) {
+          perf_.Add(PERF_CQ_SLEEPS);
+        }
+      }
+    }
+    if (waiter) {
+      waiter->End();
+    }
+    RNETLIB_PROBE3(cq_poll, tx_cntr_.get(), num_done, num_empty_polls);
+
+    // the counter does not tell which operations have failed, only that some have since those of (req) were posted
+    if (num_errors != req->cntr_errors) {
+      perf_.Add(PERF_CQ_ERRORS, num_errors - req->cntr_errors);
+    }
+    return !timed_out && (num_errors == req->cntr_errors);
+  }
+
+  // hands a successful completion taken from (cq) over to the request of its context.
+  void Complete(const struct fi_cq_err_entry &cqe, struct fid_cq *cq) {
+    OnCompletion(cq);
+    auto ctx = container_of(cqe.op_context, struct ofi_context, ctx);
+    if (ctx->req == &mrecv_req_) {
+      CompleteMultiRecv(cqe, ctx);
+      return;
+    }
+    if (cqe.flags & FI_REMOTE_CQ_DATA) {
+      notifications_[ToNotifyKey(cqe.data >> 32)].push_back(static_cast<uint32_t>(cqe.data));
+    }
+    OFI_CTX_COMP(ctx)++;
+    OFI_CTX_FREE(ctx);
+  }
+
+  // a message or a notification has landed in a multi-receive buffer, whose context is never freed.
+  void CompleteMultiRecv(const struct fi_cq_err_entry &cqe, struct ofi_context *ctx) {
+    auto mbuf = FindMultiRecvBuf(ctx);
+    mrecv_req_.comp++;
+    if ((cqe.flags & FI_REMOTE_CQ_DATA) && (cqe.flags & FI_MSG)) {
+      mbuf->num_held++;
+      inplace_msgs_[ToNotifyKey(cqe.data >> 32)].push_back({cqe.buf, cqe.len, mbuf});
+    } else if (cqe.flags & FI_REMOTE_CQ_DATA) {
+      notifications_[ToNotifyKey(cqe.data >> 32)].push_back(static_cast<uint32_t>(cqe.data));
+    }
+    if (cqe.flags & FI_MULTI_RECV) {
+      // the provider is done with the buffer, which is posted again once its messages have been released
+      mbuf->posted = false;
+    }
+  }
+
+  MultiRecvBuf *FindMultiRecvBuf(struct ofi_context *ctx) const {
+    for (const auto &mbuf : mrecv_bufs_) {
+      if (&mbuf->ctx == ctx) {
+        return mbuf.get();
+      }
+    }
+    return nullptr;
+  }
+
+  void PostMultiRecvBufs() {
+    for (auto &mbuf : mrecv_bufs_) {
+      if (mbuf->posted || mbuf->num_held > 0) {
+        continue;
+      }
+      struct iovec iov = {mbuf->buf.get(), kMultiRecvBufSize};
+      void *desc = mbuf->lmr->GetLKey();
+      struct fi_msg msg;
+      std::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.desc = &desc;
+      msg.iov_count = 1;
+      msg.addr = FI_ADDR_UNSPEC;
+      msg.context = &mbuf->ctx.ctx;
+      auto ret = fi_recvmsg(ep_.get(), &msg, FI_MULTI_RECV);
+      if (ret == 0) {
+        mbuf->posted = true;
+      } else if (ret != -FI_EAGAIN) {
+        OFI_PRINTERR(post, ret);
+      } // otherwise, tried again on the next wait
+    }
+  }
+
+  // waits for anything to land in the multi-receive buffers. returns false once the wait has timed out.
+  bool WaitMultiRecv(Waiter *waiter) {
+    PostMultiRecvBufs();
+    mrecv_req_.req = 1;
+    mrecv_req_.comp = 0;
+    return (PollRxCQ(1, &mrecv_req_, waiter) > 0);
+  }
+
+  // hands a failed completion over to the request of its context. returns false if it cannot be read.
+  bool CompleteError(struct fid_cq *cq) {
+    struct fi_cq_err_entry cqe;
+    perf_.Add(PERF_CQ_ERRORS);
+    auto ret = fi_cq_readerr(cq, &cqe, 0);
+    if (ret < 0) {
+      OFI_PRINTERR(cq_readerr, ret);
+      return false;
+    }
+    if (cqe.err != FI_ECANCELED) {
+      std::cerr << fi_cq_strerror(cq, cqe.prov_errno, cqe.err_data, nullptr, 0) << std::endl;
+    }
+    if (!cqe.op_context) {
+      // a counted operation, whose failure shows up on the tx counter
+      return true;
+    }
+    OnCompletion(cq);
+    auto ctx = container_of(cqe.op_context, struct ofi_context, ctx);
+    if (ctx->req == &mrecv_req_) {
+      // the message is lost, but the buffer may be done with
+      if (cqe.flags & FI_MULTI_RECV) {
+        FindMultiRecvBuf(ctx)->posted = false;
+      }
+      return true;
+    }
+    OFI_CTX_COMP(ctx)++;
+    OFI_CTX_FREE(ctx);
+    return true;
+  }
+
+  void ProgressCQ(struct fid_cq *cq) {
+    struct fi_cq_err_entry cqe;
+
+    while (true) {
+      perf_.Add(PERF_CQ_POLLS);
+      auto ret = fi_cq_read(cq, &cqe, 1);
+      if (ret > 0) {
+        Complete(cqe, cq);
+      } else if (ret == -FI_EAVAIL) {
+        if (!CompleteError(cq)) {
+          break;
+        }
+      } else {
+        if (ret != -FI_EAGAIN) {
+          OFI_PRINTERR(cq_read, ret);
+        } else {
+          perf_.Add(PERF_CQ_EMPTY_POLLS);
+        }
+        break;
+      }
+    }
+  }
+
+  // takes a completion of the tx CQ if any, so that the provider makes progress (under FI_PROGRESS_MANUAL)
+  // while nobody is waiting for completions. errors are left to the next PollCQ().
+  void ProgressTxCQ() {
+    struct fi_cq_err_entry cqe;
+    perf_.Add(PERF_CQ_POLLS);
+    if (fi_cq_read(tx_cq_.get(), &cqe, 1) > 0) {
+      Complete(cqe, tx_cq_.get());
+    }
+  }
+
+  size_t PollCQ(struct fid_cq *cq, size_t count, struct ofi_req *req, Waiter *waiter) {
     ssize_t ret = 0;
-    struct ofi_context *ctx = nullptr;
     struct fi_cq_err_entry cqe;
+    uint64_t num_empty_polls = 0;
+    bool sleep = false;
+    RNETLIB_TRACE_SCOPE("ofi_poll_cq", count);
 
+    if (waiter) {
+      waiter->Begin();
+    }
     while (req->comp < count) {
-      // FIXME: implement timeout
-      ret = fi_cq_read(cq, &cqe, 1);
+      // fi_cq_sread() returns -FI_EAGAIN once the sleep has timed out
+      ret = sleep ? fi_cq_sread(cq, &cqe, 1, nullptr, waiter->GetSleepMillis()) : fi_cq_read(cq, &cqe, 1);
+      sleep = false;
+      perf_.Add(PERF_CQ_POLLS);
       if (ret > 0) {
-        ctx = container_of(cqe.op_context, struct ofi_context, ctx);
-        OFI_CTX_COMP(ctx)++;
-        OFI_CTX_FREE(ctx);
+        Complete(cqe, cq);
       } else if (ret < 0 && ret == -FI_EAVAIL) {
-        ret = fi_cq_readerr(cq, &cqe, 0);
-        if (ret < 0) {
-          OFI_PRINTERR(cq_readerr, ret);
+        if (!CompleteError(cq)) {
           break;
         }
-        std::cerr << fi_cq_strerror(cq, cqe.prov_errno, cqe.err_data, nullptr, 0) << std::endl;
-        ctx = container_of(cqe.op_context, struct ofi_context, ctx);
-        OFI_CTX_COMP(ctx)++;
-        OFI_CTX_FREE(ctx);
       } else if (ret < 0 && ret != -FI_EAGAIN) {
         OFI_PRINTERR(cq_read, ret);
         break;
+      } else {
+        perf_.Add(PERF_CQ_EMPTY_POLLS);
+        num_empty_polls++;
+        if (waiter) {
+          auto action = waiter->OnEmptyPoll();
+          if (action == Waiter::WAIT_TIMED_OUT) {
+            perf_.Add(PERF_CQ_TIMEOUTS);
+            break;
+          }
+          sleep = (action == Waiter::WAIT_SLEEP && cq_waitable_);
+          if (sleep) {
+            perf_.Add(PERF_CQ_SLEEPS);
+          }
+        }
       }
     }
+    if (waiter) {
+      waiter->End();
+    }
 
     auto num_comp = req->comp;
+    RNETLIB_PROBE3(cq_poll, cq, num_comp, num_empty_polls);
     req->req -= num_comp;
     req->comp = 0;
 
@@ -0,0 +1,175 @@
+#ifndef RNETLIB_OFI_OFI_EVENT_LOOP_H_
+#define RNETLIB_OFI_OFI_EVENT_LOOP_H_
+
+#include <poll.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rnetlib/event_loop.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
+#include "rnetlib/ofi/ofi_channel.h"
+#include "rnetlib/ofi/ofi_endpoint.h"
+
+namespace rnetlib {
+namespace ofi {
+
+// Completes the asynchronous operations of OFI channels.
+// The channels share the CQs of the endpoint, so each of them drives the endpoint on its own in OnEvent(),
+// and retires its operations whose completions have been taken by anyone.
+// Once none of them has anything to retire, the loop sleeps on the fds of the CQs of their endpoints
+// (fi_trywait() tells whether it is safe to), and busy-polls if any of the endpoints has none.
+// With (progress_thread), a thread keeps kicking the endpoints of the channels, so that the transfers of providers
+// with manual progress (e.g., rendezvous and RMA) keep moving while the application is not in WaitAll().
+// only FI_THREAD_SAFE endpoints can be kicked from another thread; the others are left to WaitAll().
+class OFIEventLoop : public EventLoop {
+ public:
+  explicit OFIEventLoop(bool progress_thread = false) : stop_(false) {
+    if (progress_thread) {
+      progress_thread_ = std::thread([this] { RunProgress(); });
+    }
+  }
+
+  ~OFIEventLoop() override {
+    if (progress_thread_.joinable()) {
+      stop_ = true;
+      progress_thread_.join();
+    }
+  }
+
+  void AddHandler(EventHandler &handler) override {
+    auto itr = std::find_if(handlers_.begin(), handlers_.end(),
+                            [&handler](const EventHandler &h) { return h.GetHandlerID() == handler.GetHandlerID(); });
+    if (itr != handlers_.end()) {
+      return;
+    }
+    handlers_.emplace_back(std::ref(handler));
+
+    if (progress_thread_.joinable()) {
+      const auto &ep = reinterpret_cast<OFIChannel *>(handler.GetHandlerID())->GetEndpoint();
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (ep->NeedsKick() && std::find(kicked_eps_.begin(), kicked_eps_.end(), ep) == kicked_eps_.end()) {
+        kicked_eps_.push_back(ep);
+      }
+    }
+  }
+
+  int WaitAll(int timeout_millis) override {
+    auto beg = std::chrono::steady_clock::now();
+    std::vector<int> fds;
+    std::vector<struct pollfd> pfds;
+
+    while (!handlers_.empty()) {
+      perf_.Add(PERF_LOOP_WAITS);
+      int num_events = 0;
+      {
+        RNETLIB_TRACE_SCOPE("ofi_loop_poll", handlers_.size());
+        for (auto itr = handlers_.begin(); itr != handlers_.end();) {
+          if (itr->get().OnEvent(POLLIN, nullptr) == MAY_BE_REMOVED) {
+            itr = handlers_.erase(itr);
+            num_events++;
+          } else {
+            ++itr;
+          }
+        }
+      }
+
+      if (num_events > 0) {
+        perf_.Add(PERF_LOOP_WAKEUPS);
+        RNETLIB_TRACE_INSTANT("ofi_loop_wakeup", num_events);
+        RNETLIB_PROBE2(loop_wakeup, this, num_events);
+        perf_.Add(PERF_LOOP_EVENTS, static_cast<uint64_t>(num_events));
+        continue;
+      }
+
+      int wait_millis = -1;
+      if (timeout_millis >= 0) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - beg);
+        if (elapsed.count() >= timeout_millis) {
+          // timed out
+          perf_.Add(PERF_LOOP_TIMEOUTS);
+          return kErrTimedOut;
+        }
+        wait_millis = timeout_millis - static_cast<int>(elapsed.count());
+      }
+
+      if (!GetWaitFDs(fds)) {
+        // some of the endpoints can only be polled
+        continue;
+      }
+      pfds.clear();
+      for (auto fd : fds) {
+        pfds.emplace_back(pollfd{fd, POLLIN, 0});
+      }
+      int rc;
+      {
+        RNETLIB_TRACE_SCOPE("ofi_loop_sleep", pfds.size());
+        rc = poll(pfds.data(), static_cast<nfds_t>(pfds.size()), wait_millis);
+      }
+      if (rc < 0 && errno != EINTR) {
+        // TODO: log error
+        return kErrFailed;
+      } // otherwise, the handlers take whatever has come, and the timeout is checked on the next round
+    }
+
+    return 0;
+  }
+
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
+ private:
+  // how long the progress thread sleeps between two kicks of the endpoints
+  static const int kProgressIntervalUsecs = 50;
+
+  std::vector<std::reference_wrapper<EventHandler>> handlers_;
+  PerfCounters perf_;
+  std::thread progress_thread_;
+  std::atomic<bool> stop_;
+  // endpoints kicked by the progress thread, which hold on to them until this loop is gone
+  std::vector<OFIEndpoint::ptr> kicked_eps_;
+  std::mutex mtx_;
+
+  // collects the fds of the CQs of the endpoints of the handlers into (fds), if it is safe to sleep on all of them.
+  bool GetWaitFDs(std::vector<int> &fds) const {
+    std::vector<OFIEndpoint *> eps;
+    for (const auto &handler : handlers_) {
+      auto ep = reinterpret_cast<OFIChannel *>(handler.get().GetHandlerID())->GetEndpoint().get();
+      if (std::find(eps.begin(), eps.end(), ep) == eps.end()) {
+        eps.push_back(ep);
+      }
+    }
+
+    fds.clear();
+    for (auto ep : eps) {
+      // fi_trywait() fails if a CQ has completions to take, which the handlers do right away
+      if (!ep->GetWaitFDs(fds) || !ep->TryWait()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void RunProgress() {
+    while (!stop_) {
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const auto &ep : kicked_eps_) {
+          ep->Kick();
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(kProgressIntervalUsecs));
+    }
+  }
+};
+
+} // namespace ofi
+} // namespace rnetlib
+
+#endif // RNETLIB_OFI_OFI_EVENT_LOOP_H_
@@ -1,7 +1,7 @@
 #ifndef RNETLIB_OFI_OFI_SERVER_H_
 #define RNETLIB_OFI_OFI_SERVER_H_
 
-#include <array>
+#include <vector>
 
 #include "rnetlib/server.h"
 #include "rnetlib/ofi/ofi_endpoint.h"
@@ -11,55 +11,138 @@ namespace ofi {
 
 class OFIServer : public Server {
  public:
-  OFIServer(const std::string &bind_addr, uint16_t bind_port)
-      : ep_(OFIEndpoint::GetInstance(nullptr, std::to_string(bind_port).c_str())), ai_idx_(0) {
+  static const size_t kDefaultNumAcceptBufs = 64;
+
+  // with (private_eps), the server listens on an endpoint of its own, and every accepted channel gets another one,
+  // so that threads driving different channels never share an endpoint.
+  // with (multi_recv), small messages of the clients asking for it land in the multi-receive buffers of the endpoint.
+  // (num_accept_bufs) connection requests can arrive before Accept() takes them without being left to the provider.
+  OFIServer(const std::string &bind_addr, uint16_t bind_port, bool private_eps = false, bool multi_recv = false,
+            size_t num_accept_bufs = kDefaultNumAcceptBufs)
+      : ep_(private_eps ? OFIEndpoint::New(nullptr, std::to_string(bind_port).c_str())
+                        : OFIEndpoint::GetInstance(nullptr, std::to_string(bind_port).c_str())),
+        private_eps_(private_eps), multi_recv_(multi_recv), peer_ais_(num_accept_bufs), slots_(num_accept_bufs), head_(0) {
     // FIXME: bind endpoint to a specific local address
-    std::memset(&rx_req_, 0, sizeof(rx_req_));
   }
 
   ~OFIServer() override = default;
 
   bool Listen() override {
-    ai_lmrs_[0] = ep_.RegisterMemoryRegion(&peer_ai_[0], sizeof(peer_ai_[0]), MR_LOCAL_WRITE);
-    ai_lmrs_[1] = ep_.RegisterMemoryRegion(&peer_ai_[1], sizeof(peer_ai_[1]), MR_LOCAL_WRITE);
-    PostAccept();
+    ai_lmr_ = ep_->RegisterMemoryRegion(peer_ais_.data(), sizeof(struct ofi_addrinfo) * peer_ais_.size(),
+                                        MR_LOCAL_WRITE);
+    if (!ai_lmr_) {
+      return false;
+    }
+    for (size_t i = 0; i < slots_.size(); i++) {
+      PostAccept(i);
+    }
     return true;
   }
 
   Channel::ptr Accept() override {
-    PostAccept();
-    ep_.PollRxCQ(rx_req_.req - 1, &rx_req_);
-    assert(rx_req_.req == 1);
-    
-    fi_addr_t peer_addr = FI_ADDR_UNSPEC;
-    ep_.InsertAddr(&peer_ai_[ai_idx_].addr, &peer_addr);
-
-    auto src_tag = ep_.GetNewSrcTag();
-    std::unique_ptr<OFIChannel> ch(new OFIChannel(ep_, peer_addr, peer_ai_[ai_idx_].desc, src_tag));
-    ch->SetDestTag(peer_ai_[ai_idx_].src_tag);
-    ch->Send(&src_tag, sizeof(src_tag));
+    auto &slot = slots_[head_];
+    if (!IsArrived(slot)) {
+      ep_->PollRxCQ(slot.req.req, &slot.req);
+    }
+    ResolveArrived();
+
+    // the slot goes back to the ring right away, so the request is copied out first
+    auto peer_ai = peer_ais_[head_];
+    auto peer_addr = slot.peer_addr;
+    PostAccept(head_);
+    head_ = (head_ + 1) % slots_.size();
+
+    // the peer learns the tag of the channel, and its address unless it is on the listening endpoint
+    struct ofi_addrinfo self_ai;
+    std::memset(&self_ai, 0, sizeof(self_ai));
+    auto ch_ep = ep_;
+    if (private_eps_) {
+      ch_ep = OFIEndpoint::New(nullptr, nullptr);
+      self_ai = ch_ep->GetBindAddrInfo();
+      ch_ep->InsertAddr(&peer_ai.addr, &peer_addr);
+    }
+
+    self_ai.src_tag = ch_ep->GetNewSrcTag();
+    // small messages go through multi-receive buffers only if both sides have them
+    auto multi_recv = multi_recv_ && (peer_ai.flags & OFI_ADDRINFO_MULTI_RECV) && ch_ep->EnableMultiRecv();
+    self_ai.flags = multi_recv ? OFI_ADDRINFO_MULTI_RECV : 0;
+    std::unique_ptr<OFIChannel> ch(new OFIChannel(ch_ep, peer_addr, peer_ai.desc, self_ai.src_tag));
+    ch->SetDestTag(peer_ai.src_tag);
+    ch->Send(&self_ai, sizeof(self_ai));
+    if (multi_recv) {
+      ch->SetMultiRecv();
+    }
+    RNETLIB_PROBE2(accept, ch.get(), peer_ai.desc);
 
     return std::move(ch);
   }
 
   std::string GetRawAddr() const override {
-    const auto &self_addrinfo = ep_.GetBindAddrInfo();
+    const auto &self_addrinfo = ep_->GetBindAddrInfo();
     return std::string(self_addrinfo.addr, self_addrinfo.addrlen);
   }
 
   uint16_t GetListenPort() const override { return 0; }
 
  private:
-  OFIEndpoint &ep_;
-  int ai_idx_;
-  std::array<struct ofi_addrinfo, 2> peer_ai_;
-  std::array<LocalMemoryRegion::ptr, 2> ai_lmrs_;
-  struct ofi_req rx_req_;
-
-  void PostAccept() {
-    ep_.PostRecv(ai_lmrs_[ai_idx_]->GetAddr(), ai_lmrs_[ai_idx_]->GetLength(), ai_lmrs_[ai_idx_]->GetLKey(),
-                 (TAG_PROTO_CTR << OFI_TAG_SOURCE_BITS), &rx_req_);
-    ai_idx_ = !ai_idx_;
+  // a buffer of the ring a connection request lands in
+  struct AcceptSlot {
+    struct ofi_req req;
+    // FI_ADDR_UNSPEC until the address of the request has been inserted into the AV
+    fi_addr_t peer_addr;
+  };
+
+  OFIEndpoint::ptr ep_;
+  bool private_eps_;
+  bool multi_recv_;
+  std::vector<struct ofi_addrinfo> peer_ais_;
+  std::vector<AcceptSlot> slots_;
+  LocalMemoryRegion::ptr ai_lmr_;
+  // the slot Accept() takes next. requests fill the slots in the order they are posted
+  size_t head_;
+
+  void PostAccept(size_t idx) {
+    auto &slot = slots_[idx];
+    std::memset(&slot.req, 0, sizeof(slot.req));
+    slot.peer_addr = FI_ADDR_UNSPEC;
+    ep_->PostRecv(&peer_ais_[idx], sizeof(struct ofi_addrinfo), ai_lmr_->GetLKey(),
+                  (TAG_PROTO_CTR << OFI_TAG_SOURCE_BITS), &slot.req);
+  }
+
+  static bool IsArrived(const AcceptSlot &slot) { return slot.req.comp == slot.req.req; }
+
+  // inserts the addresses of all the requests that have arrived into the AV with a single fi_av_insert,
+  // so that a burst of connections is resolved at once rather than an Accept() at a time.
+  void ResolveArrived() {
+    if (private_eps_) {
+      // each channel inserts its peer into an endpoint of its own
+      return;
+    }
+    ep_->Progress();
+
+    std::vector<char> addrs;
+    std::vector<size_t> idxs;
+    for (size_t n = 0; n < slots_.size(); n++) {
+      auto idx = (head_ + n) % slots_.size();
+      if (!IsArrived(slots_[idx])) {
+        break;
+      }
+      if (slots_[idx].peer_addr == FI_ADDR_UNSPEC) {
+        const auto &ai = peer_ais_[idx];
+        addrs.insert(addrs.end(), ai.addr, ai.addr + ai.addrlen);
+        idxs.push_back(idx);
+      }
+    }
+    if (idxs.empty()) {
+      return;
+    }
+
+    // the addresses of a provider are all as long as each other
+    std::vector<fi_addr_t> fi_addrs(idxs.size(), FI_ADDR_UNSPEC);
+    ep_->InsertAddrs(addrs.data(), idxs.size(), fi_addrs.data());
+    for (size_t i = 0; i < idxs.size(); i++) {
+      slots_[idxs[i]].peer_addr = fi_addrs[i];
+    }
   }
 };
 
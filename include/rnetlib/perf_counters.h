@@ -0,0 +1,145 @@
+#ifndef RNETLIB_PERF_COUNTERS_H_
+#define RNETLIB_PERF_COUNTERS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace rnetlib {
+
+enum PerfCounter {
+  // operations issued and bytes moved
+  PERF_SEND_OPS = 0,
+  PERF_SEND_BYTES,
+  PERF_RECV_OPS,
+  PERF_RECV_BYTES,
+  PERF_WRITE_OPS,
+  PERF_WRITE_BYTES,
+  PERF_READ_OPS,
+  PERF_READ_BYTES,
+  PERF_ATOMIC_OPS,
+  // protocol choices
+  PERF_EAGER_OPS,
+  PERF_RENDEZVOUS_OPS,
+  PERF_MR_REGS,
+  PERF_CTX_ALLOCS,
+  // stalls
+  PERF_WOULD_BLOCK,
+  PERF_POST_RETRIES,
+  PERF_CQ_POLLS,
+  PERF_CQ_EMPTY_POLLS,
+  PERF_CQ_ERRORS,
+  PERF_CQ_SLEEPS,
+  PERF_CQ_TIMEOUTS,
+  // event loops
+  PERF_LOOP_WAITS,
+  PERF_LOOP_WAKEUPS,
+  PERF_LOOP_TIMEOUTS,
+  PERF_LOOP_EVENTS,
+  PERF_NUM_COUNTERS
+};
+
+// A point-in-time copy of a set of counters.
+struct PerfSnapshot {
+  PerfSnapshot() { std::memset(counts, 0, sizeof(counts)); }
+
+  uint64_t operator[](PerfCounter counter) const { return counts[counter]; }
+
+  PerfSnapshot &operator+=(const PerfSnapshot &other) {
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+      counts[i] += other.counts[i];
+    }
+    return *this;
+  }
+
+  // the difference between two snapshots of the same counters.
+  PerfSnapshot operator-(const PerfSnapshot &other) const {
+    PerfSnapshot diff;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+      diff.counts[i] = counts[i] - other.counts[i];
+    }
+    return diff;
+  }
+
+  static const char *GetName(PerfCounter counter) {
+    static const char *names[PERF_NUM_COUNTERS] = {
+        "send_ops", "send_bytes", "recv_ops", "recv_bytes",
+        "write_ops", "write_bytes", "read_ops", "read_bytes", "atomic_ops",
+        "eager_ops", "rendezvous_ops", "mr_regs", "ctx_allocs",
+        "would_block", "post_retries", "cq_polls", "cq_empty_polls", "cq_errors",
+        "cq_sleeps", "cq_timeouts",
+        "loop_waits", "loop_wakeups", "loop_timeouts", "loop_events"
+    };
+    return names[counter];
+  }
+
+  uint64_t counts[PERF_NUM_COUNTERS];
+};
+
+#ifdef RNETLIB_ENABLE_PERF_COUNTERS
+
+// Counters updated on hot paths and read from any thread.
+// Every thread updates its own slot with relaxed atomics (threads share a slot only when there are
+// more threads than slots), so updating them costs an uncontended add. Snapshot() sums up all the slots.
+class PerfCounters {
+ public:
+  PerfCounters() {
+    for (auto &slot : slots_) {
+      for (auto &count : slot.counts) {
+        count.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  void Add(PerfCounter counter, uint64_t val = 1) {
+    slots_[GetSlotIndex()].counts[counter].fetch_add(val, std::memory_order_relaxed);
+  }
+
+  PerfSnapshot Snapshot() const {
+    PerfSnapshot snapshot;
+    for (const auto &slot : slots_) {
+      for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        snapshot.counts[i] += slot.counts[i].load(std::memory_order_relaxed);
+      }
+    }
+    return snapshot;
+  }
+
+ private:
+  static const size_t kNumSlots = 8;
+  static const size_t kCacheLineSize = 64;
+
+  // the trailing padding keeps any two slots off the same cache line,
+  // even though operator new does not honor over-aligned types in C++11.
+  struct Slot {
+    std::atomic<uint64_t> counts[PERF_NUM_COUNTERS];
+    char padding[kCacheLineSize];
+  };
+
+  Slot slots_[kNumSlots];
+
+  static size_t GetSlotIndex() {
+    static std::atomic<size_t> next_index(0);
+    static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % kNumSlots;
+    return index;
+  }
+};
+
+#else
+
+// compiled out: every update is an empty inline function.
+class PerfCounters {
+ public:
+  void Add(PerfCounter counter, uint64_t val = 1) {}
+
+  PerfSnapshot Snapshot() const { return PerfSnapshot(); }
+};
+
+#endif // RNETLIB_ENABLE_PERF_COUNTERS
+
+} // namespace rnetlib
+
+#endif // RNETLIB_PERF_COUNTERS_H_
@@ -0,0 +1,37 @@
+#ifndef RNETLIB_PROBES_H_
+#define RNETLIB_PROBES_H_
+
+// SystemTap-compatible USDT probes (provider "rnetlib").
+// A probe is a single nop until a tracer (bpftrace, perf, stap) attaches to it, so they are built in
+// whenever <sys/sdt.h> is available (systemtap-sdt-dev/systemtap-sdt-devel); RNETLIB_DISABLE_PROBES turns them off.
+//
+//   send_entry(channel), send_return(channel, len)    one Send/SendV
+//   recv_entry(channel), recv_return(channel, len)    one Recv/RecvV
+//   write_entry(channel), write_return(channel, len)  one Write/WriteV
+//   read_entry(channel), read_return(channel, len)    one Read/ReadV
+//   protocol(channel, len, eager)                     eager (1) or rendezvous (0) transfer
+//   mr_reg_entry(addr, len), mr_reg_return(addr, len) memory registration
+//   cq_poll(cq, num_polled, num_empty_polls)          one round of CQ polling
+//   loop_wakeup(evloop, num_ready)                    an event loop woke up
+//   connect(channel, peer_desc), accept(channel, peer_desc)  connection established
+// *_return probes are skipped when an operation fails before it is posted.
+// See tools/bpftrace/ for sample scripts.
+
+#if !defined(RNETLIB_DISABLE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RNETLIB_HAVE_PROBES
+#endif // __has_include(<sys/sdt.h>)
+#endif // !defined(RNETLIB_DISABLE_PROBES) && defined(__has_include)
+
+#ifdef RNETLIB_HAVE_PROBES
+#define RNETLIB_PROBE1(name, a)       DTRACE_PROBE1(rnetlib, name, a)
+#define RNETLIB_PROBE2(name, a, b)    DTRACE_PROBE2(rnetlib, name, a, b)
+#define RNETLIB_PROBE3(name, a, b, c) DTRACE_PROBE3(rnetlib, name, a, b, c)
+#else
+#define RNETLIB_PROBE1(name, a)
+#define RNETLIB_PROBE2(name, a, b)
+#define RNETLIB_PROBE3(name, a, b, c)
+#endif // RNETLIB_HAVE_PROBES
+
+#endif // RNETLIB_PROBES_H_
@@ -0,0 +1,115 @@
+#ifndef RNETLIB_RMA_WINDOW_H_
+#define RNETLIB_RMA_WINDOW_H_
+
+#include <cassert>
+#include <vector>
+
+#include "rnetlib/channel.h"
+#include "rnetlib/local_memory_region.h"
+#include "rnetlib/remote_memory_region.h"
+
+namespace rnetlib {
+
+// A remote region which is registered and exchanged once, and then accessed in sub-ranges at byte offsets
+// into it, instead of as a whole region per transfer.
+// Puts and gets are the blocking WriteV()/ReadV() of the channel, so the sub-ranges of a vectored or strided
+// access are all in flight at once. every sub-range has to lie within the window, or the access fails with 0.
+class RmaWindow {
+ public:
+  RmaWindow(Channel &channel, const RemoteMemoryRegion &rmr) : channel_(channel), rmr_(rmr) {}
+
+  const RemoteMemoryRegion &GetRemoteMemoryRegion() const { return rmr_; }
+
+  size_t GetLength() const { return rmr_.length; }
+
+  // the sub-range of (len) bytes at (offset).
+  RemoteMemoryRegion Slice(size_t offset, size_t len) const {
+    assert(InRange(offset, len));
+    RemoteMemoryRegion sliced = rmr_;
+    sliced.addr += offset;
+    sliced.length = len;
+    return sliced;
+  }
+
+  size_t Put(void *buf, size_t len, size_t offset) {
+    return InRange(offset, len) ? channel_.Write(buf, len, Slice(offset, len)) : 0;
+  }
+
+  size_t Get(void *buf, size_t len, size_t offset) {
+    return InRange(offset, len) ? channel_.Read(buf, len, Slice(offset, len)) : 0;
+  }
+
+  size_t Put(const LocalMemoryRegion::ptr &lmr, size_t offset) { return PutV(&lmr, &offset, 1); }
+
+  size_t Get(const LocalMemoryRegion::ptr &lmr, size_t offset) { return GetV(&lmr, &offset, 1); }
+
+  // puts (lmr[i]) at (offsets[i]) for every i < (cnt).
+  size_t PutV(const LocalMemoryRegion::ptr *lmr, const size_t *offsets, size_t cnt) {
+    return TransferV(true, lmr, offsets, cnt);
+  }
+
+  // gets (lmr[i]) from (offsets[i]) for every i < (cnt).
+  size_t GetV(const LocalMemoryRegion::ptr *lmr, const size_t *offsets, size_t cnt) {
+    return TransferV(false, lmr, offsets, cnt);
+  }
+
+  // puts (count) blocks of (block_len) bytes, which lie (local_stride) bytes apart in (lmr),
+  // at (remote_stride) bytes apart from (offset) on.
+  size_t PutStrided(const LocalMemoryRegion::ptr &lmr, size_t offset, size_t block_len, size_t count,
+                    size_t local_stride, size_t remote_stride) {
+    return TransferStrided(true, lmr, offset, block_len, count, local_stride, remote_stride);
+  }
+
+  // gets (count) blocks of (block_len) bytes, which lie (remote_stride) bytes apart from (offset) on,
+  // into (local_stride) bytes apart in (lmr).
+  size_t GetStrided(const LocalMemoryRegion::ptr &lmr, size_t offset, size_t block_len, size_t count,
+                    size_t local_stride, size_t remote_stride) {
+    return TransferStrided(false, lmr, offset, block_len, count, local_stride, remote_stride);
+  }
+
+ private:
+  Channel &channel_;
+  RemoteMemoryRegion rmr_;
+
+  bool InRange(size_t offset, size_t len) const { return offset <= rmr_.length && len <= rmr_.length - offset; }
+
+  size_t TransferV(bool put, const LocalMemoryRegion::ptr *lmr, const size_t *offsets, size_t cnt) {
+    std::vector<RemoteMemoryRegion> rmrs;
+    rmrs.reserve(cnt);
+
+    for (size_t i = 0; i < cnt; i++) {
+      auto len = lmr[i]->GetLength();
+      if (!InRange(offsets[i], len)) {
+        // error
+        return 0;
+      }
+      rmrs.push_back(Slice(offsets[i], len));
+    }
+
+    return put ? channel_.WriteV(lmr, rmrs.data(), cnt) : channel_.ReadV(lmr, rmrs.data(), cnt);
+  }
+
+  size_t TransferStrided(bool put, const LocalMemoryRegion::ptr &lmr, size_t offset, size_t block_len, size_t count,
+                         size_t local_stride, size_t remote_stride) {
+    std::vector<LocalMemoryRegion::ptr> blocks;
+    std::vector<size_t> offsets;
+    blocks.reserve(count);
+    offsets.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+      auto local_offset = i * local_stride;
+      if (local_offset > lmr->GetLength() || block_len > lmr->GetLength() - local_offset) {
+        // error
+        return 0;
+      }
+      blocks.emplace_back(new LocalMemoryRegionSlice(*lmr, local_offset, block_len));
+      offsets.push_back(offset + i * remote_stride);
+    }
+
+    return TransferV(put, blocks.data(), offsets.data(), count);
+  }
+};
+
+} // namespace rnetlib
+
+#endif // RNETLIB_RMA_WINDOW_H_
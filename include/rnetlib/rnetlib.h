@@ -3,13 +3,17 @@
 
 #include "rnetlib/client.h"
 #include "rnetlib/event_loop.h"
+#include "rnetlib/rma_window.h"
 #include "rnetlib/server.h"
+#include "rnetlib/thread_safe_channel.h"
 #include "rnetlib/socket/socket_client.h"
 #include "rnetlib/socket/socket_event_loop.h"
+#include "rnetlib/socket/socket_progress_loop.h"
 #include "rnetlib/socket/socket_server.h"
 
 #ifdef RNETLIB_ENABLE_OFI
 #include "rnetlib/ofi/ofi_client.h"
+#include "rnetlib/ofi/ofi_event_loop.h"
 #include "rnetlib/ofi/ofi_server.h"
 #endif // RNETLIB_ENABLE_OFI
 
@@ -27,48 +31,96 @@ enum Prov {
   PROV_SOCKET
 };
 
-static Client::ptr NewClient(Prov prov, uint64_t self_desc = 0) {
+// options of NewClient()/NewServer(), which are ignored by providers that do not support them.
+enum Opt {
+  // channels share a receive queue and a completion queue (verbs)
+  OPT_SHARED_QUEUES = 1,
+  // small messages are RDMA-written into a ring of the peer, which polls it (verbs)
+  OPT_EAGER_RING = 2,
+  // a client has an endpoint of its own, and a server gives every accepted channel one,
+  // so that threads driving different clients or channels do not share an endpoint (ofi)
+  OPT_PRIVATE_ENDPOINTS = 4,
+  // small messages land in multi-receive buffers of the endpoint, without a receive posted for each (ofi).
+  // NOTE: either side tells a small message by its length, so messages have to be received with the lengths
+  // they have been sent with.
+  OPT_MULTI_RECV = 8,
+  // an event loop runs a thread which keeps the transfers of its channels moving
+  // while the application is not waiting for them (ofi, socket)
+  OPT_PROGRESS_THREAD = 16
+};
+
+static Client::ptr NewClient(Prov prov, uint64_t self_desc = 0, int opts = 0) {
 #ifdef RNETLIB_ENABLE_OFI
   if (prov == PROV_OFI) {
-    return Client::ptr(new ofi::OFIClient(self_desc));
+    return Client::ptr(new ofi::OFIClient(self_desc, (opts & OPT_PRIVATE_ENDPOINTS) != 0,
+                                          (opts & OPT_MULTI_RECV) != 0));
   }
 #endif // RNETLIB_ENABLE_OFI
 
 #ifdef RNETLIB_ENABLE_VERBS
   if (prov == PROV_VERBS) {
-    return Client::ptr(new verbs::VerbsClient(self_desc));
+    return Client::ptr(new verbs::VerbsClient(self_desc, (opts & OPT_SHARED_QUEUES) != 0,
+                                                 (opts & OPT_EAGER_RING) != 0));
   }
 #endif // RNETLIB_ENABLE_VERBS
 
   return Client::ptr(new socket::SocketClient(self_desc));
 }
 
-static Server::ptr NewServer(const std::string &addr, uint16_t port, Prov prov) {
+static Server::ptr NewServer(const std::string &addr, uint16_t port, Prov prov, int opts = 0) {
 #ifdef RNETLIB_ENABLE_OFI
   if (prov == PROV_OFI) {
-    return Server::ptr(new ofi::OFIServer(addr, port));
+    return Server::ptr(new ofi::OFIServer(addr, port, (opts & OPT_PRIVATE_ENDPOINTS) != 0,
+                                          (opts & OPT_MULTI_RECV) != 0));
   }
 #endif // RNETLIB_ENABLE_OFI
 
 #ifdef RNETLIB_ENABLE_VERBS
   if (prov == PROV_VERBS) {
-    return Server::ptr(new verbs::VerbsServer(addr, port));
+    return Server::ptr(new verbs::VerbsServer(addr, port, (opts & OPT_SHARED_QUEUES) != 0,
+                                                 (opts & OPT_EAGER_RING) != 0));
   }
 #endif // RNETLIB_ENABLE_VERBS
 
   return Server::ptr(new socket::SocketServer(addr, port));
 }
 
-static EventLoop::ptr NewEventLoop(Prov prov) {
+// lets any number of threads use (ch) at once, which has to be done before more than one of them uses it.
+static Channel::ptr MakeThreadSafe(Channel::ptr ch) {
+  return Channel::ptr(new ThreadSafeChannel(std::move(ch)));
+}
+
+// the progress thread of OPT_PROGRESS_THREAD is pinned to (progress_cpu) unless it is negative (socket).
+static EventLoop::ptr NewEventLoop(Prov prov, int opts = 0, int progress_cpu = -1) {
+#ifdef RNETLIB_ENABLE_OFI
+  if (prov == PROV_OFI) {
+    return std::unique_ptr<EventLoop>(new ofi::OFIEventLoop((opts & OPT_PROGRESS_THREAD) != 0));
+  }
+#endif // RNETLIB_ENABLE_OFI
+
 #ifdef RNETLIB_ENABLE_VERBS
   if (prov == PROV_VERBS) {
     return std::unique_ptr<EventLoop>(new verbs::VerbsEventLoop);
   }
 #endif // RNETLIB_ENABLE_VERBS
 
+  if (opts & OPT_PROGRESS_THREAD) {
+    return std::unique_ptr<EventLoop>(new socket::SocketProgressLoop(progress_cpu));
+  }
   return std::unique_ptr<EventLoop>(new socket::SocketEventLoop);
 }
 
+// counters kept by a provider rather than by its channels (e.g., the endpoint shared by OFI channels).
+static PerfSnapshot GetProviderPerfCounters(Prov prov) {
+#ifdef RNETLIB_ENABLE_OFI
+  if (prov == PROV_OFI) {
+    return ofi::OFIEndpoint::GetPerfCounters();
+  }
+#endif // RNETLIB_ENABLE_OFI
+
+  return PerfSnapshot();
+}
+
 } // namespace rnetlib
 
 #endif // RNETLIB_RNETLIB_H_
@@ -6,15 +6,21 @@
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 
+#include <cerrno>
 #include <climits>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "rnetlib/channel.h"
 #include "rnetlib/event_handler.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
 #include "rnetlib/socket/socket_common.h"
 #include "rnetlib/socket/socket_event_loop.h"
 #include "rnetlib/socket/socket_local_memory_region.h"
+#include "rnetlib/socket/socket_progress_loop.h"
 
 #ifndef IOV_MAX
 #define IOV_MAX 1024
@@ -50,18 +56,70 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
   }
 
   size_t SendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
-    auto ret = ISendV(lmr, lmrcnt, evloop_);
-    evloop_->WaitAll(-1);
+    RNETLIB_PROBE1(send_entry, this);
+    size_t ret;
+    if (send_iov_.empty()) {
+      // nothing to go before it, so it is sent without the state the receives share
+      std::vector<struct iovec> iov;
+      ret = AppendIOV(lmr, lmrcnt, iov);
+      perf_.Add(PERF_SEND_OPS);
+      if (!TransferNow(iov, true)) {
+        ret = 0;
+      }
+    } else {
+      ret = ISendV(lmr, lmrcnt, evloop_);
+      evloop_->WaitAll(-1);
+    }
+    RNETLIB_PROBE2(send_return, this, ret);
     return ret;
   }
 
   size_t RecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
-    auto ret = IRecvV(lmr, lmrcnt, evloop_);
-    evloop_->WaitAll(-1);
+    RNETLIB_PROBE1(recv_entry, this);
+    size_t ret;
+    if (recv_iov_.empty()) {
+      std::vector<struct iovec> iov;
+      ret = AppendIOV(lmr, lmrcnt, iov);
+      perf_.Add(PERF_RECV_OPS);
+      if (!TransferNow(iov, false)) {
+        ret = 0;
+      }
+    } else {
+      ret = IRecvV(lmr, lmrcnt, evloop_);
+      evloop_->WaitAll(-1);
+    }
+    RNETLIB_PROBE2(recv_return, this, ret);
     return ret;
   }
 
+  // the messages of a stream need no boundaries, so they are all written together.
+  size_t SendMsgV(const LocalMemoryRegion::ptr *const *lmr, const size_t *lmrcnts, size_t msgcnt) override {
+    RNETLIB_PROBE1(send_entry, this);
+    size_t ret = 0;
+    if (send_iov_.empty()) {
+      std::vector<struct iovec> iov;
+      for (size_t i = 0; i < msgcnt; i++) {
+        ret += AppendIOV(lmr[i], lmrcnts[i], iov);
+        perf_.Add(PERF_SEND_OPS);
+      }
+      if (!TransferNow(iov, true)) {
+        msgcnt = 0;
+      }
+    } else {
+      for (size_t i = 0; i < msgcnt; i++) {
+        ret += ISendV(lmr[i], lmrcnts[i], evloop_);
+      }
+      evloop_->WaitAll(-1);
+    }
+    RNETLIB_PROBE2(send_return, this, ret);
+    return msgcnt;
+  }
+
   size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
+    if (auto ploop = dynamic_cast<SocketProgressLoop *>(evloop.get())) {
+      return ISendV(lmr, lmrcnt, *ploop);
+    }
+    perf_.Add(PERF_SEND_OPS);
     size_t total_len = 0;
     for (size_t i = 0; i < lmrcnt; i++) {
       auto len = lmr[i]->GetLength();
@@ -71,6 +129,7 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
       }
     }
 
+    RNETLIB_TRACE_INSTANT("socket_isend", total_len);
     if (!send_iov_.empty()) {
       evloop->AddHandler(*this);
     }
@@ -79,6 +138,10 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
   }
 
   size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
+    if (auto ploop = dynamic_cast<SocketProgressLoop *>(evloop.get())) {
+      return IRecvV(lmr, lmrcnt, *ploop);
+    }
+    perf_.Add(PERF_RECV_OPS);
     size_t total_len = 0;
     for (size_t i = 0; i < lmrcnt; i++) {
       auto len = lmr[i]->GetLength();
@@ -88,6 +151,7 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
       }
     }
 
+    RNETLIB_TRACE_INSTANT("socket_irecv", total_len);
     if (!recv_iov_.empty()) {
       evloop->AddHandler(*this);
     }
@@ -95,6 +159,19 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
     return total_len;
   }
 
+  // hands the transfer over to the thread of (ploop), which reports its completion through (status).
+  size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, SocketProgressLoop &ploop,
+                SocketOpStatus *status = nullptr) {
+    perf_.Add(PERF_SEND_OPS);
+    return ploop.Submit(*this, true, lmr, lmrcnt, status);
+  }
+
+  size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, SocketProgressLoop &ploop,
+                SocketOpStatus *status = nullptr) {
+    perf_.Add(PERF_RECV_OPS);
+    return ploop.Submit(*this, false, lmr, lmrcnt, status);
+  }
+
   size_t Write(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
     return Write(RegisterMemoryRegion(buf, len, MR_LOCAL_READ), rmr);
   }
@@ -121,6 +198,20 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
     return 0;
   }
 
+  // a notification is a bare 4-byte message of (value) in the byte stream, in the order of messages.
+  bool WriteNotify(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr, uint32_t value) override {
+    if (lmr->GetLength() > 0) {
+      // not supported: there is no WriteV() on a stream to write the data with.
+      return false;
+    }
+    return Send(&value, sizeof(value)) == sizeof(value);
+  }
+
+  bool WaitNotify(uint32_t &value) override { return Recv(&value, sizeof(value)) == sizeof(value); }
+
+  // not supported: nothing on the peer of a stream would apply the operations between its messages.
+  size_t AtomicV(AtomicOp *ops, size_t cnt) override { return 0; }
+
   LocalMemoryRegion::ptr RegisterMemoryRegion(void *addr, size_t len, int type) const override {
     return LocalMemoryRegion::ptr(new SocketLocalMemoryRegion(addr, len));
   }
@@ -140,24 +231,66 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
     Recv(rmr, sizeof(RemoteMemoryRegion) * rmrcnt);
   }
 
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
+  // blocking sends and receives without asynchronous operations in flight go straight to the socket, each with
+  // state of its own.
+  bool IsFullDuplex() const override { return true; }
+
   int OnEvent(int event_type, void *arg) override {
+    if (event_type == SocketProgressLoop::kSubmitEvent) {
+      // on the progress thread: the transfer goes after those queued before it
+      std::unique_ptr<SocketAsyncOp> op(static_cast<SocketAsyncOp *>(arg));
+      auto &iov = op->send ? send_iov_ : recv_iov_;
+      iov.insert(iov.end(), op->iov.begin(), op->iov.end());
+      (op->send ? send_ops_ : recv_ops_).push_back(std::move(op));
+      return 0;
+    }
+
+    RNETLIB_TRACE_SCOPE("socket_on_event", event_type);
+    std::vector<std::unique_ptr<SocketAsyncOp>> done_ops;
     if (event_type & POLLOUT) {
       auto offset = SendIOV(send_iov_.data(), send_iov_.size());
       if (offset > 0) {
         send_iov_.erase(send_iov_.begin(), send_iov_.begin() + offset);
+        RetireOps(send_ops_, offset, done_ops);
       }
     }
     if (event_type & POLLIN) {
       auto offset = RecvIOV(recv_iov_.data(), recv_iov_.size());
       if (offset > 0) {
         recv_iov_.erase(recv_iov_.begin(), recv_iov_.begin() + offset);
+        RetireOps(recv_ops_, offset, done_ops);
       }
     }
+    auto ret = (send_iov_.empty() && recv_iov_.empty()) ? MAY_BE_REMOVED : 0;
 
-    return (send_iov_.empty() && recv_iov_.empty()) ? MAY_BE_REMOVED : 0;
+    // the submitter may use this channel again as soon as it sees its ops done, so they are reported last.
+    for (const auto &op : done_ops) {
+      op->status->Finish(true);
+    }
+    return ret;
   }
 
-  int OnError(int error_type) override { return MAY_BE_REMOVED; }
+  int OnError(int error_type) override {
+    if (send_ops_.empty() && recv_ops_.empty()) {
+      return MAY_BE_REMOVED;
+    }
+    // the transfers queued on the progress thread will never complete
+    std::vector<std::unique_ptr<SocketAsyncOp>> failed_ops;
+    for (auto ops : {&send_ops_, &recv_ops_}) {
+      for (auto &op : *ops) {
+        failed_ops.push_back(std::move(op));
+      }
+      ops->clear();
+    }
+    send_iov_.clear();
+    recv_iov_.clear();
+    for (const auto &op : failed_ops) {
+      op->status->Finish(false);
+    }
+    return MAY_BE_REMOVED;
+  }
 
   void *GetHandlerID() const override { return const_cast<int *>(&sock_fd_); }
 
@@ -180,7 +313,77 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
   uint64_t peer_desc_;
   std::vector<struct iovec> send_iov_;
   std::vector<struct iovec> recv_iov_;
+  // the transfers submitted to a SocketProgressLoop, whose entries are queued in (send_iov_) and (recv_iov_)
+  std::deque<std::unique_ptr<SocketAsyncOp>> send_ops_;
+  std::deque<std::unique_ptr<SocketAsyncOp>> recv_ops_;
   EventLoop::ptr evloop_;
+  mutable PerfCounters perf_;
+
+  // appends the non-empty entries of (lmr) to (iov), and returns their total length.
+  static size_t AppendIOV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, std::vector<struct iovec> &iov) {
+    size_t total_len = 0;
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      total_len += len;
+      if (len > 0) {
+        iov.push_back({lmr[i]->GetAddr(), len});
+      }
+    }
+    return total_len;
+  }
+
+  // transfers (iov) blocking on the socket itself rather than on an event loop, so that nothing but (iov) is touched.
+  // returns false on error, or once the connection has been closed.
+  bool TransferNow(std::vector<struct iovec> &iov, bool send) {
+    RNETLIB_TRACE_SCOPE(send ? "socket_send_now" : "socket_recv_now", iov.size());
+    size_t offset = 0;
+    bool hung_up = false;
+    while (offset < iov.size()) {
+      auto num_left = hung_up ? GetNumBytesLeft(iov, offset) : 0;
+      offset += send ? SendIOV(iov.data() + offset, iov.size() - offset)
+                     : RecvIOV(iov.data() + offset, iov.size() - offset);
+      if (offset == iov.size()) {
+        break;
+      }
+      if (hung_up && GetNumBytesLeft(iov, offset) == num_left) {
+        // nothing more will come, or go
+        return false;
+      }
+      struct pollfd pfd = {sock_fd_, static_cast<short>(send ? POLLOUT : POLLIN), 0};
+      if (S_POLL(&pfd, 1, -1) < 0 && errno != EINTR) {
+        return false;
+      }
+      if (pfd.revents & (POLLERR | POLLNVAL)) {
+        return false;
+      }
+      // the data received before the hangup can still be read
+      hung_up = (pfd.revents & POLLHUP) != 0;
+    }
+    return true;
+  }
+
+  static size_t GetNumBytesLeft(const std::vector<struct iovec> &iov, size_t offset) {
+    size_t len = 0;
+    for (size_t i = offset; i < iov.size(); i++) {
+      len += iov[i].iov_len;
+    }
+    return len;
+  }
+
+  // takes the ops whose entries are among the (offset) ones transferred from (ops) into (done_ops).
+  static void RetireOps(std::deque<std::unique_ptr<SocketAsyncOp>> &ops, size_t offset,
+                        std::vector<std::unique_ptr<SocketAsyncOp>> &done_ops) {
+    while (offset > 0 && !ops.empty()) {
+      auto &op = ops.front();
+      if (op->num_iov_left > offset) {
+        op->num_iov_left -= offset;
+        break;
+      }
+      offset -= op->num_iov_left;
+      done_ops.push_back(std::move(op));
+      ops.pop_front();
+    }
+  }
 
   size_t SendIOV(struct iovec *iov, size_t iovcnt) const {
     size_t offset = 0;
@@ -188,6 +391,7 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
     while (offset < iovcnt) {
       auto sent = S_WRITEV(sock_fd_, iov + offset, (iovcnt - offset) > IOV_MAX ? IOV_MAX : (iovcnt - offset));
       if (sent > 0) {
+        perf_.Add(PERF_SEND_BYTES, static_cast<uint64_t>(sent));
         while (offset < iovcnt) {
           if (iov[offset].iov_len > sent) {
             iov[offset].iov_base = static_cast<char *>(iov[offset].iov_base) + sent;
@@ -200,6 +404,8 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
       } else {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
           // SNDBUF is full.
+          perf_.Add(PERF_WOULD_BLOCK);
+          RNETLIB_TRACE_INSTANT("socket_send_would_block", offset);
           break;
         }
         // TODO: handle error
@@ -216,6 +422,7 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
     while (offset < iovcnt) {
       auto recvd = S_READV(sock_fd_, iov + offset, (iovcnt - offset) > IOV_MAX ? IOV_MAX : (iovcnt - offset));
       if (recvd > 0) {
+        perf_.Add(PERF_RECV_BYTES, static_cast<uint64_t>(recvd));
         while (offset < iovcnt) {
           if (iov[offset].iov_len > recvd) {
             iov[offset].iov_base = static_cast<char *>(iov[offset].iov_base) + recvd;
@@ -228,6 +435,8 @@ class SocketChannel : public Channel, public EventHandler, public SocketCommon {
       } else {
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
           // RCVBUF is empty.
+          perf_.Add(PERF_WOULD_BLOCK);
+          RNETLIB_TRACE_INSTANT("socket_recv_would_block", offset);
           break;
         }
         // TODO: handle error
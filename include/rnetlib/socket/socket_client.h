@@ -56,6 +56,7 @@ class SocketClient : public Client, public SocketCommon, public EventHandler {
 
     Channel::ptr ch(new SocketChannel(sock_fd_, peer_desc));
     ch->Send(&self_desc_, sizeof(self_desc_));
+    RNETLIB_PROBE2(connect, ch.get(), peer_desc);
 
     // successfully connected.
     return std::move(ch);
@@ -115,6 +116,7 @@ class SocketClient : public Client, public SocketCommon, public EventHandler {
 
   void OnEstablished() {
     std::unique_ptr<Channel> channel(new SocketChannel(sock_fd_));
+    RNETLIB_PROBE2(connect, channel.get(), 0);
     if (on_established_) {
       on_established_(*channel);
     }
@@ -94,6 +94,10 @@ class SocketCommon {
 #endif // RNETLIB_ENABLE_VERBS
 
     struct S_ADDRINFO *tmp;
+    // an empty address means "any" (getaddrinfo rejects an empty node name)
+    if (addr && *addr == '\0') {
+      addr = nullptr;
+    }
     int error = S_GETADDRINFO(const_cast<char *>(addr), const_cast<char *>(std::to_string(port).c_str()), &hints, &tmp);
     if (error) {
       if (error == EAI_SYSTEM) {
@@ -9,6 +9,8 @@
 #include <vector>
 
 #include "rnetlib/event_loop.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
 
 #ifdef RNETLIB_ENABLE_VERBS
 // rsocket-specific functions
@@ -32,57 +34,105 @@ class SocketEventLoop : public EventLoop {
   }
 
   int WaitAll(int timeout_millis) override {
-    std::vector<struct pollfd> fds;
-
     while (!handler_refs_.empty()) {
-      fds.clear();
-
-      for (const auto &handler_ref : handler_refs_) {
-        fds.emplace_back(pollfd{handler_ref.first, handler_ref.second.get().GetEventType(), 0});
+      auto ret = PollOnce(timeout_millis);
+      if (ret) {
+        return ret;
       }
-      nfds_t num_fds = static_cast<nfds_t>(fds.size());
-
-      auto rc = S_POLL(fds.data(), num_fds, timeout_millis);
-      if (rc < 0) {
-        // miscellaneous errors
-        // TODO: log error
-        return kErrFailed;
-      } else if (rc == 0) {
-        // timed out
-        // TODO: log error
-        return kErrTimedOut;
+    }
+
+    return 0;
+  }
+
+  // polls the handlers once for up to (timeout_millis), and dispatches their events.
+  // (wakeup_fd) is polled along with them, but its events are left to the caller.
+  int PollOnce(int timeout_millis, int wakeup_fd = -1) {
+    fds_.clear();
+    for (auto itr = handler_refs_.begin(); itr != handler_refs_.end();) {
+      auto event_type = itr->second.get().GetEventType();
+      if (event_type == 0) {
+        // channels whose operations have completed in the meantime (e.g., by a blocking one) have nothing left to
+        // wait for.
+        itr = handler_refs_.erase(itr);
+        continue;
       }
+      fds_.emplace_back(pollfd{itr->first, event_type, 0});
+      ++itr;
+    }
+    if (fds_.empty() && wakeup_fd < 0) {
+      return 0;
+    }
+    perf_.Add(PERF_LOOP_WAITS);
 
-      for (int i = 0; i < num_fds; i++) {
-        auto &pfd = fds[i];
-        auto sock_fd = pfd.fd;
-        auto &revents = pfd.revents;
-        auto &handler = handler_refs_.at(sock_fd).get();
-
-        if (revents == 0) {
-          // this file descriptor is not ready yet
-          continue;
-        } else if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
-          // connection has been closed
-          if (handler.OnError(revents) == MAY_BE_REMOVED) {
-            handler_refs_.erase(sock_fd);
-          }
-        } else {
-          // got an event
-          if (handler.OnEvent(revents, nullptr) == MAY_BE_REMOVED) {
-            handler_refs_.erase(sock_fd);
-          }
-        }
+    nfds_t num_fds = static_cast<nfds_t>(fds_.size());
+    if (wakeup_fd >= 0) {
+      fds_.emplace_back(pollfd{wakeup_fd, POLLIN, 0});
+    }
 
-        revents = 0;
+    int rc;
+    {
+      RNETLIB_TRACE_SCOPE("socket_loop_poll", num_fds);
+      rc = S_POLL(fds_.data(), static_cast<nfds_t>(fds_.size()), timeout_millis);
+    }
+    if (rc < 0) {
+      // miscellaneous errors
+      // TODO: log error
+      return kErrFailed;
+    } else if (rc == 0) {
+      // timed out
+      // TODO: log error
+      perf_.Add(PERF_LOOP_TIMEOUTS);
+      return kErrTimedOut;
+    }
+    perf_.Add(PERF_LOOP_WAKEUPS);
+    RNETLIB_TRACE_INSTANT("socket_loop_wakeup", rc);
+    RNETLIB_PROBE2(loop_wakeup, this, rc);
+    perf_.Add(PERF_LOOP_EVENTS, static_cast<uint64_t>(rc));
+
+    for (int i = 0; i < num_fds; i++) {
+      auto &pfd = fds_[i];
+      auto sock_fd = pfd.fd;
+      auto &revents = pfd.revents;
+      auto &handler = handler_refs_.at(sock_fd).get();
+
+      if (revents == 0) {
+        // this file descriptor is not ready yet
+        continue;
+      } else if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+        // connection has been closed
+        if (handler.OnError(revents) == MAY_BE_REMOVED) {
+          handler_refs_.erase(sock_fd);
+        }
+      } else {
+        // got an event
+        if (handler.OnEvent(revents, nullptr) == MAY_BE_REMOVED) {
+          handler_refs_.erase(sock_fd);
+        }
       }
+
+      revents = 0;
     }
 
     return 0;
   }
 
+  bool HasHandlers() const { return !handler_refs_.empty(); }
+
+  // lets every handler know that its events will never come, through OnError(error_type), and removes them all.
+  void FailAll(int error_type) {
+    auto handler_refs = std::move(handler_refs_);
+    handler_refs_.clear();
+    for (auto &handler_ref : handler_refs) {
+      handler_ref.second.get().OnError(error_type);
+    }
+  }
+
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
  private:
   std::unordered_map<int, std::reference_wrapper<EventHandler>> handler_refs_;
+  std::vector<struct pollfd> fds_;
+  PerfCounters perf_;
 };
 
 } // namespace socket
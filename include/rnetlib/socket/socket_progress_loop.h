@@ -0,0 +1,263 @@
+#ifndef RNETLIB_SOCKET_SOCKET_PROGRESS_LOOP_H_
+#define RNETLIB_SOCKET_SOCKET_PROGRESS_LOOP_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rnetlib/event_loop.h"
+#include "rnetlib/local_memory_region.h"
+#include "rnetlib/mpsc_queue.h"
+#include "rnetlib/tracer.h"
+#include "rnetlib/socket/socket_event_loop.h"
+
+namespace rnetlib {
+namespace socket {
+
+class SocketProgressLoop;
+
+// the status of an asynchronous operation submitted to a SocketProgressLoop,
+// which the submitting thread can test or wait on.
+class SocketOpStatus {
+ public:
+  enum State {
+    OP_PENDING = 0,
+    OP_DONE,
+    OP_FAILED
+  };
+
+  SocketOpStatus() : state_(OP_DONE), loop_(nullptr) {}
+
+  // true once the operation has completed, successfully or not.
+  bool Test() const { return state_ != OP_PENDING; }
+
+  State GetState() const { return static_cast<State>(state_.load()); }
+
+  // waits for up to (timeout_millis) (forever if negative). returns false if it has timed out.
+  inline bool Wait(int timeout_millis = -1) const;
+
+  // called by the progress thread once the operation has completed.
+  inline void Finish(bool ok);
+
+ private:
+  friend class SocketProgressLoop;
+
+  std::atomic<int> state_;
+  SocketProgressLoop *loop_;
+};
+
+// a transfer handed over from a submitting thread to the progress thread, which gives it to its channel.
+struct SocketAsyncOp : public MPSCNode {
+  EventHandler *handler;
+  bool send;
+  std::vector<struct iovec> iov;
+  // the # of the entries of (iov) the channel has not transferred yet
+  size_t num_iov_left;
+  SocketOpStatus *status;
+  // the status of operations submitted without one of their own
+  SocketOpStatus own_status;
+};
+
+// An event loop run by a thread of its own, which keeps the transfers of socket channels moving while the
+// application computes. The thread owns a SocketEventLoop, optionally pinned to (cpu).
+// ISendV()/IRecvV() of a channel with this loop submit the transfer through a lock-free MPSC queue, and wake the
+// thread up through an eventfd if it sleeps. the thread hands the transfer over to the channel with
+// OnEvent(kSubmitEvent, op), so that only the thread touches the channel until its transfers have completed.
+// completions are reported through a SocketOpStatus per operation, and WaitAll() waits for all of them.
+// NOTE: blocking operations on a channel must not be mixed with its transfers in flight on this loop.
+class SocketProgressLoop : public EventLoop {
+ public:
+  // passed to OnEvent() of the channel of a submitted op, with the op as the argument
+  static const int kSubmitEvent = 1 << 16;
+
+  explicit SocketProgressLoop(int cpu = -1)
+      : wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), sleeping_(false), stop_(false), num_pending_(0),
+        num_waiters_(0) {
+    thread_ = std::thread([this] { Run(); });
+    if (cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      // FIXME: report the failure
+      pthread_setaffinity_np(thread_.native_handle(), sizeof(cpus), &cpus);
+    }
+  }
+
+  // the transfers still in flight fail, so that nobody waits for them forever.
+  ~SocketProgressLoop() override {
+    stop_ = true;
+    Wake();
+    thread_.join();
+    // anything the thread has not seen
+    while (!submitted_.Empty()) {
+      std::unique_ptr<SocketAsyncOp> op(submitted_.Pop());
+      if (op) {
+        op->status->Finish(false);
+      }
+    }
+    // the waiters woken up by the failures have to be done with (mtx_) and (cv_)
+    while (num_waiters_ > 0) {
+      std::this_thread::yield();
+    }
+    close(wakeup_fd_);
+  }
+
+  // channels submit their transfers through Submit() instead.
+  void AddHandler(EventHandler &handler) override {}
+
+  // waits for every operation submitted so far.
+  int WaitAll(int timeout_millis) override {
+    return WaitFor([this] { return num_pending_.load() == 0; }, timeout_millis) ? 0 : kErrTimedOut;
+  }
+
+  // submits the transfer of (lmr) on the channel of (handler), whose completion is reported through (status)
+  // (nullptr lets only WaitAll() wait for it). returns the # of bytes submitted.
+  size_t Submit(EventHandler &handler, bool send, const LocalMemoryRegion::ptr *lmr, size_t lmrcnt,
+                SocketOpStatus *status = nullptr) {
+    std::unique_ptr<SocketAsyncOp> op(new SocketAsyncOp);
+    size_t total_len = 0;
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      total_len += len;
+      if (len > 0) {
+        op->iov.push_back({lmr[i]->GetAddr(), len});
+      }
+    }
+    op->handler = &handler;
+    op->send = send;
+    op->num_iov_left = op->iov.size();
+    op->status = status ? status : &op->own_status;
+    op->status->state_.store(SocketOpStatus::OP_PENDING, std::memory_order_relaxed);
+    op->status->loop_ = this;
+    num_pending_++;
+
+    if (op->iov.empty()) {
+      // nothing to transfer
+      op->status->Finish(true);
+      return total_len;
+    }
+    RNETLIB_TRACE_INSTANT(send ? "socket_submit_send" : "socket_submit_recv", total_len);
+    submitted_.Push(op.release());
+    // the thread only has to be woken up if it may have gone to sleep before the push
+    if (sleeping_.exchange(false)) {
+      Wake();
+    }
+
+    return total_len;
+  }
+
+  PerfSnapshot GetPerfCounters() const override { return evloop_.GetPerfCounters(); }
+
+ private:
+  friend class SocketOpStatus;
+
+  SocketEventLoop evloop_;
+  MPSCQueue<SocketAsyncOp> submitted_;
+  int wakeup_fd_;
+  // true while the thread may be sleeping in poll()
+  std::atomic<bool> sleeping_;
+  std::atomic<bool> stop_;
+  std::atomic<uint64_t> num_pending_;
+  // waiters sleep on (cv_) only while (num_waiters_) tells the thread to notify them
+  std::atomic<uint64_t> num_waiters_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::thread thread_;
+
+  void Run() {
+    while (!stop_) {
+      TakeSubmitted();
+
+      sleeping_ = true;
+      // a push after this is followed by a wakeup
+      if (!submitted_.Empty() || stop_) {
+        sleeping_ = false;
+        continue;
+      }
+      evloop_.PollOnce(-1, wakeup_fd_);
+      sleeping_ = false;
+
+      uint64_t val;
+      while (read(wakeup_fd_, &val, sizeof(val)) > 0);
+    }
+
+    // the channels fail the transfers they have been handed, on this thread which owns them until then
+    TakeSubmitted();
+    evloop_.FailAll(POLLHUP);
+  }
+
+  // hands the submitted ops over to their channels, which take care of them from here on.
+  void TakeSubmitted() {
+    while (!submitted_.Empty()) {
+      auto op = submitted_.Pop();
+      if (!op) {
+        // a push is in progress
+        std::this_thread::yield();
+        continue;
+      }
+      auto &handler = *op->handler;
+      handler.OnEvent(kSubmitEvent, op);
+      evloop_.AddHandler(handler);
+    }
+  }
+
+  void Wake() {
+    uint64_t val = 1;
+    auto ret = write(wakeup_fd_, &val, sizeof(val));
+    (void)ret;
+  }
+
+  void OnComplete() {
+    num_pending_--;
+    if (num_waiters_ > 0) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      cv_.notify_all();
+    }
+  }
+
+  template <typename Pred>
+  bool WaitFor(Pred pred, int timeout_millis) {
+    if (pred()) {
+      return true;
+    }
+    std::unique_lock<std::mutex> lock(mtx_);
+    num_waiters_++;
+    bool ok = true;
+    if (timeout_millis < 0) {
+      cv_.wait(lock, pred);
+    } else {
+      ok = cv_.wait_for(lock, std::chrono::milliseconds(timeout_millis), pred);
+    }
+    num_waiters_--;
+    return ok;
+  }
+};
+
+inline bool SocketOpStatus::Wait(int timeout_millis) const {
+  if (Test() || !loop_) {
+    return true;
+  }
+  return loop_->WaitFor([this] { return Test(); }, timeout_millis);
+}
+
+inline void SocketOpStatus::Finish(bool ok) {
+  // the submitter may drop the status as soon as it has seen the state
+  auto loop = loop_;
+  state_ = ok ? OP_DONE : OP_FAILED;
+  loop->OnComplete();
+}
+
+} // namespace socket
+} // namespace rnetlib
+
+#endif // RNETLIB_SOCKET_SOCKET_PROGRESS_LOOP_H_
@@ -73,6 +73,7 @@ class SocketServer : public Server, public SocketCommon, public EventHandler {
     uint64_t peer_desc;
     ch->Recv(&peer_desc, sizeof(peer_desc));
     ch->SetDesc(peer_desc);
+    RNETLIB_PROBE2(accept, ch.get(), peer_desc);
 
     return std::move(ch);
   }
@@ -0,0 +1,431 @@
+#ifndef RNETLIB_THREAD_SAFE_CHANNEL_H_
+#define RNETLIB_THREAD_SAFE_CHANNEL_H_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rnetlib/channel.h"
+#include "rnetlib/event_handler.h"
+#include "rnetlib/mpsc_queue.h"
+#include "rnetlib/socket/socket_progress_loop.h"
+
+namespace rnetlib {
+
+// A channel which any number of threads can use at once, wrapping one of any provider.
+// Sends are queued on a lock-free MPSC queue, and whichever sender gets hold of the channel combines those queued
+// so far into batches of SendMsgV() (flat combining), while the others wait for their sends to be done.
+// Blocking receives hold a lock of their own when the channel is full-duplex (see Channel::IsFullDuplex()), so a
+// thread blocked in Recv() keeps no sender waiting; every other operation holds the whole channel for its duration.
+// Asynchronous operations are completed through this channel as the handler, which holds the whole channel too.
+// NOTE: so until they complete, receives are serialized with sends again, and a thread blocked in Recv() keeps
+// WaitAll() of their event loop waiting. they can't be done on a SocketProgressLoop, whose thread would not.
+class ThreadSafeChannel : public Channel, public EventHandler {
+ public:
+  // on a single core, a spinning sender only keeps the combiner off the CPU
+  explicit ThreadSafeChannel(Channel::ptr ch)
+      : ch_(std::move(ch)), max_spins_((std::thread::hardware_concurrency() > 1) ? kMaxSpins : 0),
+        duplex_(ch_->IsFullDuplex()), capture_(new CaptureLoop()) {}
+
+  uint64_t GetDesc() const override { return ch_->GetDesc(); }
+
+  size_t Send(void *buf, size_t len) override { return Send(RegisterMemoryRegion(buf, len, MR_LOCAL_READ)); }
+
+  size_t Recv(void *buf, size_t len) override {
+    RecvLock lock(*this);
+    return ch_->Recv(buf, len);
+  }
+
+  size_t Send(const LocalMemoryRegion::ptr &lmr) override { return SendV(&lmr, 1); }
+
+  size_t Recv(const LocalMemoryRegion::ptr &lmr) override {
+    RecvLock lock(*this);
+    return ch_->Recv(lmr);
+  }
+
+  size_t ISend(void *buf, size_t len, const EventLoop::ptr &evloop) override {
+    if (IsProgressLoop(evloop)) {
+      return 0;
+    }
+    size_t ret;
+    {
+      BothLock lock(*this);
+      ret = ch_->ISend(buf, len, capture_);
+      Captured();
+    }
+    Watch(evloop);
+    return ret;
+  }
+
+  size_t IRecv(void *buf, size_t len, const EventLoop::ptr &evloop) override {
+    if (IsProgressLoop(evloop)) {
+      return 0;
+    }
+    size_t ret;
+    {
+      BothLock lock(*this);
+      ret = ch_->IRecv(buf, len, capture_);
+      Captured();
+    }
+    Watch(evloop);
+    return ret;
+  }
+
+  size_t SendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
+    SendReq req;
+    req.lmr = lmr;
+    req.lmrcnt = lmrcnt;
+    req.len = 0;
+    for (size_t i = 0; i < lmrcnt; i++) {
+      req.len += lmr[i]->GetLength();
+    }
+    req.ret = 0;
+    req.done.store(false, std::memory_order_relaxed);
+    queue_.Push(&req);
+
+    for (int n = 0; !req.done.load(std::memory_order_acquire); n++) {
+      // once it has waited for a while, a sender sleeps until it can combine rather than keep spinning
+      if (n < max_spins_ ? send_mtx_.try_lock() : (send_mtx_.lock(), true)) {
+        Combine();
+        send_mtx_.unlock();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    return req.ret;
+  }
+
+  size_t RecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
+    RecvLock lock(*this);
+    return ch_->RecvV(lmr, lmrcnt);
+  }
+
+  size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
+    if (IsProgressLoop(evloop)) {
+      return 0;
+    }
+    size_t ret;
+    {
+      BothLock lock(*this);
+      ret = ch_->ISendV(lmr, lmrcnt, capture_);
+      Captured();
+    }
+    Watch(evloop);
+    return ret;
+  }
+
+  size_t SendMsgV(const LocalMemoryRegion::ptr *const *lmr, const size_t *lmrcnts, size_t msgcnt) override {
+    SendLock lock(*this);
+    return ch_->SendMsgV(lmr, lmrcnts, msgcnt);
+  }
+
+  size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
+    if (IsProgressLoop(evloop)) {
+      return 0;
+    }
+    size_t ret;
+    {
+      BothLock lock(*this);
+      ret = ch_->IRecvV(lmr, lmrcnt, capture_);
+      Captured();
+    }
+    Watch(evloop);
+    return ret;
+  }
+
+  size_t Write(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
+    BothLock lock(*this);
+    return ch_->Write(buf, len, rmr);
+  }
+
+  size_t Read(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
+    BothLock lock(*this);
+    return ch_->Read(buf, len, rmr);
+  }
+
+  size_t Write(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr) override {
+    BothLock lock(*this);
+    return ch_->Write(lmr, rmr);
+  }
+
+  size_t Read(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr) override {
+    BothLock lock(*this);
+    return ch_->Read(lmr, rmr);
+  }
+
+  size_t WriteV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
+    BothLock lock(*this);
+    return ch_->WriteV(lmr, rmr, cnt);
+  }
+
+  size_t ReadV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
+    BothLock lock(*this);
+    return ch_->ReadV(lmr, rmr, cnt);
+  }
+
+  bool WriteNotify(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr, uint32_t value) override {
+    SendLock lock(*this);
+    return ch_->WriteNotify(lmr, rmr, value);
+  }
+
+  bool WaitNotify(uint32_t &value) override {
+    RecvLock lock(*this);
+    return ch_->WaitNotify(value);
+  }
+
+  size_t AtomicV(AtomicOp *ops, size_t cnt) override {
+    BothLock lock(*this);
+    return ch_->AtomicV(ops, cnt);
+  }
+
+  // memory can be registered by any thread at any time
+  LocalMemoryRegion::ptr RegisterMemoryRegion(void *addr, size_t len, int type) const override {
+    return ch_->RegisterMemoryRegion(addr, len, type);
+  }
+
+  void SynRemoteMemoryRegionV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
+    BothLock lock(*this);
+    ch_->SynRemoteMemoryRegionV(lmr, lmrcnt);
+  }
+
+  void AckRemoteMemoryRegionV(RemoteMemoryRegion *rmr, size_t rmrcnt) override {
+    BothLock lock(*this);
+    ch_->AckRemoteMemoryRegionV(rmr, rmrcnt);
+  }
+
+  PerfSnapshot GetPerfCounters() const override { return ch_->GetPerfCounters(); }
+
+  void SetWaitPolicy(const WaitPolicy &policy) override {
+    BothLock lock(*this);
+    ch_->SetWaitPolicy(policy);
+  }
+
+  // a blocked Recv() keeps no sender waiting, whatever the channel wrapped
+  bool IsFullDuplex() const override { return true; }
+
+  int OnEvent(int event_type, void *arg) override {
+    BothLock lock(*this);
+    // they may have been completed by a blocking operation meanwhile
+    return async_pending_ ? Forwarded(handler_->OnEvent(event_type, arg)) : MAY_BE_REMOVED;
+  }
+
+  int OnError(int error_type) override {
+    BothLock lock(*this);
+    return async_pending_ ? Forwarded(handler_->OnError(error_type)) : MAY_BE_REMOVED;
+  }
+
+  // the event loops find the endpoint, or the socket, of the channel wrapped through its ID
+  void *GetHandlerID() const override {
+    BothLock lock(*this);
+    return handler_->GetHandlerID();
+  }
+
+  short GetEventType() const override {
+    BothLock lock(*this);
+    return async_pending_ ? handler_->GetEventType() : 0;
+  }
+
+ private:
+  // the most sends combined into a SendMsgV()
+  static const size_t kMaxBatch = 64;
+  // the most batches a combiner sends before it lets go of the channel
+  static const size_t kMaxBatchesPerCombine = 16;
+  // how many times a sender tries to become the combiner before it waits on the channel
+  static const int kMaxSpins = 100;
+
+  // the lock of the whole channel, taken in the order of send_mtx_ and recv_mtx_
+  class BothLock {
+   public:
+    explicit BothLock(const ThreadSafeChannel &ch) : send_lock_(ch.send_mtx_), recv_lock_(ch.recv_mtx_) {}
+
+   private:
+    std::lock_guard<std::mutex> send_lock_;
+    std::lock_guard<std::mutex> recv_lock_;
+  };
+
+  // the lock of the send side, and of the receive side too unless they can go on at once.
+  class SendLock {
+   public:
+    explicit SendLock(ThreadSafeChannel &ch) : ch_(ch), both_(false) {
+      ch_.send_mtx_.lock();
+      // async_pending_ can't change without send_mtx_
+      if (!ch_.duplex_ || ch_.async_pending_) {
+        ch_.recv_mtx_.lock();
+        both_ = true;
+      }
+    }
+
+    ~SendLock() {
+      if (both_) {
+        ch_.Refresh();
+        ch_.recv_mtx_.unlock();
+      }
+      ch_.send_mtx_.unlock();
+    }
+
+   private:
+    ThreadSafeChannel &ch_;
+    bool both_;
+  };
+
+  // the lock of the receive side, and of the send side too unless they can go on at once.
+  class RecvLock {
+   public:
+    explicit RecvLock(ThreadSafeChannel &ch) : ch_(ch), both_(false) {
+      ch_.recv_mtx_.lock();
+      if (!ch_.duplex_ || ch_.async_pending_) {
+        // send_mtx_ is the first to be taken
+        ch_.recv_mtx_.unlock();
+        ch_.send_mtx_.lock();
+        ch_.recv_mtx_.lock();
+        both_ = true;
+      }
+    }
+
+    ~RecvLock() {
+      if (both_) {
+        ch_.Refresh();
+        ch_.send_mtx_.unlock();
+      }
+      ch_.recv_mtx_.unlock();
+    }
+
+   private:
+    ThreadSafeChannel &ch_;
+    bool both_;
+  };
+
+  // an event loop which only takes the handler of the asynchronous operations posted on the channel wrapped, so that
+  // the channel is completed through this one instead.
+  class CaptureLoop : public EventLoop {
+   public:
+    CaptureLoop() : handler_(nullptr) {}
+
+    void AddHandler(EventHandler &handler) override { handler_ = &handler; }
+
+    int WaitAll(int timeout_millis) override { return 0; }
+
+    PerfSnapshot GetPerfCounters() const override { return PerfSnapshot(); }
+
+    EventHandler *Take() {
+      auto handler = handler_;
+      handler_ = nullptr;
+      return handler;
+    }
+
+   private:
+    EventHandler *handler_;
+  };
+
+  // a send waiting on the stack of its thread
+  struct SendReq : public MPSCNode {
+    const LocalMemoryRegion::ptr *lmr;
+    size_t lmrcnt;
+    size_t len;
+    size_t ret;
+    std::atomic<bool> done;
+  };
+
+  Channel::ptr ch_;
+  int max_spins_;
+  bool duplex_;
+  MPSCQueue<SendReq> queue_;
+  // held by the combiner, or by any send
+  mutable std::mutex send_mtx_;
+  // held by any receive, and by the send side too unless duplex_ is set and async_pending_ is not
+  mutable std::mutex recv_mtx_;
+  EventLoop::ptr capture_;
+  // the handler of the asynchronous operations in flight, if async_pending_ is set (written holding both the locks)
+  EventHandler *handler_ = nullptr;
+  bool async_pending_ = false;
+  // owned by the combiner
+  std::vector<SendReq *> batch_;
+  std::vector<const LocalMemoryRegion::ptr *> batch_lmrs_;
+  std::vector<size_t> batch_lmrcnts_;
+
+  static bool IsProgressLoop(const EventLoop::ptr &evloop) {
+    return dynamic_cast<socket::SocketProgressLoop *>(evloop.get()) != nullptr;
+  }
+
+  // takes the handler the channel wrapped has given to capture_, if any (holding both the locks).
+  void Captured() {
+    auto handler = static_cast<CaptureLoop *>(capture_.get())->Take();
+    if (handler) {
+      handler_ = handler;
+      async_pending_ = true;
+    }
+  }
+
+  // lets (evloop) complete the asynchronous operations through this channel.
+  void Watch(const EventLoop::ptr &evloop) {
+    bool pending;
+    {
+      BothLock lock(*this);
+      pending = async_pending_;
+    }
+    if (pending) {
+      evloop->AddHandler(*this);
+    }
+  }
+
+  // notices the asynchronous operations completed by a blocking one (holding both the locks).
+  void Refresh() {
+    if (async_pending_ && handler_->GetEventType() == 0) {
+      async_pending_ = false;
+    }
+  }
+
+  int Forwarded(int ret) {
+    if (ret == MAY_BE_REMOVED) {
+      async_pending_ = false;
+    }
+    return ret;
+  }
+
+  // sends what has been queued so far in batches, and lets their senders return.
+  void Combine() {
+    // the same as SendLock, except that send_mtx_ is held already
+    bool both = !duplex_ || async_pending_;
+    if (both) {
+      recv_mtx_.lock();
+    }
+    CombineLocked();
+    if (both) {
+      Refresh();
+      recv_mtx_.unlock();
+    }
+  }
+
+  void CombineLocked() {
+    for (size_t n = 0; n < kMaxBatchesPerCombine; n++) {
+      batch_.clear();
+      batch_lmrs_.clear();
+      batch_lmrcnts_.clear();
+      while (batch_.size() < kMaxBatch) {
+        auto req = queue_.Pop();
+        if (!req) {
+          break;
+        }
+        batch_.push_back(req);
+        batch_lmrs_.push_back(req->lmr);
+        batch_lmrcnts_.push_back(req->lmrcnt);
+      }
+      if (batch_.empty()) {
+        return;
+      }
+
+      auto num_sent = ch_->SendMsgV(batch_lmrs_.data(), batch_lmrcnts_.data(), batch_.size());
+      for (size_t i = 0; i < batch_.size(); i++) {
+        batch_[i]->ret = (i < num_sent) ? batch_[i]->len : 0;
+        // the request is gone from the stack of its sender as soon as it is done
+        batch_[i]->done.store(true, std::memory_order_release);
+      }
+    }
+  }
+};
+
+} // namespace rnetlib
+
+#endif // RNETLIB_THREAD_SAFE_CHANNEL_H_
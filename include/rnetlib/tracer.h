@@ -0,0 +1,230 @@
+#ifndef RNETLIB_TRACER_H_
+#define RNETLIB_TRACER_H_
+
+#ifdef RNETLIB_ENABLE_TRACE
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef RNETLIB_TRACE_RING_SIZE
+// # of records per thread (has to be a power of two)
+#define RNETLIB_TRACE_RING_SIZE 65536
+#endif // RNETLIB_TRACE_RING_SIZE
+
+#define RNETLIB_TRACE_CONCAT_(a, b) a##b
+#define RNETLIB_TRACE_CONCAT(a, b) RNETLIB_TRACE_CONCAT_(a, b)
+
+// records the duration of the enclosing scope.
+#define RNETLIB_TRACE_SCOPE(name, arg) \
+  rnetlib::TraceScope RNETLIB_TRACE_CONCAT(trace_scope_, __LINE__)(name, static_cast<uint64_t>(arg))
+
+// records a point in time.
+#define RNETLIB_TRACE_INSTANT(name, arg) \
+  rnetlib::Tracer::GetInstance().Record(rnetlib::TRACE_INSTANT, name, static_cast<uint64_t>(arg), \
+                                        rnetlib::Tracer::Now(), 0)
+
+namespace rnetlib {
+
+enum TracePhase : uint32_t {
+  TRACE_COMPLETE = 0,
+  TRACE_INSTANT
+};
+
+// a fixed-size binary record. names have to be string literals.
+struct TraceRecord {
+  uint64_t beg_ticks;
+  uint64_t end_ticks; // 0 for instant events
+  const char *name;
+  uint64_t arg;
+};
+
+// A single-producer/single-consumer ring owned by one thread.
+// Records are dropped (and counted) while the ring is full.
+class TraceRing {
+ public:
+  explicit TraceRing(uint32_t tid) : tid_(tid), head_(0), tail_(0), num_dropped_(0), records_(kRingSize) {}
+
+  void Push(const TraceRecord &rec) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kRingSize) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    records_[head & (kRingSize - 1)] = rec;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  template <typename F>
+  void Drain(F &&f) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      f(records_[tail & (kRingSize - 1)]);
+    }
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  uint32_t GetTID() const { return tid_; }
+
+  uint64_t GetNumDropped() const { return num_dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static const uint64_t kRingSize = RNETLIB_TRACE_RING_SIZE;
+  static_assert((kRingSize & (kRingSize - 1)) == 0, "RNETLIB_TRACE_RING_SIZE has to be a power of two");
+
+  static const size_t kCacheLineSize = 64;
+
+  // the producer and the consumer update their own cache line
+  // (padded rather than aligned, since operator new does not honor over-aligned types in C++11).
+  const uint32_t tid_;
+  std::atomic<uint64_t> head_;
+  char padding0_[kCacheLineSize];
+  std::atomic<uint64_t> tail_;
+  char padding1_[kCacheLineSize];
+  std::atomic<uint64_t> num_dropped_;
+  std::vector<TraceRecord> records_;
+};
+
+class Tracer {
+ public:
+  static Tracer &GetInstance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  ~Tracer() {
+    // dump whatever is left if a trace file is given by the environment.
+    auto path = std::getenv("RNETLIB_TRACE_FILE");
+    if (path) {
+      DumpChromeTrace(path);
+    }
+  }
+
+  // returns a timestamp in ticks (the TSC on x86; nanoseconds elsewhere).
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return NowNsecs();
+#endif
+  }
+
+  void Record(TracePhase phase, const char *name, uint64_t arg, uint64_t beg_ticks, uint64_t end_ticks) {
+    GetRing().Push({beg_ticks, (phase == TRACE_INSTANT) ? 0 : end_ticks, name, arg});
+  }
+
+  // moves all the records collected so far into a Chrome trace (chrome://tracing, ui.perfetto.dev).
+  void DumpChromeTrace(std::ostream &os) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto nsecs_per_tick = GetNsecsPerTick();
+    auto pid = getpid();
+    bool first = true;
+
+    os << "{\"traceEvents\":[";
+    for (const auto &ring : rings_) {
+      ring->Drain([&](const TraceRecord &rec) {
+        auto ts = (rec.beg_ticks - base_ticks_) * nsecs_per_tick / 1e3;
+        os << (first ? "\n" : ",\n") << "{\"name\":\"" << rec.name << "\",\"pid\":" << pid
+           << ",\"tid\":" << ring->GetTID() << ",\"ts\":" << ts;
+        if (rec.end_ticks == 0) {
+          os << ",\"ph\":\"i\",\"s\":\"t\"";
+        } else {
+          os << ",\"ph\":\"X\",\"dur\":" << (rec.end_ticks - rec.beg_ticks) * nsecs_per_tick / 1e3;
+        }
+        os << ",\"args\":{\"arg\":" << rec.arg << "}}";
+        first = false;
+      });
+    }
+    os << "\n],\"otherData\":{\"dropped\":" << GetNumDroppedLocked() << "}}" << std::endl;
+  }
+
+  bool DumpChromeTrace(const std::string &path) {
+    std::ofstream ofs(path);
+    if (!ofs) {
+      return false;
+    }
+    DumpChromeTrace(ofs);
+    return static_cast<bool>(ofs);
+  }
+
+  uint64_t GetNumDropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GetNumDroppedLocked();
+  }
+
+ private:
+  // guards rings_, which new threads append to
+  mutable std::mutex mutex_;
+  // rings outlive their threads so that records of finished threads can still be dumped.
+  std::vector<std::unique_ptr<TraceRing>> rings_;
+  uint64_t base_ticks_;
+  uint64_t base_nsecs_;
+
+  Tracer() : base_ticks_(Now()), base_nsecs_(NowNsecs()) {}
+
+  uint64_t GetNumDroppedLocked() const {
+    uint64_t num_dropped = 0;
+    for (const auto &ring : rings_) {
+      num_dropped += ring->GetNumDropped();
+    }
+    return num_dropped;
+  }
+
+  static uint64_t NowNsecs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  // calibrates ticks against the steady clock over the lifetime of the tracer.
+  double GetNsecsPerTick() const {
+    auto ticks = Now() - base_ticks_;
+    auto nsecs = NowNsecs() - base_nsecs_;
+    return (ticks > 0) ? static_cast<double>(nsecs) / ticks : 1.;
+  }
+
+  TraceRing &GetRing() {
+    static thread_local TraceRing *ring = nullptr;
+    if (!ring) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.emplace_back(new TraceRing(static_cast<uint32_t>(rings_.size())));
+      ring = rings_.back().get();
+    }
+    return *ring;
+  }
+};
+
+class TraceScope {
+ public:
+  // the tracer is created first, so that no record begins before its base timestamp.
+  TraceScope(const char *name, uint64_t arg)
+      : tracer_(Tracer::GetInstance()), name_(name), arg_(arg), beg_ticks_(Tracer::Now()) {}
+
+  ~TraceScope() { tracer_.Record(TRACE_COMPLETE, name_, arg_, beg_ticks_, Tracer::Now()); }
+
+ private:
+  Tracer &tracer_;
+  const char *name_;
+  uint64_t arg_;
+  uint64_t beg_ticks_;
+};
+
+} // namespace rnetlib
+
+#else
+
+#define RNETLIB_TRACE_SCOPE(name, arg)
+#define RNETLIB_TRACE_INSTANT(name, arg)
+
+#endif // RNETLIB_ENABLE_TRACE
+
+#endif // RNETLIB_TRACER_H_
@@ -1,88 +1,172 @@
 #ifndef RNETLIB_VERBS_VERBS_CHANNEL_H_
 #define RNETLIB_VERBS_VERBS_CHANNEL_H_
 
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/uio.h>
 #include <infiniband/verbs.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
 
 #include "rnetlib/channel.h"
 #include "rnetlib/eager_buffer.h"
+#include "rnetlib/event_handler.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
 #include "rnetlib/verbs/verbs_common.h"
+#include "rnetlib/verbs/verbs_eager_ring.h"
 #include "rnetlib/verbs/verbs_local_memory_region.h"
+#include "rnetlib/verbs/verbs_shared_queue.h"
 
 namespace rnetlib {
 namespace verbs {
 
-class VerbsChannel : public Channel {
+class VerbsChannel : public Channel, public EventHandler {
  public:
   explicit VerbsChannel(VerbsCommon::RDMACommID id) : VerbsChannel(std::move(id), 0) {}
-  VerbsChannel(VerbsCommon::RDMACommID id, uint64_t peer_desc)
-      : id_(std::move(id)), peer_desc_(peer_desc), num_recv_wr_(0), num_send_wr_(0),
-        recv_buf_(*this), send_buf_(*this) {
+  // (shared) is given if the QP of (id) has been created on a VerbsSharedQueue.
+  // (eager_ring) sends small messages over RDMA writes into a ring of the peer once SetUpEagerRing() is done.
+  VerbsChannel(VerbsCommon::RDMACommID id, uint64_t peer_desc, VerbsSharedQueue::ptr shared = nullptr,
+               bool eager_ring = false)
+      : shared_(std::move(shared)), id_(std::move(id)), peer_desc_(peer_desc), num_recv_wr_(0), num_send_wr_(0),
+        num_retired_recv_wrs_(0), num_retired_send_wrs_(0), inbox_(nullptr), posted_recv_buf_(0) {
     struct ibv_qp_attr attr;
     struct ibv_qp_init_attr init_attr;
 
     ibv_query_qp(id_->qp, &attr, 0, &init_attr);
     max_inline_data_ = attr.cap.max_inline_data;
+
+    struct ibv_port_attr port_attr;
+    ibv_query_port(id_->verbs, 1, &port_attr);
+    max_msg_sz_ = port_attr.max_msg_sz;
+
+    if (eager_ring) {
+      ring_.reset(new VerbsEagerRing(shared_ ? shared_->GetPD() : id_->pd));
+    }
+
+    if (shared_) {
+      // messages are received with the SRQ, and completions are sorted out by the shared queue.
+      max_recv_wr_ = max_recv_sge_ = 0;
+      max_send_wr_ = attr.cap.max_send_wr;
+      max_send_sge_ = attr.cap.max_send_sge;
+      inbox_ = &shared_->Attach(id_->qp->qp_num, *this);
+      comp_channels_.send = comp_channels_.recv = nullptr;
+      return;
+    }
+
     // max_recv_wr has to be at least twice as big as max_send_wr
     // so that Recv Queue constantly keeps "max_send_wr" requests for incoming requests.
     max_recv_wr_ = std::min(attr.cap.max_send_wr, attr.cap.max_recv_wr);
     max_send_wr_ = max_recv_wr_ - 2;
     max_recv_sge_ = max_send_sge_ = std::min(attr.cap.max_send_sge, attr.cap.max_recv_sge);
+    send_buf_.reset(new EagerBuffer(*this));
+
+    comp_channels_.send = id_->send_cq_channel;
+    comp_channels_.recv = id_->recv_cq_channel;
+    // completion events are picked up by OnEvent(), which must not block on them
+    for (auto cq_channel : {id_->send_cq_channel, id_->recv_cq_channel}) {
+      if (cq_channel) {
+        fcntl(cq_channel->fd, F_SETFL, fcntl(cq_channel->fd, F_GETFL) | O_NONBLOCK);
+      }
+    }
 
-    struct ibv_port_attr port_attr;
-    ibv_query_port(id_->verbs, 1, &port_attr);
-    max_msg_sz_ = port_attr.max_msg_sz;
-
-    struct ibv_sge sge = {
-        .addr = reinterpret_cast<uintptr_t>(recv_buf_.GetAddr()),
-        .length = EAGER_THRESHOLD,
-        .lkey = *(reinterpret_cast<uint32_t *>(recv_buf_.GetLKey()))
-    };
-    PostRecv(&sge, 1);
+    recv_bufs_.emplace_back(new EagerBuffer(*this));
+    PostRecvBuf(0);
   }
 
   virtual ~VerbsChannel() {
     if (id_) {
       rdma_disconnect(id_.get());
+      if (shared_) {
+        shared_->Detach(id_->qp->qp_num);
+      } else {
+        // CQs with unacknowledged events cannot be destroyed
+        AckCQEvents();
+      }
     }
   }
 
   uint64_t GetDesc() const override { return peer_desc_; }
 
+  // exchanges the eager rings of both sides. both sides have to call this right after connecting.
+  bool SetUpEagerRing() {
+    if (!ring_ || !ring_->IsValid()) {
+      return false;
+    }
+
+    // the rings are not connected yet, so the descriptors go the usual way.
+    auto desc = ring_->GetDesc();
+    VerbsEagerRing::Desc peer_desc;
+    if (Send(&desc, sizeof(desc)) != sizeof(desc) || Recv(&peer_desc, sizeof(peer_desc)) != sizeof(peer_desc)) {
+      return false;
+    }
+    ring_->SetPeerDesc(peer_desc);
+
+    return true;
+  }
+
   size_t Send(void *buf, size_t len) override {
+    RNETLIB_TRACE_SCOPE("verbs_send", len);
+    RNETLIB_PROBE3(protocol, this, len, len <= EAGER_THRESHOLD);
+    if (UseEagerRing(len)) {
+      struct iovec iov = {buf, len};
+      return SendRing(&iov, 1);
+    }
     if (len <= EAGER_THRESHOLD) {
       // eager-send
-      send_buf_.Write(buf, len);
+      RNETLIB_PROBE1(send_entry, this);
+      std::memcpy(GetSendBuf(), buf, len);
       struct ibv_sge sge = {
-          .addr = reinterpret_cast<uintptr_t>(send_buf_.GetAddr()),
+          .addr = reinterpret_cast<uintptr_t>(GetSendBuf()),
           .length = static_cast<uint32_t>(len),
-          .lkey = *(reinterpret_cast<uint32_t *>(send_buf_.GetLKey()))
+          .lkey = GetSendBufLKey()
       };
       if (PostSend(IBV_WR_SEND, &sge, 1, nullptr, 0) != 1) {
         // error
         return 0;
       };
+      perf_.Add(PERF_SEND_OPS);
+      perf_.Add(PERF_SEND_BYTES, len);
+      perf_.Add(PERF_EAGER_OPS);
 
-      return PollSendCQ(num_send_wr_) ? len : 0;
+      auto ret = PollSendCQ(num_send_wr_) ? len : 0;
+      RNETLIB_PROBE2(send_return, this, ret);
+      return ret;
     }
     // rendezvous-send
     return Send(RegisterMemoryRegion(buf, len, MR_LOCAL_READ));
   }
 
   size_t Recv(void *buf, size_t len) override {
+    RNETLIB_TRACE_SCOPE("verbs_recv", len);
+    RNETLIB_PROBE3(protocol, this, len, len <= EAGER_THRESHOLD);
+    if (UseEagerRing(len)) {
+      struct iovec iov = {buf, len};
+      return RecvRing(&iov, 1);
+    }
+    if (shared_) {
+      // every message is received into the SRQ and copied out, whatever its length is.
+      RNETLIB_PROBE1(recv_entry, this);
+      AsyncOp op(0, len);
+      op.iov.push_back({buf, len});
+      auto ret = RecvShared(op);
+      RNETLIB_PROBE2(recv_return, this, ret);
+      return ret;
+    }
     if (len <= EAGER_THRESHOLD) {
       // eager-recv
+      RNETLIB_PROBE1(recv_entry, this);
+      assert(recv_ops_.empty());
       // refill a eager-recv request
-      struct ibv_sge sge = {
-          .addr = reinterpret_cast<uintptr_t>(recv_buf_.GetAddr()),
-          .length = EAGER_THRESHOLD,
-          .lkey = *(reinterpret_cast<uint32_t *>(recv_buf_.GetLKey()))
-      };
-      if (PostRecv(&sge, 1) != 1) {
+      auto &recv_buf = *recv_bufs_[posted_recv_buf_];
+      if (!PostRecvBuf(posted_recv_buf_)) {
         // error
         return 0;
       }
@@ -91,8 +175,13 @@ class VerbsChannel : public Channel {
         // error
         return 0;
       }
+      perf_.Add(PERF_RECV_OPS);
+      perf_.Add(PERF_RECV_BYTES, len);
+      perf_.Add(PERF_EAGER_OPS);
 
-      return recv_buf_.Read(buf, len);
+      auto ret = recv_buf.Read(buf, len);
+      RNETLIB_PROBE2(recv_return, this, ret);
+      return ret;
     }
     // rendezvous-recv
     return Recv(RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE));
@@ -103,17 +192,36 @@ class VerbsChannel : public Channel {
   size_t Recv(const LocalMemoryRegion::ptr &lmr) override { return RecvV(&lmr, 1); }
 
   size_t ISend(void *buf, size_t len, const EventLoop::ptr &evloop) override {
-    // TODO: implement this.
-    return 0;
+    // TODO: copy small messages into pre-registered buffers instead of registering them
+    auto lmr = RegisterMemoryRegion(buf, len, MR_LOCAL_READ);
+    auto ret = PostISendV(&lmr, 1);
+    if (ret > 0) {
+      // keep the region registered until the transfer completes
+      send_ops_.back().lmr = std::move(lmr);
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t IRecv(void *buf, size_t len, const EventLoop::ptr &evloop) override {
-    // TODO: implement this.
-    return 0;
+    auto lmr = RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE);
+    auto ret = PostIRecvV(&lmr, 1);
+    if (ret > 0) {
+      recv_ops_.back().lmr = std::move(lmr);
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t SendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
-    assert(num_send_wr_ == 0);
+    RNETLIB_TRACE_SCOPE("verbs_sendv", lmrcnt);
+    if (ring_) {
+      auto iov = ToIOVec(lmr, lmrcnt);
+      if (UseEagerRing(GetIOVecLength(iov))) {
+        return SendRing(iov.data(), iov.size());
+      }
+    }
+    RNETLIB_PROBE1(send_entry, this);
     size_t sent_len = 0;
     std::vector<struct ibv_sge> sges;
     sges.reserve(lmrcnt);
@@ -138,7 +246,7 @@ class VerbsChannel : public Channel {
           // error
           return 0;
         }
-        if (!PollSendCQ(1)) {
+        if (!PollSendCQ(num_send_wr_)) {
           return 0;
         }
         sent_len += sending_len;
@@ -159,12 +267,74 @@ class VerbsChannel : public Channel {
       // error
       return 0;
     }
+    perf_.Add(PERF_SEND_OPS);
+    perf_.Add(PERF_SEND_BYTES, sent_len);
+    perf_.Add(PERF_RENDEZVOUS_OPS);
 
-    return PollSendCQ(num_send_wr_) ? sent_len : 0;
+    auto ret = PollSendCQ(num_send_wr_) ? sent_len : 0;
+    RNETLIB_PROBE2(send_return, this, ret);
+    return ret;
+  }
+
+  // the WRs of the messages are posted together and waited for once, except for those sent through the ring.
+  size_t SendMsgV(const LocalMemoryRegion::ptr *const *lmr, const size_t *lmrcnts, size_t msgcnt) override {
+    RNETLIB_TRACE_SCOPE("verbs_sendmsgv", msgcnt);
+    RNETLIB_PROBE1(send_entry, this);
+    size_t num_sent = 0, num_queued = 0, queued_len = 0;
+
+    for (size_t i = 0; i < msgcnt; i++) {
+      if (ring_) {
+        auto iov = ToIOVec(lmr[i], lmrcnts[i]);
+        auto len = GetIOVecLength(iov);
+        if (UseEagerRing(len)) {
+          // the messages queued up go first
+          if (!FlushSendMsgs(num_queued, queued_len)) {
+            return num_sent;
+          }
+          num_sent += num_queued;
+          num_queued = queued_len = 0;
+          if (SendRing(iov.data(), iov.size()) != len) {
+            return num_sent;
+          }
+          num_sent++;
+          continue;
+        }
+      }
+      auto len = AppendSendV(lmr[i], lmrcnts[i]);
+      perf_.Add((len <= EAGER_THRESHOLD) ? PERF_EAGER_OPS : PERF_RENDEZVOUS_OPS);
+      queued_len += len;
+      num_queued++;
+    }
+    if (FlushSendMsgs(num_queued, queued_len)) {
+      num_sent += num_queued;
+    }
+
+    RNETLIB_PROBE2(send_return, this, num_sent);
+    return num_sent;
   }
 
   size_t RecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
-    assert(num_recv_wr_ == 1);
+    RNETLIB_TRACE_SCOPE("verbs_recvv", lmrcnt);
+    if (ring_) {
+      auto iov = ToIOVec(lmr, lmrcnt);
+      if (UseEagerRing(GetIOVecLength(iov))) {
+        return RecvRing(iov.data(), iov.size());
+      }
+    }
+    RNETLIB_PROBE1(recv_entry, this);
+    if (shared_) {
+      AsyncOp op(0, 0);
+      for (size_t i = 0; i < lmrcnt; i++) {
+        if (lmr[i]->GetLength() > 0) {
+          op.iov.push_back({lmr[i]->GetAddr(), lmr[i]->GetLength()});
+          op.len += lmr[i]->GetLength();
+        }
+      }
+      auto ret = RecvShared(op);
+      RNETLIB_PROBE2(recv_return, this, ret);
+      return ret;
+    }
+    assert(recv_ops_.empty() && num_recv_wr_ == 1);
 
     size_t recvd_len = 0;
     std::vector<struct ibv_sge> sges;
@@ -207,12 +377,8 @@ class VerbsChannel : public Channel {
     }
 
     // refill a eager-recv request
-    struct ibv_sge sge = {
-        .addr = reinterpret_cast<uintptr_t>(recv_buf_.GetAddr()),
-        .length = EAGER_THRESHOLD,
-        .lkey = *(reinterpret_cast<uint32_t *>(recv_buf_.GetLKey()))
-    };
-    if (PostRecv(&sge, 1) != 1) {
+    auto &recv_buf = *recv_bufs_[posted_recv_buf_];
+    if (!PostRecvBuf(posted_recv_buf_)) {
       // error
       return 0;
     }
@@ -221,60 +387,89 @@ class VerbsChannel : public Channel {
       // error
       return 0;
     }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, recvd_len);
+    perf_.Add(PERF_RENDEZVOUS_OPS);
 
     // copy the received header part to the user buffer.
-    recv_buf_.Read(head_sge_addr, head_sge_len);
+    recv_buf.Read(head_sge_addr, head_sge_len);
+    RNETLIB_PROBE2(recv_return, this, recvd_len);
 
     return recvd_len;
   }
 
+  // (lmr) has to stay registered until (evloop) has completed the transfer.
   size_t ISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
-    // TODO: implement this.
-    return 0;
+    auto ret = PostISendV(lmr, lmrcnt);
+    if (ret > 0) {
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
+  // (lmr) has to stay registered until (evloop) has completed the transfer.
   size_t IRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt, const EventLoop::ptr &evloop) override {
-    // TODO: implement this.
-    return 0;
+    auto ret = PostIRecvV(lmr, lmrcnt);
+    if (ret > 0) {
+      WatchAsyncOps(evloop);
+    }
+    return ret;
   }
 
   size_t Write(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
+    RNETLIB_TRACE_SCOPE("verbs_write", len);
+    RNETLIB_PROBE3(protocol, this, len, len <= EAGER_THRESHOLD);
     assert(len == rmr.length);
     if (len <= EAGER_THRESHOLD) {
       // eager-write
-      send_buf_.Write(buf, len);
+      RNETLIB_PROBE1(write_entry, this);
+      std::memcpy(GetSendBuf(), buf, len);
       struct ibv_sge sge = {
-          .addr = reinterpret_cast<uintptr_t>(send_buf_.GetAddr()),
+          .addr = reinterpret_cast<uintptr_t>(GetSendBuf()),
           .length = static_cast<uint32_t>(len),
-          .lkey = *(reinterpret_cast<uint32_t *>(send_buf_.GetLKey()))
+          .lkey = GetSendBufLKey()
       };
       if (PostSend(IBV_WR_RDMA_WRITE, &sge, 1, reinterpret_cast<void *>(rmr.addr), rmr.rkey) != 1) {
         return 0;
       }
-      return PollSendCQ(num_send_wr_) ? len : 0;
+      perf_.Add(PERF_WRITE_OPS);
+      perf_.Add(PERF_WRITE_BYTES, len);
+      perf_.Add(PERF_EAGER_OPS);
+      auto ret = PollSendCQ(num_send_wr_) ? len : 0;
+      RNETLIB_PROBE2(write_return, this, ret);
+      return ret;
     }
     // rendezvous-write
     return Write(RegisterMemoryRegion(buf, len, MR_LOCAL_READ), rmr);
   }
 
   size_t Read(void *buf, size_t len, const RemoteMemoryRegion &rmr) override {
+    RNETLIB_TRACE_SCOPE("verbs_read", len);
+    RNETLIB_PROBE3(protocol, this, len, len <= EAGER_THRESHOLD);
     assert(len == rmr.length);
     if (len <= EAGER_THRESHOLD) {
       // eager-read
+      RNETLIB_PROBE1(read_entry, this);
       struct ibv_sge sge = {
-          .addr = reinterpret_cast<uintptr_t>(send_buf_.GetAddr()),
+          .addr = reinterpret_cast<uintptr_t>(GetSendBuf()),
           .length = static_cast<uint32_t>(len),
-          .lkey = *(reinterpret_cast<uint32_t *>(send_buf_.GetLKey()))
+          .lkey = GetSendBufLKey()
       };
       if (PostSend(IBV_WR_RDMA_READ, &sge, 1, reinterpret_cast<void *>(rmr.addr), rmr.rkey) != 1) {
         return 0;
       }
 
-      if (!PollSendCQ(num_recv_wr_)) {
+      if (!PollSendCQ(num_send_wr_)) {
         return 0;
       }
-
-      return send_buf_.Read(buf, len);
+      perf_.Add(PERF_READ_OPS);
+      perf_.Add(PERF_READ_BYTES, len);
+      perf_.Add(PERF_EAGER_OPS);
+
+      std::memcpy(buf, GetSendBuf(), len);
+      auto ret = len;
+      RNETLIB_PROBE2(read_return, this, ret);
+      return ret;
     }
     // rendezvous-read
     return Read(RegisterMemoryRegion(buf, len, MR_LOCAL_WRITE), rmr);
@@ -289,9 +484,12 @@ class VerbsChannel : public Channel {
   }
 
   size_t WriteV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
+    RNETLIB_TRACE_SCOPE("verbs_writev", cnt);
+    RNETLIB_PROBE1(write_entry, this);
     struct ibv_sge sge;
-    size_t len, total_len = 0;
+    size_t len, total_len = 0, num_ops = 0;
 
+    // every region gets its own WR, but all of them are posted at once.
     for (size_t i = 0; i < cnt; i++) {
       len = lmr[i]->GetLength();
       if (len > 0) {
@@ -299,21 +497,32 @@ class VerbsChannel : public Channel {
         sge.addr = reinterpret_cast<uintptr_t>(lmr[i]->GetAddr());
         sge.length = static_cast<uint32_t>(len);
         sge.lkey = *(static_cast<uint32_t *>(lmr[i]->GetLKey()));
-        if (PostSend(IBV_WR_RDMA_WRITE, &sge, 1, reinterpret_cast<void *>(rmr[i].addr), rmr[i].rkey) != 1) {
-          // error
-          break;
-        }
+        AppendSend(IBV_WR_RDMA_WRITE, &sge, 1, reinterpret_cast<void *>(rmr[i].addr), rmr[i].rkey);
         total_len += len;
+        num_ops++;
       }
     }
+    if (!FlushSend()) {
+      // error
+      PollSendCQ(num_send_wr_);
+      return 0;
+    }
+    perf_.Add(PERF_WRITE_OPS, num_ops);
+    perf_.Add(PERF_WRITE_BYTES, total_len);
+    perf_.Add(PERF_RENDEZVOUS_OPS);
 
-    return PollSendCQ(num_send_wr_) ? total_len : 0;
+    auto ret = PollSendCQ(num_send_wr_) ? total_len : 0;
+    RNETLIB_PROBE2(write_return, this, ret);
+    return ret;
   }
 
   size_t ReadV(const LocalMemoryRegion::ptr *lmr, const RemoteMemoryRegion *rmr, size_t cnt) override {
+    RNETLIB_TRACE_SCOPE("verbs_readv", cnt);
+    RNETLIB_PROBE1(read_entry, this);
     struct ibv_sge sge;
-    size_t len, total_len = 0;
+    size_t len, total_len = 0, num_ops = 0;
 
+    // every region gets its own WR, but all of them are posted at once.
     for (size_t i = 0; i < cnt; i++) {
       len = lmr[i]->GetLength();
       if (len > 0) {
@@ -321,19 +530,121 @@ class VerbsChannel : public Channel {
         sge.addr = reinterpret_cast<uintptr_t>(lmr[i]->GetAddr());
         sge.length = static_cast<uint32_t>(len);
         sge.lkey = *(static_cast<uint32_t *>(lmr[i]->GetLKey()));
-        if (PostSend(IBV_WR_RDMA_READ, &sge, 1, reinterpret_cast<void *>(rmr[i].addr), rmr[i].rkey) != 1) {
-          // error
-          break;
-        }
+        AppendSend(IBV_WR_RDMA_READ, &sge, 1, reinterpret_cast<void *>(rmr[i].addr), rmr[i].rkey);
         total_len += len;
+        num_ops++;
+      }
+    }
+    if (!FlushSend()) {
+      // error
+      PollSendCQ(num_send_wr_);
+      return 0;
+    }
+    perf_.Add(PERF_READ_OPS, num_ops);
+    perf_.Add(PERF_READ_BYTES, total_len);
+    perf_.Add(PERF_RENDEZVOUS_OPS);
+
+    auto ret = PollSendCQ(num_send_wr_) ? total_len : 0;
+    RNETLIB_PROBE2(read_return, this, ret);
+    return ret;
+  }
+
+  // the notification rides on the last WR of the write as its immediate data.
+  bool WriteNotify(const LocalMemoryRegion::ptr &lmr, const RemoteMemoryRegion &rmr, uint32_t value) override {
+    RNETLIB_TRACE_SCOPE("verbs_write_notify", lmr->GetLength());
+    RNETLIB_PROBE1(write_entry, this);
+    auto len = lmr->GetLength();
+    assert(len == rmr.length);
+    auto raddr = reinterpret_cast<void *>(rmr.addr);
+
+    if (len > 0) {
+      struct ibv_sge sge = {
+          .addr = reinterpret_cast<uintptr_t>(lmr->GetAddr()),
+          .length = static_cast<uint32_t>(len),
+          .lkey = *(static_cast<uint32_t *>(lmr->GetLKey()))
+      };
+      AppendSend(IBV_WR_RDMA_WRITE, &sge, 1, raddr, rmr.rkey);
+    } else {
+      // a notification alone, which takes a WR without SGEs
+      struct ibv_send_wr wr;
+      std::memset(&wr, 0, sizeof(wr));
+      wr.wr.rdma.rkey = rmr.rkey;
+      wr.wr.rdma.remote_addr = rmr.addr;
+      send_wr_heads_.push_back(send_sges_.size());
+      send_wrs_.push_back(wr);
+    }
+    auto &last_wr = send_wrs_.back();
+    last_wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    last_wr.imm_data = htonl(value);
+
+    if (!FlushSend()) {
+      // error
+      PollSendCQ(num_send_wr_);
+      return false;
+    }
+    perf_.Add(PERF_WRITE_OPS);
+    perf_.Add(PERF_WRITE_BYTES, len);
+
+    auto ret = PollSendCQ(num_send_wr_);
+    RNETLIB_PROBE2(write_return, this, ret ? len : 0);
+    return ret;
+  }
+
+  bool WaitNotify(uint32_t &value) override {
+    RNETLIB_TRACE_SCOPE("verbs_wait_notify", 0);
+    if (shared_) {
+      waiter_.Begin();
+      while (inbox_->notifications.empty()) {
+        if (!PollShared()) {
+          return false;
+        }
       }
+      waiter_.End();
+      value = inbox_->notifications.front();
+      inbox_->notifications.pop_front();
+      return true;
     }
 
-    return PollSendCQ(num_send_wr_) ? total_len : 0;
+    if (notifications_.empty()) {
+      assert(recv_ops_.empty());
+      // the notification takes the eager buffer posted for the next message. wait for it before posting the buffer
+      // again, so that nothing changes if the wait times out.
+      if (!PollRecvCQ(1) || !PostRecvBuf(posted_recv_buf_)) {
+        return false;
+      }
+      if (notifications_.empty()) {
+        // error: a message has come instead
+        return false;
+      }
+    }
+    value = notifications_.front();
+    notifications_.pop_front();
+    return true;
+  }
+
+  size_t AtomicV(AtomicOp *ops, size_t cnt) override {
+    RNETLIB_TRACE_SCOPE("verbs_atomicv", cnt);
+    // the previous values land in the eager buffer, so post as many operations at a time as it holds.
+    const size_t max_ops = EAGER_THRESHOLD / sizeof(uint64_t);
+
+    for (size_t offset = 0; offset < cnt; offset += max_ops) {
+      if (!PostAtomics(ops + offset, std::min(cnt - offset, max_ops))) {
+        // error
+        return 0;
+      }
+    }
+    perf_.Add(PERF_ATOMIC_OPS, cnt);
+
+    return cnt;
   }
 
   LocalMemoryRegion::ptr RegisterMemoryRegion(void *addr, size_t len, int type) const override {
-    return VerbsLocalMemoryRegion::Register(id_->pd, addr, len, type);
+    RNETLIB_TRACE_SCOPE("verbs_reg_mr", len);
+    RNETLIB_PROBE2(mr_reg_entry, addr, len);
+    perf_.Add(PERF_MR_REGS);
+    auto lmr = VerbsLocalMemoryRegion::Register(shared_ ? shared_->GetPD() : id_->pd, addr, len, type);
+    RNETLIB_PROBE2(mr_reg_return, addr, len);
+    return lmr;
   }
 
   void SynRemoteMemoryRegionV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) override {
@@ -351,9 +662,66 @@ class VerbsChannel : public Channel {
     Recv(rmr, sizeof(RemoteMemoryRegion) * rmrcnt);
   }
 
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
+  // NOTE: messages over an eager ring are always spun for.
+  void SetWaitPolicy(const WaitPolicy &policy) override { waiter_.SetPolicy(policy); }
+
+  int OnEvent(int event_type, void *arg) override {
+    RNETLIB_TRACE_SCOPE("verbs_on_event", event_type);
+    if (!shared_) {
+      // consume the notifications and re-arm the CQs before draining them, so that no completion is missed.
+      AckCQEvents();
+      ArmCQs();
+    }
+    ProgressAsyncOps();
+
+    return (send_ops_.empty() && recv_ops_.empty()) ? MAY_BE_REMOVED : 0;
+  }
+
+  int OnError(int error_type) override { return MAY_BE_REMOVED; }
+
+  void *GetHandlerID() const override { return const_cast<VerbsCommon::CompChannels *>(&comp_channels_); }
+
+  // VerbsEventLoop waits on the completion channels of the channels with pending operations.
+  // (with shared queues, the VerbsSharedQueue waits on behalf of its channels)
+  short GetEventType() const override { return (send_ops_.empty() && recv_ops_.empty()) ? 0 : POLLIN; }
+
   const struct rdma_cm_id *GetIDPtr() const { return id_.get(); }
 
  private:
+  // an asynchronous operation, which completes once (seq) WRs have been retired on its queue
+  struct AsyncOp {
+    AsyncOp(uint64_t seq, size_t len, size_t recv_buf_idx = 0, void *head_addr = nullptr, size_t head_len = 0)
+        : seq(seq), len(len), recv_buf_idx(recv_buf_idx), head_addr(head_addr), head_len(head_len) {}
+
+    uint64_t seq;
+    size_t len;
+    // registered on behalf of ISend/IRecv
+    LocalMemoryRegion::ptr lmr;
+    // recv only: the eager buffer holding the head of the message
+    size_t recv_buf_idx;
+    void *head_addr;
+    size_t head_len;
+    // recv with shared queues only: the buffers messages are copied into, and how far they have been filled
+    std::vector<struct iovec> iov;
+    size_t iov_idx = 0;
+    size_t num_recvd = 0;
+    size_t num_msgs = 0;
+  };
+
+  // max # of eager buffers for receiving, i.e., asynchronous receives in flight
+  static const size_t kMaxRecvBufs = 8;
+
+  // a signaled send WR every this many WRs
+  static const uint64_t kSignalInterval = 64;
+  // # of completions taken by a single ibv_poll_cq
+  static const int kMaxPollEntries = 32;
+  // a sleep while waiting on the ring
+  static const int kRingNapMicros = 50;
+
+  // destroyed after the QP
+  VerbsSharedQueue::ptr shared_;
   VerbsCommon::RDMACommID id_;
   uint64_t peer_desc_;
   uint32_t max_inline_data_;
@@ -364,70 +732,219 @@ class VerbsChannel : public Channel {
   uint32_t num_recv_wr_;
   uint32_t num_send_wr_;
   uint32_t max_msg_sz_;
-  // pre-allocated buffer for eager send/recv
-  EagerBuffer recv_buf_;
-  EagerBuffer send_buf_;
+  // # of WRs retired since the channel was created
+  uint64_t num_retired_recv_wrs_;
+  uint64_t num_retired_send_wrs_;
+  // constructed before the eager buffers, which register memory through this channel
+  mutable PerfCounters perf_;
+  Waiter waiter_;
+  VerbsCommon::CompChannels comp_channels_;
+  VerbsSharedQueue::Inbox *inbox_;
+  std::unique_ptr<VerbsEagerRing> ring_;
+  // pre-allocated buffer for eager send (the one of the shared queue is used instead, if any)
+  std::unique_ptr<EagerBuffer> send_buf_;
+  // pre-allocated buffers for eager recv. one of them is always posted,
+  // and more are allocated on demand for asynchronous receives.
+  std::vector<std::unique_ptr<EagerBuffer>> recv_bufs_;
+  size_t posted_recv_buf_;
+  std::deque<AsyncOp> send_ops_;
+  std::deque<AsyncOp> recv_ops_;
+  // the values of RDMA writes with immediate data taken from the recv CQ
+  std::deque<uint32_t> notifications_;
+
+  // send WRs (and their SGEs) built up by AppendSend() and posted together by FlushSend()
+  std::vector<struct ibv_send_wr> send_wrs_;
+  std::vector<struct ibv_sge> send_sges_;
+  std::vector<size_t> send_wr_heads_;
 
   /***
     FIXME: the current implementation could exhaust recv_wrs in remote QP
     when sending more than max_send_wr_ requests at a time
   */
-  int PostSend(enum ibv_wr_opcode opcode, struct ibv_sge *sg_list, int num_sges, void *raddr, uint32_t rkey) {
-    int offset = 0;
-    struct ibv_send_wr wr, *bad_wr;
-
-    while (offset < num_sges) {
-      int num_sending_sges = (num_sges - offset) > max_send_sge_ ? max_send_sge_ : (num_sges - offset);
+  int PostSend(enum ibv_wr_opcode opcode, const struct ibv_sge *sg_list, int num_sges, void *raddr, uint32_t rkey) {
+    AppendSend(opcode, sg_list, num_sges, raddr, rkey);
+    return FlushSend() ? num_sges : 0;
+  }
 
-      std::memset(&wr, 0, sizeof(wr));
-      wr.sg_list = sg_list + offset;
-      wr.opcode = opcode;
+  // splits (sg_list) into WRs of at most max_send_sge_ SGEs and max_msg_sz_ bytes, and queues them up.
+  void AppendSend(enum ibv_wr_opcode opcode, const struct ibv_sge *sg_list, int num_sges, void *raddr, uint32_t rkey) {
+    auto remote_addr = reinterpret_cast<uintptr_t>(raddr);
+    // a message received with a SRQ has to fit in one of its eager buffers
+    auto max_wr_len = (shared_ && opcode == IBV_WR_SEND) ? static_cast<uint32_t>(EAGER_THRESHOLD) : max_msg_sz_;
+    struct ibv_send_wr wr;
+    uint32_t sending_len = 0;
+    bool opened = false;
+
+    for (int i = 0; i < num_sges; i++) {
+      auto sge = sg_list[i];
+      do {
+        if (!opened) {
+          std::memset(&wr, 0, sizeof(wr));
+          wr.opcode = opcode;
+          if (opcode == IBV_WR_RDMA_READ || opcode == IBV_WR_RDMA_WRITE) {
+            wr.wr.rdma.rkey = rkey;
+            wr.wr.rdma.remote_addr = remote_addr;
+          }
+          send_wr_heads_.push_back(send_sges_.size());
+          sending_len = 0;
+          opened = true;
+        }
 
-      uint32_t sending_len = 0, last_sge_rem = 0;
-      for (int i = 0; i < num_sending_sges; i++) {
+        auto len = std::min(sge.length, max_wr_len - sending_len);
+        send_sges_.push_back({sge.addr, len, sge.lkey});
         wr.num_sge++;
-        if (sending_len + sg_list[offset + i].length > max_msg_sz_) {
-          last_sge_rem = sg_list[offset + i].length - (max_msg_sz_ - sending_len);
-          sg_list[offset + i].length -= last_sge_rem;
-          sending_len = max_msg_sz_;
-          num_sending_sges = i;
-          break;
-        } else {
-          sending_len += sg_list[offset + i].length;
+        sending_len += len;
+        remote_addr += len;
+        sge.addr += len;
+        sge.length -= len;
+
+        if (wr.num_sge == static_cast<int>(max_send_sge_) || sending_len == max_wr_len) {
+          CloseSendWR(wr, sending_len);
+          opened = false;
         }
+      } while (sge.length > 0);
+    }
+    if (opened) {
+      CloseSendWR(wr, sending_len);
+    }
+  }
+
+  void AppendAtomic(enum ibv_wr_opcode opcode, const struct ibv_sge &sge, const AtomicOp &op,
+                    uint64_t compare_add, uint64_t swap) {
+    struct ibv_send_wr wr;
+    std::memset(&wr, 0, sizeof(wr));
+    wr.opcode = opcode;
+    wr.num_sge = 1;
+    wr.wr.atomic.remote_addr = op.rmr.addr + op.offset;
+    wr.wr.atomic.rkey = static_cast<uint32_t>(op.rmr.rkey);
+    wr.wr.atomic.compare_add = compare_add;
+    wr.wr.atomic.swap = swap;
+    send_wr_heads_.push_back(send_sges_.size());
+    send_sges_.push_back(sge);
+    send_wrs_.push_back(wr);
+  }
+
+  // posts (ops) at once and waits for all of them.
+  // verbs has no swap, so a swap reads the word first and then compare-and-swaps it until the swap takes.
+  bool PostAtomics(AtomicOp *ops, size_t cnt) {
+    auto results = static_cast<uint64_t *>(GetSendBuf());
+    struct ibv_sge sge = {0, sizeof(uint64_t), GetSendBufLKey()};
+    std::vector<size_t> swaps;
+    // whether the swaps have only read their words so far
+    bool swaps_reading = true;
+
+    for (size_t i = 0; i < cnt; i++) {
+      sge.addr = reinterpret_cast<uintptr_t>(&results[i]);
+      switch (ops[i].opcode) {
+        case ATOMIC_FETCH_ADD:
+          AppendAtomic(IBV_WR_ATOMIC_FETCH_AND_ADD, sge, ops[i], ops[i].operand, 0);
+          break;
+        case ATOMIC_COMPARE_SWAP:
+          AppendAtomic(IBV_WR_ATOMIC_CMP_AND_SWP, sge, ops[i], ops[i].compare, ops[i].operand);
+          break;
+        case ATOMIC_SWAP:
+          AppendAtomic(IBV_WR_ATOMIC_FETCH_AND_ADD, sge, ops[i], 0, 0);
+          swaps.push_back(i);
+          break;
       }
-      offset += num_sending_sges;
+    }
 
-      if ((opcode == IBV_WR_SEND || opcode == IBV_WR_RDMA_WRITE) && sending_len <= max_inline_data_) {
-        wr.send_flags |= IBV_SEND_INLINE;
+    while (true) {
+      if (!FlushSend()) {
+        // error
+        PollSendCQ(num_send_wr_);
+        return false;
+      }
+      if (!PollSendCQ(num_send_wr_)) {
+        return false;
       }
-      if (opcode == IBV_WR_RDMA_READ || opcode == IBV_WR_RDMA_WRITE) {
-        wr.wr.rdma.rkey = rkey;
-        wr.wr.rdma.remote_addr = reinterpret_cast<uintptr_t>(raddr);
+      if (swaps.empty()) {
+        break;
       }
 
+      // a compare-and-swap took if it has seen the value it expected,
+      // otherwise it is tried again with the value it has seen.
+      std::vector<size_t> retries;
+      for (auto i : swaps) {
+        if (!swaps_reading && results[i] == ops[i].result) {
+          continue;
+        }
+        ops[i].result = results[i];
+        sge.addr = reinterpret_cast<uintptr_t>(&results[i]);
+        AppendAtomic(IBV_WR_ATOMIC_CMP_AND_SWP, sge, ops[i], ops[i].result, ops[i].operand);
+        retries.push_back(i);
+      }
+      swaps.swap(retries);
+      swaps_reading = false;
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+      if (ops[i].opcode != ATOMIC_SWAP) {
+        ops[i].result = results[i];
+      }
+    }
+
+    return true;
+  }
+
+  void CloseSendWR(struct ibv_send_wr &wr, uint32_t sending_len) {
+    if ((wr.opcode == IBV_WR_SEND || wr.opcode == IBV_WR_RDMA_WRITE) && sending_len <= max_inline_data_) {
+      wr.send_flags |= IBV_SEND_INLINE;
+    }
+    send_wrs_.push_back(wr);
+  }
+
+  // posts the queued WRs as linked lists, as long as the send queue has room for them.
+  // only every kSignalInterval-th WR and the last one of each list are signaled; a signaled WR carries
+  // the # of WRs its completion retires in wr_id, since WRs on an RC QP complete in order.
+  bool FlushSend() {
+    bool ok = true;
+    size_t offset = 0, num_wrs = send_wrs_.size();
+
+    while (offset < num_wrs) {
       if (num_send_wr_ == max_send_wr_) {
         // FIXME: this might block
+        perf_.Add(PERF_POST_RETRIES);
         if (!PollSendCQ(1)) {
           // error
+          ok = false;
           break;
         }
       }
 
-      if (ibv_post_send(id_->qp, &wr, &bad_wr)) {
-        // error
-        break;
+      auto num_posting = std::min<size_t>(num_wrs - offset, max_send_wr_ - num_send_wr_);
+      uint64_t num_unsignaled = 0;
+      for (size_t i = offset; i < offset + num_posting; i++) {
+        auto &wr = send_wrs_[i];
+        wr.sg_list = (wr.num_sge > 0) ? &send_sges_[send_wr_heads_[i]] : nullptr;
+        wr.next = (i + 1 < offset + num_posting) ? &send_wrs_[i + 1] : nullptr;
+        wr.wr_id = 0;
+        if (++num_unsignaled == kSignalInterval || wr.next == nullptr) {
+          wr.send_flags |= IBV_SEND_SIGNALED;
+          wr.wr_id = num_unsignaled;
+          num_unsignaled = 0;
+        }
       }
-      num_send_wr_++;
 
-      if (last_sge_rem) {
-        sg_list[offset].addr += sg_list[offset].length;
-        raddr = static_cast<char *>(raddr) + sg_list[offset].length;
-        sg_list[offset].length = last_sge_rem;
+      struct ibv_send_wr *bad_wr;
+      if (ibv_post_send(id_->qp, &send_wrs_[offset], &bad_wr)) {
+        // error
+        // the WRs before bad_wr have been posted; keep track of the ones a signaled WR will retire.
+        for (auto wr = &send_wrs_[offset]; wr != bad_wr; wr++) {
+          num_send_wr_ += static_cast<uint32_t>(wr->wr_id);
+        }
+        ok = false;
+        break;
       }
+      num_send_wr_ += static_cast<uint32_t>(num_posting);
+      offset += num_posting;
+      RNETLIB_TRACE_INSTANT("verbs_post_send", num_posting);
     }
 
-    return offset;
+    send_wrs_.clear();
+    send_sges_.clear();
+    send_wr_heads_.clear();
+    return ok;
   }
 
   int PostRecv(struct ibv_sge *sg_list, int num_sges) {
@@ -457,6 +974,7 @@ class VerbsChannel : public Channel {
 
       if (num_recv_wr_ == max_recv_wr_) {
         // FIXME: this might block
+        perf_.Add(PERF_POST_RETRIES);
         if (!PollRecvCQ(1)) {
           // error
           break;
@@ -468,6 +986,7 @@ class VerbsChannel : public Channel {
         break;
       }
       num_recv_wr_++;
+      RNETLIB_TRACE_INSTANT("verbs_post_recv", recving_len);
 
       if (last_sge_rem) {
         sg_list[offset].addr += sg_list[offset].length;
@@ -478,35 +997,566 @@ class VerbsChannel : public Channel {
     return offset;
   }
 
-  bool PollSendCQ(uint32_t num_cqes) {
-    auto polled = PollCQ(id_->send_cq, num_cqes);
-    num_send_wr_ -= polled;
-    return (polled == num_cqes);
+  // posts the WRs of SendV() without waiting for their completions.
+  size_t PostISendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) {
+    RNETLIB_TRACE_SCOPE("verbs_isendv", lmrcnt);
+    auto sent_len = AppendSendV(lmr, lmrcnt);
+
+    // arm the CQs before posting, so that every completion from now on raises an event.
+    ArmCQs();
+    if (!FlushSend()) {
+      // error
+      return 0;
+    }
+    send_ops_.emplace_back(num_retired_send_wrs_ + num_send_wr_, sent_len);
+    perf_.Add(PERF_SEND_OPS);
+    perf_.Add(PERF_SEND_BYTES, sent_len);
+    perf_.Add((sent_len <= EAGER_THRESHOLD) ? PERF_EAGER_OPS : PERF_RENDEZVOUS_OPS);
+    RNETLIB_TRACE_INSTANT("verbs_isend", sent_len);
+
+    return sent_len;
+  }
+
+  // queues up the WRs of SendV() for FlushSend(), and returns the # of bytes they send.
+  size_t AppendSendV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) {
+    size_t sent_len = 0;
+    std::vector<struct ibv_sge> sges;
+    sges.reserve(lmrcnt);
+
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      if (len == 0) {
+        continue;
+      }
+      auto addr = lmr[i]->GetAddr();
+      auto lkey = *(static_cast<uint32_t *>(lmr[i]->GetLKey()));
+
+      if (sent_len == 0) {
+        // this is the very first part of the transfer, send it to the pre-allocated ReceiveBuffer.
+        auto sending_len = (len > EAGER_THRESHOLD) ? EAGER_THRESHOLD : len;
+        struct ibv_sge sge = {reinterpret_cast<uintptr_t>(addr), static_cast<uint32_t>(sending_len), lkey};
+        AppendSend(IBV_WR_SEND, &sge, 1, nullptr, 0);
+        sent_len += sending_len;
+
+        len -= sending_len;
+        if (len == 0) {
+          continue;
+        }
+        addr = static_cast<char *>(addr) + sending_len;
+      }
+
+      sges.push_back({reinterpret_cast<uintptr_t>(addr), static_cast<uint32_t>(len), lkey});
+      sent_len += len;
+    }
+    AppendSend(IBV_WR_SEND, sges.data(), static_cast<int>(sges.size()), nullptr, 0);
+
+    return sent_len;
+  }
+
+  // posts the WRs queued up for (num_msgs) messages of (len) bytes in all, and waits for them.
+  bool FlushSendMsgs(size_t num_msgs, size_t len) {
+    if (num_msgs == 0) {
+      return true;
+    }
+    if (!FlushSend()) {
+      // error
+      PollSendCQ(num_send_wr_);
+      return false;
+    }
+    if (!PollSendCQ(num_send_wr_)) {
+      return false;
+    }
+    perf_.Add(PERF_SEND_OPS, num_msgs);
+    perf_.Add(PERF_SEND_BYTES, len);
+    return true;
+  }
+
+  // posts the WRs of RecvV() without waiting for their completions.
+  size_t PostIRecvV(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) {
+    RNETLIB_TRACE_SCOPE("verbs_irecvv", lmrcnt);
+    if (shared_) {
+      // nothing to post: the op takes the next messages the shared queue sorts out into the inbox.
+      recv_ops_.emplace_back(0, 0);
+      auto &op = recv_ops_.back();
+      for (size_t i = 0; i < lmrcnt; i++) {
+        if (lmr[i]->GetLength() > 0) {
+          op.iov.push_back({lmr[i]->GetAddr(), lmr[i]->GetLength()});
+          op.len += lmr[i]->GetLength();
+        }
+      }
+      perf_.Add(PERF_RECV_OPS);
+      perf_.Add(PERF_RECV_BYTES, op.len);
+      perf_.Add(PERF_EAGER_OPS);
+      RNETLIB_TRACE_INSTANT("verbs_irecv", op.len);
+      return op.len;
+    }
+    size_t recvd_len = 0;
+    std::vector<struct ibv_sge> sges;
+    sges.reserve(lmrcnt);
+    void *head_sge_addr = nullptr;
+    size_t head_sge_len = 0;
+
+    for (size_t i = 0; i < lmrcnt; i++) {
+      auto len = lmr[i]->GetLength();
+      if (len == 0) {
+        continue;
+      }
+      auto addr = lmr[i]->GetAddr();
+      auto lkey = *(static_cast<uint32_t *>(lmr[i]->GetLKey()));
+
+      if (recvd_len == 0) {
+        // this is the very first part of the transfer, receive it with the pre-allocated ReceiveBuffer.
+        head_sge_addr = addr;
+        if (len > EAGER_THRESHOLD) {
+          head_sge_len = EAGER_THRESHOLD;
+          len -= EAGER_THRESHOLD;
+          addr = static_cast<char *>(addr) + EAGER_THRESHOLD;
+          recvd_len += EAGER_THRESHOLD;
+        } else {
+          head_sge_len = len;
+          recvd_len += len;
+          continue;
+        }
+      }
+
+      sges.push_back({reinterpret_cast<uintptr_t>(addr), static_cast<uint32_t>(len), lkey});
+      recvd_len += len;
+    }
+
+    // the head of this message lands in the eager buffer posted last,
+    // so the next message needs another one until the head has been copied out.
+    auto head_buf = posted_recv_buf_;
+    auto next_buf = GetFreeRecvBuf();
+
+    ArmCQs();
+    auto num_sges = static_cast<int>(sges.size());
+    if (PostRecv(sges.data(), num_sges) != num_sges) {
+      // error
+      return 0;
+    }
+    recv_ops_.emplace_back(num_retired_recv_wrs_ + num_recv_wr_, recvd_len, head_buf, head_sge_addr, head_sge_len);
+    if (!PostRecvBuf(next_buf)) {
+      // error
+      recv_ops_.pop_back();
+      return 0;
+    }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, recvd_len);
+    perf_.Add((recvd_len <= EAGER_THRESHOLD) ? PERF_EAGER_OPS : PERF_RENDEZVOUS_OPS);
+    RNETLIB_TRACE_INSTANT("verbs_irecv", recvd_len);
+
+    return recvd_len;
+  }
+
+  // lets (evloop) complete the asynchronous operations unless they have completed already.
+  void WatchAsyncOps(const EventLoop::ptr &evloop) {
+    ProgressAsyncOps();
+    if (GetEventType() == 0) {
+      return;
+    }
+    if (shared_) {
+      shared_->Activate(*inbox_);
+      shared_->Progress();
+      if (shared_->GetEventType() != 0) {
+        evloop->AddHandler(*shared_);
+      }
+      return;
+    }
+    evloop->AddHandler(*this);
+  }
+
+  // NOTE: ISend()/IRecv() and their vector versions never take the ring,
+  // so they must not be paired with Send()/Recv() of small messages on a channel with an eager ring.
+  bool UseEagerRing(size_t len) const {
+    return ring_ && ring_->IsConnected() && len <= VerbsEagerRing::kMaxMsgSize;
   }
 
-  bool PollRecvCQ(uint32_t num_cqes) {
-    auto polled = PollCQ(id_->recv_cq, num_cqes);
-    num_recv_wr_ -= polled;
-    return (polled == num_cqes);
+  std::vector<struct iovec> ToIOVec(const LocalMemoryRegion::ptr *lmr, size_t lmrcnt) const {
+    std::vector<struct iovec> iov;
+    iov.reserve(lmrcnt);
+    for (size_t i = 0; i < lmrcnt; i++) {
+      if (lmr[i]->GetLength() > 0) {
+        iov.push_back({lmr[i]->GetAddr(), lmr[i]->GetLength()});
+      }
+    }
+    return iov;
   }
 
-  uint32_t PollCQ(struct ibv_cq *cq, uint32_t num_cqes) {
-    int ret = 0;
-    uint32_t num_polled = 0;
-    struct ibv_wc wc;
+  static size_t GetIOVecLength(const std::vector<struct iovec> &iov) {
+    size_t len = 0;
+    for (const auto &v : iov) {
+      len += v.iov_len;
+    }
+    return len;
+  }
 
-    for (uint32_t i = 0; i < num_cqes; i++) {
-      // poll
-      while ((ret = ibv_poll_cq(cq, 1, &wc)) == 0);
+  // eager-send into the next slot of the peer's ring. the message is copied into an outgoing slot, so this returns
+  // once it has been posted.
+  size_t SendRing(const struct iovec *iov, size_t iovcnt) {
+    RNETLIB_PROBE1(send_entry, this);
+    waiter_.Begin();
+    while (!ring_->HasFreeSlot()) {
+      if (!WaitRing()) {
+        return 0;
+      }
+    }
+    waiter_.End();
+    // the outgoing slot is free once the write out of it, kNumSlots messages ago, has completed
+    auto out_seq = ring_->GetOutSlotSeq();
+    if (out_seq > num_retired_send_wrs_ && !PollSendCQ(static_cast<uint32_t>(out_seq - num_retired_send_wrs_))) {
+      return 0;
+    }
 
-      if (ret < 0 || wc.status != IBV_WC_SUCCESS) {
+    auto len = ring_->Pack(iov, iovcnt);
+    auto sge = ring_->GetPackedSGE();
+    if (PostSend(IBV_WR_RDMA_WRITE, &sge, 1, ring_->GetPeerSlot(), ring_->GetPeerDesc().rkey) != 1) {
+      // error
+      return 0;
+    }
+    ring_->Pop(num_retired_send_wrs_ + num_send_wr_);
+    perf_.Add(PERF_SEND_OPS);
+    perf_.Add(PERF_SEND_BYTES, len);
+    perf_.Add(PERF_EAGER_OPS);
+
+    RNETLIB_PROBE2(send_return, this, len);
+    return len;
+  }
+
+  // eager-recv from the next slot of the own ring, which is polled rather than the CQ.
+  size_t RecvRing(const struct iovec *iov, size_t iovcnt) {
+    RNETLIB_PROBE1(recv_entry, this);
+    waiter_.Begin();
+    while (!ring_->HasMessage()) {
+      if (!WaitRing()) {
+        return 0;
+      }
+    }
+    waiter_.End();
+    auto len = ring_->Unpack(iov, iovcnt);
+    if (ring_->NeedsCreditUpdate()) {
+      // let the sender reuse the slots consumed so far
+      auto sge = ring_->StageCredit();
+      auto credit_addr = reinterpret_cast<void *>(ring_->GetPeerDesc().credit_addr);
+      if (PostSend(IBV_WR_RDMA_WRITE, &sge, 1, credit_addr, ring_->GetPeerDesc().rkey) != 1
+          || !PollSendCQ(num_send_wr_)) {
         // error
-        continue;
+        return 0;
+      }
+    }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, len);
+    perf_.Add(PERF_EAGER_OPS);
+
+    RNETLIB_PROBE2(recv_return, this, len);
+    return len;
+  }
+
+  void *GetSendBuf() const { return shared_ ? shared_->GetSendBuf() : send_buf_->GetAddr(); }
+
+  uint32_t GetSendBufLKey() const {
+    return shared_ ? shared_->GetLKey() : *(reinterpret_cast<uint32_t *>(send_buf_->GetLKey()));
+  }
+
+  // the ring: waits as the wait policy says after an empty poll of the ring. nothing notifies of RDMA writes, so
+  // a sleep is a short nap. returns false once the wait has timed out.
+  bool WaitRing() {
+    switch (waiter_.OnEmptyPoll()) {
+      case Waiter::WAIT_TIMED_OUT:
+        perf_.Add(PERF_CQ_TIMEOUTS);
+        return false;
+      case Waiter::WAIT_SLEEP:
+        perf_.Add(PERF_CQ_SLEEPS);
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(kRingNapMicros)));
+        return true;
+      default:
+        return true;
+    }
+  }
+
+  // shared queues: takes the completions available now, or waits for them as the wait policy says.
+  // returns false once the wait has timed out or failed.
+  bool PollShared() {
+    if (shared_->Poll() != 0) {
+      return true;
+    }
+    switch (waiter_.OnEmptyPoll()) {
+      case Waiter::WAIT_TIMED_OUT:
+        perf_.Add(PERF_CQ_TIMEOUTS);
+        return false;
+      case Waiter::WAIT_SLEEP:
+        perf_.Add(PERF_CQ_SLEEPS);
+        return shared_->Sleep(waiter_.GetSleepMillis());
+      default:
+        return true;
+    }
+  }
+
+  // shared queues: waits until the messages in the inbox have filled (op).
+  size_t RecvShared(AsyncOp &op) {
+    assert(recv_ops_.empty());
+    waiter_.Begin();
+    while (!DeliverMessages(op)) {
+      if (!PollShared()) {
+        return 0;
+      }
+    }
+    waiter_.End();
+    if (!inbox_->ok) {
+      return 0;
+    }
+    perf_.Add(PERF_RECV_OPS);
+    perf_.Add(PERF_RECV_BYTES, op.len);
+    perf_.Add(PERF_EAGER_OPS);
+    return op.len;
+  }
+
+  // shared queues: copies the messages in the inbox into (op), and returns whether it has been filled.
+  // a transfer is as many messages as it takes to fill the buffers, but at least one.
+  bool DeliverMessages(AsyncOp &op) {
+    while ((op.num_msgs == 0 || op.num_recvd < op.len) && !inbox_->msgs.empty()) {
+      auto &msg = inbox_->msgs.front();
+      auto src = shared_->GetData(msg);
+      size_t offset = 0;
+      while (offset < msg.len && op.iov_idx < op.iov.size()) {
+        auto &iov = op.iov[op.iov_idx];
+        auto cpylen = std::min<size_t>(iov.iov_len, msg.len - offset);
+        std::memcpy(iov.iov_base, src + offset, cpylen);
+        iov.iov_base = static_cast<char *>(iov.iov_base) + cpylen;
+        iov.iov_len -= cpylen;
+        offset += cpylen;
+        if (iov.iov_len == 0) {
+          op.iov_idx++;
+        }
+      }
+      op.num_recvd += msg.len;
+      op.num_msgs++;
+      shared_->Release(*inbox_, msg);
+      inbox_->msgs.pop_front();
+    }
+
+    return (op.num_msgs > 0 && op.num_recvd >= op.len);
+  }
+
+  // posts a recv WR for the (idx)-th eager buffer, which receives the head of the next message.
+  bool PostRecvBuf(size_t idx) {
+    struct ibv_sge sge = {
+        .addr = reinterpret_cast<uintptr_t>(recv_bufs_[idx]->GetAddr()),
+        .length = EAGER_THRESHOLD,
+        .lkey = *(reinterpret_cast<uint32_t *>(recv_bufs_[idx]->GetLKey()))
+    };
+    if (PostRecv(&sge, 1) != 1) {
+      return false;
+    }
+    posted_recv_buf_ = idx;
+    return true;
+  }
+
+  // returns an eager buffer which is neither posted nor holding the head of a pending receive.
+  size_t GetFreeRecvBuf() {
+    while (true) {
+      for (size_t i = 0; i < recv_bufs_.size(); i++) {
+        auto in_use = std::any_of(recv_ops_.begin(), recv_ops_.end(),
+                                  [i](const AsyncOp &op) { return op.recv_buf_idx == i; });
+        if (i != posted_recv_buf_ && !in_use) {
+          return i;
+        }
+      }
+      if (recv_bufs_.size() < kMaxRecvBufs) {
+        recv_bufs_.emplace_back(new EagerBuffer(*this));
+        return recv_bufs_.size() - 1;
+      }
+      // FIXME: this might block
+      perf_.Add(PERF_POST_RETRIES);
+      PollRecvCQ(static_cast<uint32_t>(recv_ops_.front().seq - num_retired_recv_wrs_));
+    }
+  }
+
+  void ArmCQs() {
+    if (shared_) {
+      // the shared queue arms its CQ by itself
+      return;
+    }
+    ibv_req_notify_cq(id_->send_cq, 0);
+    ibv_req_notify_cq(id_->recv_cq, 0);
+  }
+
+  void AckCQEvents() {
+    struct ibv_cq *cq;
+    void *cq_context;
+
+    for (auto cq_channel : {id_->send_cq_channel, id_->recv_cq_channel}) {
+      // the completion channels are non-blocking
+      while (cq_channel && ibv_get_cq_event(cq_channel, &cq, &cq_context) == 0) {
+        ibv_ack_cq_events(cq, 1);
+      }
+    }
+  }
+
+  // takes the completions available now and completes the asynchronous operations they belong to.
+  void ProgressAsyncOps() {
+    if (shared_) {
+      // the shared queue has sorted the completions of this channel out into the inbox.
+      if (inbox_->num_retired_send_wrs > 0) {
+        RetireSendWRs(static_cast<uint32_t>(inbox_->num_retired_send_wrs));
+        inbox_->num_retired_send_wrs = 0;
+      }
+      while (!recv_ops_.empty() && DeliverMessages(recv_ops_.front())) {
+        RNETLIB_TRACE_INSTANT("verbs_irecv_done", recv_ops_.front().len);
+        recv_ops_.pop_front();
+      }
+      if (send_ops_.empty() && recv_ops_.empty()) {
+        shared_->Deactivate(*inbox_);
+      }
+      return;
+    }
+
+    bool ok = true;
+    uint32_t num_retired = 0;
+
+    while (!send_ops_.empty() && TryPollCQ(id_->send_cq, kMaxPollEntries, true, num_retired, ok) > 0) {
+      RetireSendWRs(num_retired);
+      num_retired = 0;
+    }
+    while (!recv_ops_.empty()) {
+      // leave the completions of the WRs no pending operation is waiting for to synchronous receives.
+      auto num_wrs = recv_ops_.back().seq - num_retired_recv_wrs_;
+      auto max_entries = (num_wrs < kMaxPollEntries) ? static_cast<int>(num_wrs) : kMaxPollEntries;
+      if (TryPollCQ(id_->recv_cq, max_entries, false, num_retired, ok) <= 0) {
+        break;
+      }
+      RetireRecvWRs(num_retired);
+      num_retired = 0;
+    }
+  }
+
+  void RetireSendWRs(uint32_t num_wrs) {
+    num_send_wr_ -= num_wrs;
+    num_retired_send_wrs_ += num_wrs;
+    while (!send_ops_.empty() && send_ops_.front().seq <= num_retired_send_wrs_) {
+      RNETLIB_TRACE_INSTANT("verbs_isend_done", send_ops_.front().len);
+      send_ops_.pop_front();
+    }
+  }
+
+  void RetireRecvWRs(uint32_t num_wrs) {
+    num_recv_wr_ -= num_wrs;
+    num_retired_recv_wrs_ += num_wrs;
+    while (!recv_ops_.empty() && recv_ops_.front().seq <= num_retired_recv_wrs_) {
+      auto &op = recv_ops_.front();
+      if (op.head_len > 0) {
+        // copy the received header part to the user buffer.
+        recv_bufs_[op.recv_buf_idx]->Read(op.head_addr, op.head_len);
+      }
+      RNETLIB_TRACE_INSTANT("verbs_irecv_done", op.len);
+      recv_ops_.pop_front();
+    }
+  }
+
+  // waits until (num_wrs) send WRs have completed.
+  bool PollSendCQ(uint32_t num_wrs) {
+    if (shared_) {
+      auto target = num_retired_send_wrs_ + num_wrs;
+      waiter_.Begin();
+      while (true) {
+        ProgressAsyncOps();
+        if (num_retired_send_wrs_ >= target) {
+          break;
+        }
+        if (!PollShared()) {
+          return false;
+        }
+      }
+      waiter_.End();
+      return inbox_->ok;
+    }
+    uint32_t num_retired = 0;
+    auto ok = PollCQ(id_->send_cq, num_wrs, true, num_retired);
+    RetireSendWRs(num_retired);
+    return ok;
+  }
+
+  // waits until (num_wrs) recv WRs have completed.
+  bool PollRecvCQ(uint32_t num_wrs) {
+    uint32_t num_retired = 0;
+    auto ok = PollCQ(id_->recv_cq, num_wrs, false, num_retired);
+    RetireRecvWRs(num_retired);
+    return ok;
+  }
+
+  // drains up to kMaxPollEntries completions at a time until (num_wrs) WRs are retired.
+  bool PollCQ(struct ibv_cq *cq, uint32_t num_wrs, bool send, uint32_t &num_retired) {
+    bool ok = true;
+    uint64_t num_empty_polls = 0;
+    RNETLIB_TRACE_SCOPE("verbs_poll_cq", num_wrs);
+
+    num_retired = 0;
+    waiter_.Begin();
+    while (num_retired < num_wrs) {
+      // every recv completion delivers a message to whoever is waiting for it, so never take more than needed.
+      int max_entries = kMaxPollEntries;
+      if (!send && num_wrs - num_retired < kMaxPollEntries) {
+        max_entries = static_cast<int>(num_wrs - num_retired);
+      }
+
+      auto ret = TryPollCQ(cq, max_entries, send, num_retired, ok);
+      if (ret == 0) {
+        num_empty_polls++;
+        auto action = waiter_.OnEmptyPoll();
+        if (action == Waiter::WAIT_TIMED_OUT) {
+          perf_.Add(PERF_CQ_TIMEOUTS);
+          ok = false;
+          break;
+        } else if (action == Waiter::WAIT_SLEEP && cq->channel) {
+          // a completion that has come before the CQ got armed raises no event, so poll once more.
+          ibv_req_notify_cq(cq, 0);
+          ret = TryPollCQ(cq, max_entries, send, num_retired, ok);
+          if (ret == 0) {
+            perf_.Add(PERF_CQ_SLEEPS);
+            if (!VerbsCommon::SleepOnCompChannel(cq->channel, waiter_.GetSleepMillis())) {
+              ok = false;
+              break;
+            }
+          }
+        }
+      }
+      if (ret < 0) {
+        // error
+        ok = false;
+        break;
+      }
+    }
+    waiter_.End();
+    RNETLIB_PROBE3(cq_poll, cq, num_retired, num_empty_polls);
+
+    return ok;
+  }
+
+  // takes up to (max_entries) completions without waiting and returns the # of them (-1 on error).
+  // a send completion retires (wr_id) WRs, while a recv completion retires one.
+  int TryPollCQ(struct ibv_cq *cq, int max_entries, bool send, uint32_t &num_retired, bool &ok) {
+    struct ibv_wc wcs[kMaxPollEntries];
+
+    int ret = ibv_poll_cq(cq, max_entries, wcs);
+    perf_.Add(PERF_CQ_POLLS);
+    if (ret == 0) {
+      perf_.Add(PERF_CQ_EMPTY_POLLS);
+    } else if (ret < 0) {
+      perf_.Add(PERF_CQ_ERRORS);
+    }
+
+    for (int i = 0; i < ret; i++) {
+      if (wcs[i].status != IBV_WC_SUCCESS) {
+        // error
+        // FIXME: the QP is in the error state from now on
+        perf_.Add(PERF_CQ_ERRORS);
+        ok = false;
+      } else if (!send && wcs[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+        notifications_.push_back(ntohl(wcs[i].imm_data));
       }
-      num_polled++;
+      num_retired += send ? static_cast<uint32_t>(wcs[i].wr_id) : 1;
     }
 
-    return num_polled;
+    return ret;
   }
 };
 
@@ -9,17 +9,24 @@ namespace verbs {
 
 class VerbsClient : public Client, public EventHandler {
  public:
-  explicit VerbsClient(uint64_t self_desc) : self_desc_(self_desc) {}
+  // the channels connected with (shared_queues) share a receive queue and a CQ (see VerbsSharedQueue).
+  // those connected with (eager_ring) send small messages over RDMA writes (see VerbsEagerRing).
+  explicit VerbsClient(uint64_t self_desc, bool shared_queues = false, bool eager_ring = false)
+      : self_desc_(self_desc), eager_ring_(eager_ring) {
+    if (shared_queues) {
+      shared_ = std::make_shared<VerbsSharedQueue>();
+    }
+  }
 
   ~VerbsClient() override = default;
 
   Channel::ptr Connect(const std::string &peer_addr, uint16_t peer_port, uint64_t peer_desc) override {
-    auto id = VerbsCommon::NewRDMACommID(peer_addr.c_str(), peer_port, 0);
-    if (!id) {
+    auto id = VerbsCommon::NewRDMACommID(peer_addr.c_str(), peer_port, 0, !shared_);
+    if (!id || (shared_ && !shared_->CreateQP(id.get()))) {
       return nullptr;
     }
 
-    channel_.reset(new VerbsChannel(std::move(id), peer_desc));
+    channel_.reset(new VerbsChannel(std::move(id), peer_desc, shared_, eager_ring_));
 
     struct rdma_conn_param conn_param;
     std::memset(&conn_param, 0, sizeof(conn_param));
@@ -34,6 +41,10 @@ class VerbsClient : public Client, public EventHandler {
     if (rdma_connect(const_cast<struct rdma_cm_id *>(channel_->GetIDPtr()), &conn_param)) {
       return nullptr;
     }
+    if (eager_ring_ && !channel_->SetUpEagerRing()) {
+      return nullptr;
+    }
+    RNETLIB_PROBE2(connect, channel_.get(), peer_desc);
 
     return std::move(channel_);
   }
@@ -63,6 +74,7 @@ class VerbsClient : public Client, public EventHandler {
 
   int OnEvent(int event_type, void *arg) override {
     if (event_type == RDMA_CM_EVENT_ESTABLISHED) {
+      RNETLIB_PROBE2(connect, channel_.get(), 0);
       if (on_established_) {
         on_established_(*channel_);
       }
@@ -89,8 +101,10 @@ class VerbsClient : public Client, public EventHandler {
   }
 
  private:
+  VerbsSharedQueue::ptr shared_;
   std::unique_ptr<VerbsChannel> channel_;
   uint64_t self_desc_;
+  bool eager_ring_;
   std::promise<Channel::ptr> promise_;
   std::function<void(Channel &)> on_established_;
 };
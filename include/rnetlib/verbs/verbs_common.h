@@ -1,8 +1,10 @@
 #ifndef RNETLIB_VERBS_VERBS_COMMON_H_
 #define RNETLIB_VERBS_VERBS_COMMON_H_
 
+#include <poll.h>
 #include <rdma/rdma_cma.h>
 
+#include <cerrno>
 #include <memory>
 #include <string>
 
@@ -18,6 +20,12 @@ class VerbsCommon {
 
   using RDMACommID = std::unique_ptr<struct rdma_cm_id, RDMACMIDDeleter>;
 
+  // the completion channels VerbsEventLoop waits on for a handler of asynchronous operations
+  struct CompChannels {
+    struct ibv_comp_channel *send;
+    struct ibv_comp_channel *recv;
+  };
+
   static void SetInitAttr(struct ibv_qp_init_attr &init_attr) {
     // TODO: the following parameters should be user-configurable
     std::memset(&init_attr, 0, sizeof(init_attr));
@@ -26,11 +34,41 @@ class VerbsCommon {
     // max_recv_wr must be bigger than 2
     init_attr.cap.max_send_wr = init_attr.cap.max_recv_wr = 8192;
     init_attr.cap.max_send_sge = init_attr.cap.max_recv_sge = 32;
-    init_attr.sq_sig_all = 1;
+    // VerbsChannel signals send WRs selectively
+    init_attr.sq_sig_all = 0;
     init_attr.cap.max_inline_data = 32;
   }
 
-  static RDMACommID NewRDMACommID(const char *addr, uint16_t port, int flags) {
+  // sleeps until (channel) gets a completion event or (timeout_millis) passes, and consumes the events.
+  // (channel) has to be non-blocking. returns false on error.
+  static bool SleepOnCompChannel(struct ibv_comp_channel *channel, int timeout_millis) {
+    struct pollfd fd = {channel->fd, POLLIN, 0};
+    if (poll(&fd, 1, timeout_millis) < 0 && errno != EINTR) {
+      return false;
+    }
+
+    struct ibv_cq *cq;
+    void *cq_context;
+    while (ibv_get_cq_event(channel, &cq, &cq_context) == 0) {
+      ibv_ack_cq_events(cq, 1);
+    }
+
+    return true;
+  }
+
+  // the send queue depth of a QP on a shared receive queue
+  static const uint32_t kSharedMaxSendWR = 512;
+
+  // for a QP on a shared receive queue, which needs no receive queue of its own.
+  static void SetSharedInitAttr(struct ibv_qp_init_attr &init_attr) {
+    SetInitAttr(init_attr);
+    // a smaller send queue keeps the per-connection footprint small
+    init_attr.cap.max_send_wr = kSharedMaxSendWR;
+    init_attr.cap.max_recv_wr = init_attr.cap.max_recv_sge = 0;
+  }
+
+  // (with_qp) lets rdma_cm create the QP (or the QPs of incoming connections on a passive ID).
+  static RDMACommID NewRDMACommID(const char *addr, uint16_t port, int flags, bool with_qp = true) {
     struct rdma_addrinfo hints, *tmp_addrinfo;
 
     std::memset(&hints, 0, sizeof(hints));
@@ -52,7 +90,7 @@ class VerbsCommon {
     SetInitAttr(init_attr);
 
     struct rdma_cm_id *tmp_id;
-    auto ret = rdma_create_ep(&tmp_id, tmp_addrinfo, nullptr, &init_attr);
+    auto ret = rdma_create_ep(&tmp_id, tmp_addrinfo, nullptr, with_qp ? &init_attr : nullptr);
     rdma_freeaddrinfo(tmp_addrinfo);
     if (ret) {
       // TODO: log error
@@ -0,0 +1,193 @@
+#ifndef RNETLIB_VERBS_VERBS_EAGER_RING_H_
+#define RNETLIB_VERBS_VERBS_EAGER_RING_H_
+
+#include <sys/uio.h>
+#include <infiniband/verbs.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#include "rnetlib/local_memory_region.h"
+#include "rnetlib/verbs/verbs_local_memory_region.h"
+
+namespace rnetlib {
+namespace verbs {
+
+// An eager protocol over RDMA writes instead of two-sided sends.
+// Each side of a channel exposes a ring of fixed-size slots to its peer, and small messages are written
+// straight into the next slot of the peer's ring. The receiver polls the slot in memory rather than a CQ,
+// and writes the # of slots it has consumed back to the sender once every half ring.
+// A slot holds a header, the payload and a flag byte right after the payload. The flag is the last byte
+// to be placed, as long as the HCA places RDMA writes in order (which the spec does not guarantee, but
+// the HCAs this is meant for do).
+// Messages are staged in outgoing slots of their own, one for each slot of the peer, so that the sender waits for
+// the write of a slot only once it comes around to that slot again.
+// Neither side blocks here: the channel polls HasFreeSlot()/HasMessage() under its wait policy.
+class VerbsEagerRing {
+ public:
+  // what the peer needs to write into the ring, exchanged once a connection is established.
+  struct Desc {
+    uint64_t ring_addr;
+    uint64_t credit_addr;
+    uint32_t rkey;
+    uint32_t reserved;
+  };
+
+  static const size_t kNumSlots = 64;
+  static const size_t kSlotSize = 4096;
+
+ private:
+  struct SlotHeader {
+    uint32_t len;
+    // the # of the message plus one, so that an empty slot reads 0
+    uint32_t seq;
+  };
+
+ public:
+  // the largest message a slot can hold
+  static const size_t kMaxMsgSize = kSlotSize - sizeof(SlotHeader) - 1;
+
+  explicit VerbsEagerRing(struct ibv_pd *pd)
+      : buf_(new char[kBufSize]()), num_sent_(0), num_recvd_(0), num_reported_(0), packed_len_(0) {
+    lmr_ = VerbsLocalMemoryRegion::Register(pd, buf_.get(), kBufSize, MR_LOCAL_WRITE | MR_REMOTE_WRITE);
+    std::memset(&peer_desc_, 0, sizeof(peer_desc_));
+    std::memset(out_seqs_, 0, sizeof(out_seqs_));
+  }
+
+  bool IsValid() const { return lmr_ != nullptr; }
+
+  // true once the ring of the peer is known.
+  bool IsConnected() const { return peer_desc_.ring_addr != 0; }
+
+  Desc GetDesc() const {
+    return {reinterpret_cast<uintptr_t>(buf_.get()), reinterpret_cast<uintptr_t>(GetCredit()),
+            static_cast<uint32_t>(lmr_->GetRKey()), 0};
+  }
+
+  void SetPeerDesc(const Desc &desc) { peer_desc_ = desc; }
+
+  const Desc &GetPeerDesc() const { return peer_desc_; }
+
+  // sender: true if the peer has a free slot.
+  bool HasFreeSlot() const {
+    if (num_sent_ - *GetCredit() >= kNumSlots) {
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+
+  // sender: the send WR sequence # the write out of the next outgoing slot retires at (0 if it has not been used).
+  uint64_t GetOutSlotSeq() const { return out_seqs_[num_sent_ % kNumSlots]; }
+
+  // sender: packs a message gathered from (iov) into the next outgoing slot, and returns its length.
+  size_t Pack(const struct iovec *iov, size_t iovcnt) {
+    auto slot = GetOutSlot();
+    auto payload = slot + sizeof(SlotHeader);
+    size_t len = 0;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+      std::memcpy(payload + len, iov[i].iov_base, iov[i].iov_len);
+      len += iov[i].iov_len;
+    }
+    SlotHeader hdr = {static_cast<uint32_t>(len), static_cast<uint32_t>(num_sent_ + 1)};
+    std::memcpy(slot, &hdr, sizeof(hdr));
+    payload[len] = 1;
+
+    packed_len_ = sizeof(SlotHeader) + len + 1;
+    return len;
+  }
+
+  // sender: the packed slot, which is as long as its message needs.
+  struct ibv_sge GetPackedSGE() const {
+    return {reinterpret_cast<uintptr_t>(GetOutSlot()), static_cast<uint32_t>(packed_len_), GetLKey()};
+  }
+
+  // sender: the slot of the peer's ring the packed slot is written to.
+  void *GetPeerSlot() const {
+    return reinterpret_cast<void *>(peer_desc_.ring_addr + (num_sent_ % kNumSlots) * kSlotSize);
+  }
+
+  // sender: moves on to the next slot, once the packed one has been posted with send WR sequence # (seq).
+  void Pop(uint64_t seq) {
+    out_seqs_[num_sent_ % kNumSlots] = seq;
+    num_sent_++;
+  }
+
+  // receiver: true if the next message has been placed in full.
+  bool HasMessage() const {
+    auto slot = buf_.get() + (num_recvd_ % kNumSlots) * kSlotSize;
+    auto hdr = reinterpret_cast<volatile SlotHeader *>(slot);
+    if (hdr->seq != static_cast<uint32_t>(num_recvd_ + 1)) {
+      return false;
+    }
+    uint32_t len = hdr->len;
+    if (*reinterpret_cast<volatile char *>(slot + sizeof(SlotHeader) + len) == 0) {
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+
+  // receiver: scatters the next message into (iov), once HasMessage() has seen it. returns the # of bytes copied.
+  size_t Unpack(const struct iovec *iov, size_t iovcnt) {
+    auto slot = buf_.get() + (num_recvd_ % kNumSlots) * kSlotSize;
+    uint32_t len = reinterpret_cast<SlotHeader *>(slot)->len;
+
+    auto payload = slot + sizeof(SlotHeader);
+    size_t copied = 0;
+    for (size_t i = 0; i < iovcnt && copied < len; i++) {
+      auto cpylen = std::min<size_t>(iov[i].iov_len, len - copied);
+      std::memcpy(iov[i].iov_base, payload + copied, cpylen);
+      copied += cpylen;
+    }
+
+    // clear what has been written, so that neither the header nor a stale payload byte
+    // is taken for the next message in this slot
+    std::memset(slot, 0, sizeof(SlotHeader) + len + 1);
+    num_recvd_++;
+    return copied;
+  }
+
+  // receiver: true if the # of consumed slots has to be written back to the sender.
+  bool NeedsCreditUpdate() const { return (num_recvd_ - num_reported_) >= kNumSlots / 2; }
+
+  // receiver: stages the # of consumed slots, which is written to (GetPeerDesc().credit_addr).
+  struct ibv_sge StageCredit() {
+    num_reported_ = num_recvd_;
+    *GetReport() = num_reported_;
+    return {reinterpret_cast<uintptr_t>(GetReport()), sizeof(uint64_t), GetLKey()};
+  }
+
+ private:
+  // the ring, the outgoing slots, the credit written by the peer and the one staged for the peer.
+  static const size_t kBufSize = 2 * kNumSlots * kSlotSize + 2 * sizeof(uint64_t);
+
+  std::unique_ptr<char[]> buf_;
+  LocalMemoryRegion::ptr lmr_;
+  Desc peer_desc_;
+  uint64_t num_sent_;
+  uint64_t num_recvd_;
+  uint64_t num_reported_;
+  size_t packed_len_;
+  uint64_t out_seqs_[kNumSlots];
+
+  char *GetOutSlot() const { return buf_.get() + (kNumSlots + num_sent_ % kNumSlots) * kSlotSize; }
+
+  volatile uint64_t *GetCredit() const {
+    return reinterpret_cast<volatile uint64_t *>(buf_.get() + 2 * kNumSlots * kSlotSize);
+  }
+
+  uint64_t *GetReport() const {
+    return reinterpret_cast<uint64_t *>(buf_.get() + 2 * kNumSlots * kSlotSize + sizeof(uint64_t));
+  }
+
+  uint32_t GetLKey() const { return *(reinterpret_cast<uint32_t *>(lmr_->GetLKey())); }
+};
+
+} // namespace verbs
+} // namespace rnetlib
+
+#endif // RNETLIB_VERBS_VERBS_EAGER_RING_H_
@@ -1,14 +1,19 @@
 #ifndef RNETLIB_VERBS_VERBS_EVENT_LOOP_H_
 #define RNETLIB_VERBS_VERBS_EVENT_LOOP_H_
 
+#include <poll.h>
 #include <rdma/rdma_cma.h>
 
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "rnetlib/event_loop.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
+#include "rnetlib/verbs/verbs_common.h"
 
 namespace rnetlib {
 namespace verbs {
@@ -28,68 +33,142 @@ class VerbsEventLoop : public EventLoop {
   VerbsEventLoop() : event_channel_(rdma_create_event_channel()) {}
 
   void AddHandler(EventHandler &handler) override {
-    auto id = reinterpret_cast<struct rdma_cm_id *>(handler.GetHandlerID());
-    rdma_migrate_id(id, event_channel_.get());
+    if (handler.GetEventType() != 0) {
+      // a channel (or shared queues) waiting for completions of its asynchronous operations
+      auto comp_channels = reinterpret_cast<VerbsCommon::CompChannels *>(handler.GetHandlerID());
+      if (cq_handler_refs_.find(comp_channels) == cq_handler_refs_.end()) {
+        cq_handler_refs_.emplace(std::make_pair(comp_channels, std::ref(handler)));
+      }
+      return;
+    }
+    rdma_migrate_id(reinterpret_cast<struct rdma_cm_id *>(handler.GetHandlerID()), event_channel_.get());
     handlers_.emplace_back(std::ref(handler));
   }
 
   int WaitAll(int timeout_millis) override {
-    struct rdma_cm_event *ev;
+    std::vector<struct pollfd> fds;
+    // the handler of each fd (nullptr for the event channel of rdma_cm)
+    std::vector<EventHandler *> fd_handlers;
+
+    while (true) {
+      // channels whose operations have completed in the meantime have nothing left to wait for.
+      for (auto itr = cq_handler_refs_.begin(); itr != cq_handler_refs_.end();) {
+        itr = (itr->second.get().GetEventType() == 0) ? cq_handler_refs_.erase(itr) : std::next(itr);
+      }
+      if (handlers_.empty() && cq_handler_refs_.empty()) {
+        break;
+      }
 
-    while (handlers_.size() > 0) {
-      // get one event from the event channel
-      if (rdma_get_cm_event(event_channel_.get(), &ev)) {
-        // TODO: log error
-        return kErrFailed;
+      fds.clear();
+      fd_handlers.clear();
+      if (!handlers_.empty()) {
+        fds.emplace_back(pollfd{event_channel_->fd, POLLIN, 0});
+        fd_handlers.push_back(nullptr);
+      }
+      for (const auto &handler_ref : cq_handler_refs_) {
+        for (auto cq_channel : {handler_ref.first->send, handler_ref.first->recv}) {
+          if (cq_channel) {
+            fds.emplace_back(pollfd{cq_channel->fd, POLLIN, 0});
+            fd_handlers.push_back(&handler_ref.second.get());
+          }
+        }
       }
 
-      auto handler_itr = std::find_if(handlers_.begin(), handlers_.end(),
-                                      [&ev](const EventHandler &handler) {
-                                        return (handler.GetHandlerID() == ev->id
-                                            || handler.GetHandlerID() == ev->listen_id);
-                                      });
-      if (handler_itr == handlers_.end()) {
-        // got an event on an unknown handler
-        rdma_ack_cm_event(ev);
+      perf_.Add(PERF_LOOP_WAITS);
+      int rc = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout_millis);
+      if (rc < 0) {
+        // TODO: log error
         return kErrFailed;
+      } else if (rc == 0) {
+        // timed out
+        perf_.Add(PERF_LOOP_TIMEOUTS);
+        return kErrTimedOut;
       }
-      auto &handler = (*handler_itr).get();
-
-      switch (ev->event) {
-        case RDMA_CM_EVENT_CONNECT_REQUEST:
-          // got a connect request on passive side.
-          // connection got established successfully.
-          if (handler.OnEvent(ev->event, ev->id) == MAY_BE_REMOVED) {
-            handlers_.erase(handler_itr);
-          }
-          break;
-        case RDMA_CM_EVENT_ESTABLISHED:
-          // connection got established successfully.
-          if (handler.OnEvent(ev->event, nullptr) == MAY_BE_REMOVED) {
-            handlers_.erase(handler_itr);
+      perf_.Add(PERF_LOOP_WAKEUPS);
+      RNETLIB_TRACE_INSTANT("verbs_loop_wakeup", rc);
+      RNETLIB_PROBE2(loop_wakeup, this, rc);
+      perf_.Add(PERF_LOOP_EVENTS, static_cast<uint64_t>(rc));
+
+      for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].revents == 0) {
+          continue;
+        }
+        if (fd_handlers[i] == nullptr) {
+          auto ret = HandleCMEvent();
+          if (ret) {
+            return ret;
           }
-          break;
-        case RDMA_CM_EVENT_CONNECT_ERROR:
-        case RDMA_CM_EVENT_UNREACHABLE:
-        case RDMA_CM_EVENT_REJECTED:
-          // connection failed to be established.
-          if (handler.OnError(ev->event) == MAY_BE_REMOVED) {
-            handlers_.erase(handler_itr);
-          }
-          break;
-        default:
-          break;
+        } else if (fd_handlers[i]->OnEvent(fds[i].revents, nullptr) == MAY_BE_REMOVED) {
+          // the send and the recv CQs of a channel share its handler
+          cq_handler_refs_.erase(reinterpret_cast<VerbsCommon::CompChannels *>(fd_handlers[i]->GetHandlerID()));
+        }
       }
-
-      rdma_ack_cm_event(ev);
     }
 
     return 0;
   }
 
+  PerfSnapshot GetPerfCounters() const override { return perf_.Snapshot(); }
+
  private:
   std::unique_ptr<struct rdma_event_channel, RDMAEventChannelDeleter> event_channel_;
   std::vector<std::reference_wrapper<EventHandler>> handlers_;
+  // handlers of CQs keyed by their completion channels
+  std::unordered_map<VerbsCommon::CompChannels *, std::reference_wrapper<EventHandler>> cq_handler_refs_;
+  PerfCounters perf_;
+
+  // dispatches one connection event to its handler.
+  int HandleCMEvent() {
+    struct rdma_cm_event *ev;
+
+    // get one event from the event channel (it is ready to be read)
+    if (rdma_get_cm_event(event_channel_.get(), &ev)) {
+      // TODO: log error
+      return kErrFailed;
+    }
+
+    auto handler_itr = std::find_if(handlers_.begin(), handlers_.end(),
+                                    [&ev](const EventHandler &handler) {
+                                      return (handler.GetHandlerID() == ev->id
+                                          || handler.GetHandlerID() == ev->listen_id);
+                                    });
+    if (handler_itr == handlers_.end()) {
+      // got an event on an unknown handler
+      rdma_ack_cm_event(ev);
+      return kErrFailed;
+    }
+    auto &handler = (*handler_itr).get();
+
+    switch (ev->event) {
+      case RDMA_CM_EVENT_CONNECT_REQUEST:
+        // got a connect request on passive side.
+        // connection got established successfully.
+        if (handler.OnEvent(ev->event, ev->id) == MAY_BE_REMOVED) {
+          handlers_.erase(handler_itr);
+        }
+        break;
+      case RDMA_CM_EVENT_ESTABLISHED:
+        // connection got established successfully.
+        if (handler.OnEvent(ev->event, nullptr) == MAY_BE_REMOVED) {
+          handlers_.erase(handler_itr);
+        }
+        break;
+      case RDMA_CM_EVENT_CONNECT_ERROR:
+      case RDMA_CM_EVENT_UNREACHABLE:
+      case RDMA_CM_EVENT_REJECTED:
+        // connection failed to be established.
+        if (handler.OnError(ev->event) == MAY_BE_REMOVED) {
+          handlers_.erase(handler_itr);
+        }
+        break;
+      default:
+        break;
+    }
+
+    rdma_ack_cm_event(ev);
+
+    return 0;
+  }
 };
 
 } // namespace verbs
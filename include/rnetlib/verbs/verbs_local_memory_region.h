@@ -32,6 +32,9 @@ class VerbsLocalMemoryRegion : public LocalMemoryRegion {
       // then IBV_ACCESS_LOCAL_WRITE must be set too.
       ibv_mr_type |= IBV_ACCESS_LOCAL_WRITE;
     }
+    if (type & MR_REMOTE_ATOMIC) {
+      ibv_mr_type |= (IBV_ACCESS_REMOTE_ATOMIC | IBV_ACCESS_LOCAL_WRITE);
+    }
 
     auto mr = ibv_reg_mr(pd, addr, length, ibv_mr_type);
     if (!mr) {
@@ -13,13 +13,20 @@ namespace verbs {
 
 class VerbsServer : public Server, public EventHandler {
  public:
-  VerbsServer(const std::string &bind_addr, uint16_t bind_port)
-      : bind_addr_(bind_addr), bind_port_(bind_port) {}
+  // the channels accepted with (shared_queues) share a receive queue and a CQ (see VerbsSharedQueue).
+  // those accepted with (eager_ring) send small messages over RDMA writes (see VerbsEagerRing).
+  VerbsServer(const std::string &bind_addr, uint16_t bind_port, bool shared_queues = false, bool eager_ring = false)
+      : bind_addr_(bind_addr), bind_port_(bind_port), eager_ring_(eager_ring) {
+    if (shared_queues) {
+      shared_ = std::make_shared<VerbsSharedQueue>();
+    }
+  }
 
   virtual ~VerbsServer() = default;
 
   bool Listen() override {
-    listen_id_ = VerbsCommon::NewRDMACommID(bind_addr_.c_str(), bind_port_, RAI_PASSIVE);
+    // QPs on shared queues are created when accepting connections
+    listen_id_ = VerbsCommon::NewRDMACommID(bind_addr_.c_str(), bind_port_, RAI_PASSIVE, !shared_);
     if (!listen_id_) {
       // TODO: log error
       return false;
@@ -40,12 +47,21 @@ class VerbsServer : public Server, public EventHandler {
       return nullptr;
     }
 
+    VerbsCommon::RDMACommID id(new_id);
+    if (shared_ && !shared_->CreateQP(new_id)) {
+      return nullptr;
+    }
+
     auto peer_desc = *(reinterpret_cast<const uint64_t *>(new_id->event->param.conn.private_data));
-    channel_.reset(new VerbsChannel(VerbsCommon::RDMACommID(new_id), peer_desc));
+    channel_.reset(new VerbsChannel(std::move(id), peer_desc, shared_, eager_ring_));
 
     if (rdma_accept(const_cast<struct rdma_cm_id *>(channel_->GetIDPtr()), nullptr)) {
       return nullptr;
     }
+    if (eager_ring_ && !channel_->SetUpEagerRing()) {
+      return nullptr;
+    }
+    RNETLIB_PROBE2(accept, channel_.get(), peer_desc);
 
     // FIXME: might be better to wait for RDMA_CM_EVENT_ESTABLISHED event
     return std::move(channel_);
@@ -109,6 +125,7 @@ class VerbsServer : public Server, public EventHandler {
       }
     } else if (event_type == RDMA_CM_EVENT_ESTABLISHED) {
       // connection established.
+      RNETLIB_PROBE2(accept, channel_.get(), 0);
       if (on_established_) {
         on_established_(*channel_);
       }
@@ -136,10 +153,13 @@ class VerbsServer : public Server, public EventHandler {
   }
 
  private:
+  // declared before the IDs so that the QPs on it are destroyed first
+  VerbsSharedQueue::ptr shared_;
   VerbsCommon::RDMACommID listen_id_;
   std::unique_ptr<VerbsChannel> channel_;
   std::string bind_addr_;
   uint16_t bind_port_;
+  bool eager_ring_;
   std::promise<Channel::ptr> promise_;
   std::function<void(Channel & )> on_established_;
 };
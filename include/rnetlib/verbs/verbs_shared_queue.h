@@ -0,0 +1,416 @@
+#ifndef RNETLIB_VERBS_VERBS_SHARED_QUEUE_H_
+#define RNETLIB_VERBS_VERBS_SHARED_QUEUE_H_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "rnetlib/eager_buffer.h"
+#include "rnetlib/event_handler.h"
+#include "rnetlib/perf_counters.h"
+#include "rnetlib/probes.h"
+#include "rnetlib/tracer.h"
+#include "rnetlib/verbs/verbs_common.h"
+#include "rnetlib/verbs/verbs_local_memory_region.h"
+
+namespace rnetlib {
+namespace verbs {
+
+// A shared receive queue (SRQ) and a completion queue shared by the channels of a VerbsServer/VerbsClient.
+// Incoming messages land in a common pool of eager buffers posted to the SRQ, instead of in buffers and
+// receive queues of every channel. A single progress engine polls the CQ and sorts the completions out
+// into the inboxes of the channels by qp_num.
+// Every message has to fit in an eager buffer, so both sides of a channel have to use shared queues.
+// A channel whose application does not receive must not keep the SRQ empty, or every channel of the device stalls
+// on RNR retries. so once an inbox holds kMaxHeldBufs buffers, or half of the buffers are held, further messages
+// are copied out of their buffers, which go back to the SRQ right away.
+// NOTE: the copies of an inbox are bounded by kMaxCopiedBytes, past which its buffers are kept out of the SRQ
+// again, so that a peer sending to a channel which never receives is held back by RNR retries (rnr_retry_count is
+// infinite), as every other channel of the SRQ then is, rather than growing the heap without bound.
+// NOTE: this is not thread-safe, just like the channels are not.
+class VerbsSharedQueue : public EventHandler {
+ public:
+  using ptr = std::shared_ptr<VerbsSharedQueue>;
+
+  // a received message in the (buf_idx)-th eager buffer, or in (copy) once it has been copied out of it
+  struct Message {
+    size_t buf_idx;
+    uint32_t len;
+    std::unique_ptr<char[]> copy;
+  };
+
+  // the completions of one QP taken from the shared CQ
+  struct Inbox {
+    uint64_t num_retired_send_wrs;
+    std::deque<Message> msgs;
+    // the # of the eager buffers (msgs) keeps out of the SRQ
+    uint32_t num_held_bufs;
+    // the bytes of (msgs) copied out of their buffers
+    size_t num_copied_bytes;
+    // the values of RDMA writes with immediate data, which carry no message
+    std::deque<uint32_t> notifications;
+    // false once a WR of this QP has failed
+    bool ok;
+    // true while the channel has asynchronous operations to complete
+    bool active;
+    EventHandler *handler;
+  };
+
+  explicit VerbsSharedQueue(uint32_t num_bufs = kDefaultNumBufs)
+      : num_bufs_(num_bufs), num_held_bufs_(0), num_active_(0), num_qps_(0), max_cqe_(0), verbs_(nullptr),
+        pd_(nullptr), cq_(nullptr), srq_(nullptr) {
+    comp_channels_.send = comp_channels_.recv = nullptr;
+  }
+
+  ~VerbsSharedQueue() {
+    if (srq_) {
+      ibv_destroy_srq(srq_);
+    }
+    if (cq_) {
+      // CQs with unacknowledged events cannot be destroyed
+      AckCQEvents();
+      ibv_destroy_cq(cq_);
+    }
+    if (comp_channels_.send) {
+      ibv_destroy_comp_channel(comp_channels_.send);
+    }
+    lmr_.reset();
+    if (pd_) {
+      ibv_dealloc_pd(pd_);
+    }
+  }
+
+  // creates the QP of (id) on the shared queues, which are set up on the device of the first ID.
+  bool CreateQP(struct rdma_cm_id *id) {
+    if (!verbs_ && !Init(id->verbs)) {
+      return false;
+    }
+    if (id->verbs != verbs_) {
+      // TODO: set up shared queues per device
+      return false;
+    }
+
+    if (!ReserveCQ(num_qps_ + 1)) {
+      // TODO: set up another CQ when the device cannot grow this one any further
+      return false;
+    }
+
+    struct ibv_qp_init_attr init_attr;
+    VerbsCommon::SetSharedInitAttr(init_attr);
+    init_attr.send_cq = init_attr.recv_cq = cq_;
+    init_attr.srq = srq_;
+
+    if (rdma_create_qp(id, pd_, &init_attr) != 0) {
+      return false;
+    }
+    num_qps_++;
+    return true;
+  }
+
+  Inbox &Attach(uint32_t qp_num, EventHandler &handler) {
+    auto &inbox = inboxes_[qp_num];
+    inbox.num_retired_send_wrs = 0;
+    inbox.num_held_bufs = 0;
+    inbox.num_copied_bytes = 0;
+    inbox.ok = true;
+    inbox.active = false;
+    inbox.handler = &handler;
+    return inbox;
+  }
+
+  void Detach(uint32_t qp_num) {
+    auto itr = inboxes_.find(qp_num);
+    if (itr == inboxes_.end()) {
+      return;
+    }
+    for (const auto &msg : itr->second.msgs) {
+      Release(itr->second, msg);
+    }
+    Deactivate(itr->second);
+    inboxes_.erase(itr);
+    num_qps_--;
+  }
+
+  const char *GetData(const Message &msg) const {
+    return msg.copy ? msg.copy.get() : static_cast<const char *>(GetBuf(msg.buf_idx));
+  }
+
+  // gives the buffer of (msg) back to the SRQ, once the channel has taken (msg) out of (inbox).
+  void Release(Inbox &inbox, const Message &msg) {
+    if (msg.copy) {
+      inbox.num_copied_bytes -= msg.len;
+    } else {
+      inbox.num_held_bufs--;
+      num_held_bufs_--;
+      PostBuf(msg.buf_idx);
+    }
+  }
+
+  // let Progress() hand new completions over to the channel of (inbox) until it has nothing left to wait for.
+  void Activate(Inbox &inbox) {
+    if (!inbox.active) {
+      inbox.active = true;
+      num_active_++;
+    }
+  }
+
+  void Deactivate(Inbox &inbox) {
+    if (inbox.active) {
+      inbox.active = false;
+      num_active_--;
+    }
+  }
+
+  // arms the CQ and takes every completion available now.
+  void Progress() {
+    ibv_req_notify_cq(cq_, 0);
+    while (Poll() > 0);
+  }
+
+  // takes the completions available now and sorts them out into the inboxes.
+  // the channels of the active inboxes are notified through OnEvent(). returns the # of completions.
+  int Poll() {
+    struct ibv_wc wcs[kMaxPollEntries];
+
+    int ret = ibv_poll_cq(cq_, kMaxPollEntries, wcs);
+    perf_.Add(PERF_CQ_POLLS);
+    if (ret <= 0) {
+      perf_.Add((ret == 0) ? PERF_CQ_EMPTY_POLLS : PERF_CQ_ERRORS);
+      return ret;
+    }
+    RNETLIB_PROBE3(cq_poll, cq_, ret, 0);
+
+    for (int i = 0; i < ret; i++) {
+      auto &wc = wcs[i];
+      // the opcode of a failed completion is undefined, but its wr_id is not.
+      auto recv = (wc.wr_id & kRecvWRID) != 0;
+      auto itr = inboxes_.find(wc.qp_num);
+      if (itr == inboxes_.end()) {
+        // the channel has gone
+        if (recv) {
+          PostBuf(wc.wr_id & ~kRecvWRID);
+        }
+        continue;
+      }
+
+      auto &inbox = itr->second;
+      if (wc.status != IBV_WC_SUCCESS) {
+        // error
+        perf_.Add(PERF_CQ_ERRORS);
+        inbox.ok = false;
+      }
+      if (recv && wc.status == IBV_WC_SUCCESS && wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+        // nothing has been placed in the buffer, so it goes back right away
+        inbox.notifications.push_back(ntohl(wc.imm_data));
+        PostBuf(wc.wr_id & ~kRecvWRID);
+      } else if (recv) {
+        Hold(inbox, wc.wr_id & ~kRecvWRID, (wc.status == IBV_WC_SUCCESS) ? wc.byte_len : 0);
+      } else {
+        inbox.num_retired_send_wrs += wc.wr_id;
+      }
+    }
+
+    for (int i = 0; i < ret; i++) {
+      auto itr = inboxes_.find(wcs[i].qp_num);
+      if (itr != inboxes_.end() && itr->second.active
+          && itr->second.handler->OnEvent(POLLIN, nullptr) == MAY_BE_REMOVED) {
+        Deactivate(itr->second);
+      }
+    }
+
+    return ret;
+  }
+
+  // arms the CQ and sleeps until it gets a completion or (timeout_millis) passes. returns false on error.
+  bool Sleep(int timeout_millis) {
+    ibv_req_notify_cq(cq_, 0);
+    // a completion that has come before the CQ got armed raises no event
+    if (Poll() != 0) {
+      return true;
+    }
+    return VerbsCommon::SleepOnCompChannel(comp_channels_.send, timeout_millis);
+  }
+
+  void *GetBuf(size_t idx) const { return buf_.get() + idx * EAGER_THRESHOLD; }
+
+  // returns the (idx)-th eager buffer to the SRQ.
+  bool PostBuf(size_t idx) {
+    struct ibv_sge sge = {
+        .addr = reinterpret_cast<uintptr_t>(GetBuf(idx)),
+        .length = EAGER_THRESHOLD,
+        .lkey = *(reinterpret_cast<uint32_t *>(lmr_->GetLKey()))
+    };
+    struct ibv_recv_wr wr, *bad_wr;
+
+    std::memset(&wr, 0, sizeof(wr));
+    wr.wr_id = idx | kRecvWRID;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    return (ibv_post_srq_recv(srq_, &wr, &bad_wr) == 0);
+  }
+
+  // the buffer eager sends and RMA operations are staged in.
+  // the channels share it, since they do not return until those operations have completed.
+  void *GetSendBuf() const { return GetBuf(num_bufs_); }
+
+  uint32_t GetLKey() const { return *(reinterpret_cast<uint32_t *>(lmr_->GetLKey())); }
+
+  struct ibv_pd *GetPD() const { return pd_; }
+
+  int OnEvent(int event_type, void *arg) override {
+    RNETLIB_TRACE_SCOPE("verbs_srq_on_event", event_type);
+    // consume the notifications and re-arm the CQ before draining it, so that no completion is missed.
+    AckCQEvents();
+    Progress();
+
+    return (num_active_ == 0) ? MAY_BE_REMOVED : 0;
+  }
+
+  int OnError(int error_type) override { return MAY_BE_REMOVED; }
+
+  void *GetHandlerID() const override { return const_cast<VerbsCommon::CompChannels *>(&comp_channels_); }
+
+  short GetEventType() const override { return (num_active_ == 0) ? 0 : POLLIN; }
+
+  PerfSnapshot GetPerfCounters() const { return perf_.Snapshot(); }
+
+ private:
+  static const uint32_t kDefaultNumBufs = 64;
+  // the most eager buffers an inbox keeps out of the SRQ, as long as it can copy messages out of them
+  static const uint32_t kMaxHeldBufs = 8;
+  // the most bytes an inbox copies out of eager buffers
+  static const size_t kMaxCopiedBytes = 8 * EAGER_THRESHOLD;
+  static const int kMaxPollEntries = 32;
+  // tells the completions of recv WRs from those of send WRs, whose wr_id is a # of WRs
+  static const uint64_t kRecvWRID = 1ULL << 63;
+
+  uint32_t num_bufs_;
+  // the # of the eager buffers the inboxes keep out of the SRQ
+  uint32_t num_held_bufs_;
+  uint32_t num_active_;
+  uint32_t num_qps_;
+  int max_cqe_;
+  struct ibv_context *verbs_;
+  struct ibv_pd *pd_;
+  VerbsCommon::CompChannels comp_channels_;
+  struct ibv_cq *cq_;
+  struct ibv_srq *srq_;
+  // eager buffers for the SRQ, followed by the one for sends
+  std::unique_ptr<char[]> buf_;
+  LocalMemoryRegion::ptr lmr_;
+  std::unordered_map<uint32_t, Inbox> inboxes_;
+  PerfCounters perf_;
+
+  bool Init(struct ibv_context *verbs) {
+    pd_ = ibv_alloc_pd(verbs);
+    if (!pd_) {
+      return false;
+    }
+
+    comp_channels_.send = ibv_create_comp_channel(verbs);
+    if (!comp_channels_.send) {
+      return false;
+    }
+    // completion events are picked up by OnEvent(), which must not block on them
+    fcntl(comp_channels_.send->fd, F_SETFL, fcntl(comp_channels_.send->fd, F_GETFL) | O_NONBLOCK);
+
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_device(verbs, &dev_attr) != 0) {
+      return false;
+    }
+    max_cqe_ = dev_attr.max_cqe;
+    // grown by ReserveCQ() as QPs are created
+    cq_ = ibv_create_cq(verbs, std::min(GetCQSize(1), max_cqe_), this, comp_channels_.send, 0);
+    if (!cq_) {
+      return false;
+    }
+
+    struct ibv_srq_init_attr srq_init_attr;
+    std::memset(&srq_init_attr, 0, sizeof(srq_init_attr));
+    srq_init_attr.attr.max_wr = num_bufs_;
+    srq_init_attr.attr.max_sge = 1;
+    srq_ = ibv_create_srq(pd_, &srq_init_attr);
+    if (!srq_) {
+      return false;
+    }
+
+    auto buf_len = static_cast<size_t>(num_bufs_ + 1) * EAGER_THRESHOLD;
+    buf_.reset(new char[buf_len]);
+    lmr_ = VerbsLocalMemoryRegion::Register(pd_, buf_.get(), buf_len, MR_LOCAL_WRITE | MR_LOCAL_READ);
+    if (!lmr_) {
+      return false;
+    }
+    perf_.Add(PERF_MR_REGS);
+
+    for (uint32_t i = 0; i < num_bufs_; i++) {
+      if (!PostBuf(i)) {
+        return false;
+      }
+    }
+
+    verbs_ = verbs;
+    return true;
+  }
+
+  // the CQ never overflows as long as it can take a completion for every eager buffer in the SRQ, and one for every
+  // send WR of every QP.
+  int GetCQSize(uint32_t num_qps) const {
+    return static_cast<int>(num_bufs_ + static_cast<uint64_t>(num_qps) * VerbsCommon::kSharedMaxSendWR);
+  }
+
+  // makes the CQ large enough for (num_qps) QPs. returns false if the device cannot make it that large.
+  bool ReserveCQ(uint32_t num_qps) {
+    auto cqe = GetCQSize(num_qps);
+    if (cqe <= cq_->cqe) {
+      return true;
+    }
+    if (cqe > max_cqe_) {
+      return false;
+    }
+    // grows by half again at least, so that it is not resized for every QP
+    auto new_cqe = std::min(std::max(cqe, cq_->cqe + cq_->cqe / 2), max_cqe_);
+    return (ibv_resize_cq(cq_, new_cqe) == 0);
+  }
+
+  // puts a message received into the (buf_idx)-th eager buffer into (inbox), copying it out of the buffer if the
+  // inbox, or the inboxes altogether, keep too many buffers out of the SRQ, unless the inbox has copied too much.
+  void Hold(Inbox &inbox, size_t buf_idx, uint32_t len) {
+    Message msg;
+    msg.buf_idx = buf_idx;
+    msg.len = len;
+    auto can_hold = inbox.num_held_bufs < kMaxHeldBufs && num_held_bufs_ < num_bufs_ / 2;
+    if (can_hold || inbox.num_copied_bytes + len > kMaxCopiedBytes) {
+      inbox.num_held_bufs++;
+      num_held_bufs_++;
+    } else {
+      msg.copy.reset(new char[len]);
+      std::memcpy(msg.copy.get(), GetBuf(buf_idx), len);
+      inbox.num_copied_bytes += len;
+      PostBuf(buf_idx);
+    }
+    inbox.msgs.push_back(std::move(msg));
+  }
+
+  void AckCQEvents() {
+    struct ibv_cq *cq;
+    void *cq_context;
+
+    // the completion channel is non-blocking
+    while (ibv_get_cq_event(comp_channels_.send, &cq, &cq_context) == 0) {
+      ibv_ack_cq_events(cq, 1);
+    }
+  }
+};
+
+} // namespace verbs
+} // namespace rnetlib
+
+#endif // RNETLIB_VERBS_VERBS_SHARED_QUEUE_H_
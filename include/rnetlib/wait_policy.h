@@ -0,0 +1,137 @@
+#ifndef RNETLIB_WAIT_POLICY_H_
+#define RNETLIB_WAIT_POLICY_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace rnetlib {
+
+// How blocking operations (Send, Recv, Write, ...) wait for their completions.
+struct WaitPolicy {
+  enum Mode {
+    // busy-poll until the completions come (lowest latency, but a core per waiting thread)
+    WAIT_SPIN = 0,
+    // sleep on a completion notification right away
+    WAIT_BLOCK,
+    // spin for a budget that follows the observed completion latency, then sleep
+    WAIT_ADAPTIVE
+  };
+
+  explicit WaitPolicy(Mode mode = WAIT_SPIN, int timeout_millis = -1,
+                      uint64_t min_spin_nsecs = 1000, uint64_t max_spin_nsecs = 100000)
+      : mode(mode), timeout_millis(timeout_millis), min_spin_nsecs(min_spin_nsecs), max_spin_nsecs(max_spin_nsecs) {}
+
+  Mode mode;
+  // an operation fails once it has waited this long (-1 waits forever).
+  // NOTE: the operation stays in flight, so the channel should not be used any more after a timeout.
+  int timeout_millis;
+  // bounds of the spin budget of WAIT_ADAPTIVE
+  uint64_t min_spin_nsecs;
+  uint64_t max_spin_nsecs;
+};
+
+// Keeps track of one wait at a time under a WaitPolicy, and learns the spin budget of WAIT_ADAPTIVE from past waits.
+// Providers poll for completions and ask OnEmptyPoll() what to do whenever nothing has come.
+class Waiter {
+ public:
+  enum Action {
+    // keep polling
+    WAIT_POLL = 0,
+    // arm the notification, poll once more and sleep for up to GetSleepMillis()
+    WAIT_SLEEP,
+    // give up
+    WAIT_TIMED_OUT
+  };
+
+  explicit Waiter(const WaitPolicy &policy = WaitPolicy()) { SetPolicy(policy); }
+
+  void SetPolicy(const WaitPolicy &policy) {
+    policy_ = policy;
+    avg_nsecs_ = policy.min_spin_nsecs;
+    spin_budget_nsecs_ = policy.max_spin_nsecs;
+    Begin();
+  }
+
+  const WaitPolicy &GetPolicy() const { return policy_; }
+
+  void Begin() {
+    num_empty_polls_ = 0;
+    beg_nsecs_ = 0;
+    elapsed_nsecs_ = 0;
+  }
+
+  Action OnEmptyPoll() {
+    if (policy_.mode == WaitPolicy::WAIT_SPIN && policy_.timeout_millis < 0) {
+      return WAIT_POLL;
+    }
+    // the clock costs more than an empty poll, so it is read once every few of them (and on the first one).
+    if (num_empty_polls_++ % kPollsPerClockRead != 0) {
+      return WAIT_POLL;
+    }
+
+    auto now = NowNsecs();
+    if (beg_nsecs_ == 0) {
+      beg_nsecs_ = now;
+    }
+    elapsed_nsecs_ = now - beg_nsecs_;
+
+    if (policy_.timeout_millis >= 0 && elapsed_nsecs_ >= static_cast<uint64_t>(policy_.timeout_millis) * 1000000) {
+      return WAIT_TIMED_OUT;
+    }
+    if (policy_.mode == WaitPolicy::WAIT_BLOCK
+        || (policy_.mode == WaitPolicy::WAIT_ADAPTIVE && elapsed_nsecs_ >= spin_budget_nsecs_)) {
+      return WAIT_SLEEP;
+    }
+
+    return WAIT_POLL;
+  }
+
+  // how long a sleep may last (-1 for no limit).
+  int GetSleepMillis() const {
+    if (policy_.timeout_millis < 0) {
+      return -1;
+    }
+    auto elapsed_millis = static_cast<int>(elapsed_nsecs_ / 1000000);
+    return std::max(policy_.timeout_millis - elapsed_millis, 1);
+  }
+
+  // called once the completions have come, to adapt the spin budget to how long they took.
+  void End() {
+    if (policy_.mode != WaitPolicy::WAIT_ADAPTIVE) {
+      return;
+    }
+
+    auto elapsed = (beg_nsecs_ == 0) ? 0 : NowNsecs() - beg_nsecs_;
+    if (elapsed > policy_.max_spin_nsecs) {
+      // spinning would not have caught this one, so spin less from now on.
+      spin_budget_nsecs_ = std::max(spin_budget_nsecs_ / 2, policy_.min_spin_nsecs);
+    } else {
+      // spin for a couple of times the usual latency.
+      avg_nsecs_ = (avg_nsecs_ * 7 + elapsed) / 8;
+      spin_budget_nsecs_ = std::min(std::max(avg_nsecs_ * 2, policy_.min_spin_nsecs), policy_.max_spin_nsecs);
+    }
+  }
+
+  uint64_t GetSpinBudgetNsecs() const { return spin_budget_nsecs_; }
+
+ private:
+  static const uint64_t kPollsPerClockRead = 64;
+
+  WaitPolicy policy_;
+  // moving average of the waits short enough to spin through
+  uint64_t avg_nsecs_;
+  uint64_t spin_budget_nsecs_;
+  uint64_t num_empty_polls_;
+  uint64_t beg_nsecs_;
+  uint64_t elapsed_nsecs_;
+
+  static uint64_t NowNsecs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+};
+
+} // namespace rnetlib
+
+#endif // RNETLIB_WAIT_POLICY_H_